@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Участок, целиком текстовый или целиком случайный: так файл похож на смесь логов и уже сжатых данных,
+// а не на равномерно «зашумлённый» текст, который не сжимается совсем
+constexpr size_t CORPUS_RUN_SIZE = 512;
+
+enum class SizeDistribution
+{
+	Fixed,
+	Uniform,
+	Pareto,
+};
+
+// Корпус полностью задаётся этими полями: с тем же seed получаются те же файлы байт в байт
+struct CorpusSpec
+{
+	int numFiles = 1000;
+	uint64_t meanSize = 64 * 1024;
+	SizeDistribution distribution = SizeDistribution::Pareto;
+	double paretoAlpha = 1.5; // меньше — тяжелее хвост
+	uint64_t maxSize = 64 * 1024 * 1024;
+	double entropy = 0.25; // доля случайных участков, 0 — только текст, 1 — только шум
+	uint32_t seed = 12345;
+};
+
+struct Corpus
+{
+	std::vector<std::string> files;
+	uint64_t totalBytes = 0;
+	uint64_t largestFile = 0;
+	double bitsPerByte = 0; // энтропия нулевого порядка по всем байтам корпуса
+};
+
+inline SizeDistribution ParseSizeDistribution(const std::string& name)
+{
+	if (name == "fixed")
+	{
+		return SizeDistribution::Fixed;
+	}
+	if (name == "uniform")
+	{
+		return SizeDistribution::Uniform;
+	}
+	if (name == "pareto")
+	{
+		return SizeDistribution::Pareto;
+	}
+	throw std::invalid_argument("Unknown size distribution: " + name + " (use fixed, uniform or pareto)");
+}
+
+inline std::string GetDistributionName(SizeDistribution distribution)
+{
+	switch (distribution)
+	{
+	case SizeDistribution::Fixed:
+		return "fixed";
+	case SizeDistribution::Uniform:
+		return "uniform";
+	case SizeDistribution::Pareto:
+		return "pareto";
+	}
+	return "unknown";
+}
+
+// Короткое имя корпуса для отчётов: по нему сравниваются прогоны с baseline
+inline std::string DescribeCorpus(const CorpusSpec& spec)
+{
+	std::ostringstream name;
+	name << GetDistributionName(spec.distribution);
+	if (spec.distribution == SizeDistribution::Pareto)
+	{
+		name << spec.paretoAlpha;
+	}
+	name << "-" << spec.numFiles << "x" << spec.meanSize << "-e" << spec.entropy << "-s" << spec.seed;
+	return name.str();
+}
+
+// Uniform — от 1 до 2·mean. Pareto — xm / U^(1/α) с xm = mean·(α−1)/α, чтобы среднее было mean;
+// хвост обрезается на maxSize
+inline uint64_t PickFileSize(const CorpusSpec& spec, std::mt19937_64& gen)
+{
+	switch (spec.distribution)
+	{
+	case SizeDistribution::Fixed:
+		return spec.meanSize;
+	case SizeDistribution::Uniform:
+		return std::uniform_int_distribution<uint64_t>(1, std::max<uint64_t>(1, 2 * spec.meanSize - 1))(gen);
+	case SizeDistribution::Pareto:
+	{
+		const double xm = static_cast<double>(spec.meanSize) * (spec.paretoAlpha - 1) / spec.paretoAlpha;
+		const double u = 1.0 - std::uniform_real_distribution<double>(0.0, 1.0)(gen);
+		const double size = xm / std::pow(u, 1.0 / spec.paretoAlpha);
+		return std::clamp<uint64_t>(static_cast<uint64_t>(size), 1, spec.maxSize);
+	}
+	}
+	return spec.meanSize;
+}
+
+// Текст из ограниченного словаря сжимается примерно как обычные логи
+inline void AppendRun(std::string& content, size_t size, bool random, std::mt19937_64& gen)
+{
+	static const std::vector<std::string> words = { "error", "info", "request", "user", "id=", "done", "\n", " ", "0", "42" };
+	const size_t end = content.size() + size;
+	if (random)
+	{
+		while (content.size() < end)
+		{
+			const uint64_t value = gen();
+			content.append(reinterpret_cast<const char*>(&value), std::min(sizeof(value), end - content.size()));
+		}
+		return;
+	}
+	std::uniform_int_distribution<size_t> pick(0, words.size() - 1);
+	while (content.size() < end)
+	{
+		content += words[pick(gen)];
+	}
+	content.resize(end);
+}
+
+// Дописывает в корпус файл заданного размера; гистограмма байтов копится для FinishCorpus
+inline void AppendCorpusFile(Corpus& corpus, const fs::path& path, uint64_t size, double entropy, std::mt19937_64& gen,
+	std::array<uint64_t, 256>& histogram)
+{
+	std::bernoulli_distribution randomRun(entropy);
+	std::string content;
+	content.reserve(size);
+	while (content.size() < size)
+	{
+		AppendRun(content, std::min<size_t>(CORPUS_RUN_SIZE, size - content.size()), randomRun(gen), gen);
+	}
+	for (const char c: content)
+	{
+		++histogram[static_cast<unsigned char>(c)];
+	}
+
+	std::ofstream out(path, std::ios::binary);
+	out.write(content.data(), static_cast<std::streamsize>(content.size()));
+	if (!out)
+	{
+		throw std::runtime_error("Failed to write corpus file: " + path.string());
+	}
+	corpus.files.push_back(path.string());
+	corpus.totalBytes += size;
+	corpus.largestFile = std::max(corpus.largestFile, size);
+}
+
+inline void FinishCorpus(Corpus& corpus, const std::array<uint64_t, 256>& histogram)
+{
+	for (const uint64_t count: histogram)
+	{
+		if (count > 0)
+		{
+			const double p = static_cast<double>(count) / static_cast<double>(corpus.totalBytes);
+			corpus.bitsPerByte -= p * std::log2(p);
+		}
+	}
+}
+
+inline void ValidateCorpusSpec(const CorpusSpec& spec)
+{
+	if (spec.numFiles <= 0 || spec.meanSize == 0)
+	{
+		throw std::invalid_argument("Corpus must have at least one non-empty file");
+	}
+	if (spec.distribution == SizeDistribution::Pareto && spec.paretoAlpha <= 1)
+	{
+		throw std::invalid_argument("Pareto alpha must be greater than 1");
+	}
+	if (spec.entropy < 0 || spec.entropy > 1)
+	{
+		throw std::invalid_argument("Entropy must be between 0 and 1");
+	}
+}
+
+inline Corpus GenerateCorpus(const fs::path& dir, const CorpusSpec& spec)
+{
+	ValidateCorpusSpec(spec);
+	fs::create_directories(dir);
+	std::mt19937_64 gen(spec.seed);
+	std::array<uint64_t, 256> histogram{};
+	Corpus corpus;
+	corpus.files.reserve(spec.numFiles);
+	for (int i = 0; i < spec.numFiles; ++i)
+	{
+		const uint64_t size = PickFileSize(spec, gen);
+		AppendCorpusFile(corpus, dir / ("file" + std::to_string(i) + ".dat"), size, spec.entropy, gen, histogram);
+	}
+	FinishCorpus(corpus, histogram);
+	return corpus;
+}
+
+// Перекошенный корпус: numFiles файлов по meanSize и один огромный в самом конце списка, размером
+// с долю одного из numWorkers рабочих. В порядке argv его начинают последним, и он один тянет весь makespan
+inline Corpus GenerateSkewedCorpus(const fs::path& dir, const CorpusSpec& spec, int numWorkers)
+{
+	ValidateCorpusSpec(spec);
+	fs::create_directories(dir);
+	std::mt19937_64 gen(spec.seed);
+	std::array<uint64_t, 256> histogram{};
+	Corpus corpus;
+	corpus.files.reserve(spec.numFiles + 1);
+	for (int i = 0; i < spec.numFiles; ++i)
+	{
+		AppendCorpusFile(corpus, dir / ("small" + std::to_string(i) + ".dat"), spec.meanSize, spec.entropy, gen, histogram);
+	}
+	const uint64_t hugeSize = spec.meanSize * static_cast<uint64_t>(std::max(spec.numFiles / std::max(numWorkers, 1), 1));
+	AppendCorpusFile(corpus, dir / "huge.dat", hugeSize, spec.entropy, gen, histogram);
+	FinishCorpus(corpus, histogram);
+	return corpus;
+}
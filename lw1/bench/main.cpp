@@ -0,0 +1,632 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "Corpus.h"
+#include "Gzip.h"
+#include "Schedule.h"
+#include "ThreadPool.h"
+
+constexpr const char* DEFAULT_ENGINES = "make-S,make-P,extract-S,extract-P,pool-zlib";
+constexpr double DEFAULT_TOLERANCE = 0.10;
+
+struct Args
+{
+	CorpusSpec corpus;
+	std::vector<int> workers;
+	std::vector<std::string> engines;
+	int repeat = 3;
+	std::string csvPath;
+	std::string baselinePath;
+	double tolerance = DEFAULT_TOLERANCE;
+	std::string makeArchive;
+	std::string extractFiles;
+	std::string workDir;
+	bool keepCorpus = false;
+	bool skewed = true;
+};
+
+// Движок — один способ обработать корпус. Последовательный меряется один раз, параллельный — на каждом
+// числе рабочих. Ускорение считается относительно baseline: последовательного движка той же программы
+// или, если его нет, самого малого числа рабочих
+struct Engine
+{
+	std::string name;
+	bool parallel = false;
+	std::string baseline;
+	std::function<void(int workers)> run;
+	std::function<void()> cleanup;
+};
+
+struct Result
+{
+	std::string engine;
+	int workers = 1;
+	double seconds = 0; // медиана повторов
+	double cpuSeconds = 0;
+	double speedup = 0;
+};
+
+// Процессорное время этого процесса и всех дождавшихся потомков
+double GetCpuSeconds()
+{
+	auto seconds = [](const timeval& time) { return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_usec) / 1e6; };
+	rusage self{};
+	rusage children{};
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+	return seconds(self.ru_utime) + seconds(self.ru_stime) + seconds(children.ru_utime) + seconds(children.ru_stime);
+}
+
+// Запускает программу, выбросив её stdout; stderr остаётся видимым. Ненулевой код — ошибка
+void RunProgram(const std::vector<std::string>& command)
+{
+	const pid_t pid = fork();
+	if (pid == 0)
+	{
+		const int devNull = open("/dev/null", O_WRONLY);
+		if (devNull >= 0)
+		{
+			dup2(devNull, STDOUT_FILENO);
+		}
+		std::vector<char*> argv;
+		for (const auto& arg: command)
+		{
+			argv.push_back(const_cast<char*>(arg.c_str()));
+		}
+		argv.push_back(nullptr);
+		execv(argv[0], argv.data());
+		_exit(127);
+	}
+	if (pid < 0)
+	{
+		throw std::runtime_error("Failed to fork process");
+	}
+
+	int status = 0;
+	while (waitpid(pid, &status, 0) < 0)
+	{
+		if (errno != EINTR)
+		{
+			throw std::runtime_error("Failed to wait for " + command[0]);
+		}
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		throw std::runtime_error("Benchmark command failed: " + command[0] + " " + command[1]);
+	}
+}
+
+std::vector<std::string> Concat(std::vector<std::string> head, const std::vector<std::string>& tail)
+{
+	head.insert(head.end(), tail.begin(), tail.end());
+	return head;
+}
+
+void RemoveCompressed(const std::vector<std::string>& files)
+{
+	for (const auto& file: files)
+	{
+		fs::remove(file + ".gz");
+	}
+}
+
+// Прежняя модель make_archive: fork на каждый файл, внутри system("gzip ...")
+void RunForkModel(int numWorkers, const std::vector<std::string>& files)
+{
+	std::vector<pid_t> pids;
+	for (const auto& file: files)
+	{
+		if (static_cast<int>(pids.size()) >= numWorkers)
+		{
+			pid_t finishedPid = waitpid(-1, nullptr, 0);
+			std::erase(pids, finishedPid);
+		}
+
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			std::string command = "gzip -c " + file + " > " + file + ".gz";
+			_exit(system(command.c_str()) == 0 ? 0 : 1);
+		}
+		else if (pid > 0)
+		{
+			pids.push_back(pid);
+		}
+		else
+		{
+			throw std::runtime_error("Failed to fork process");
+		}
+	}
+
+	for (pid_t pid: pids)
+	{
+		waitpid(pid, nullptr, 0);
+	}
+}
+
+void RunThreadPoolModel(int numWorkers, const std::vector<std::string>& files)
+{
+	ThreadPool pool(numWorkers);
+	std::vector<std::future<void>> results;
+	results.reserve(files.size());
+	for (const auto& file: files)
+	{
+		results.push_back(pool.Submit([&file] { CompressFile(file, file + ".gz"); }));
+	}
+	for (auto& result: results)
+	{
+		result.get();
+	}
+}
+
+// Программы ищутся рядом с собранным бенчмарком: lw1/bench/bin → lw1/ex1/bin, lw1/ex2/bin
+std::string FindProgram(const std::string& given, const std::string& relative)
+{
+	if (!given.empty())
+	{
+		return given;
+	}
+	std::error_code error;
+	const fs::path self = fs::read_symlink("/proc/self/exe", error);
+	return error ? relative : (self.parent_path() / ".." / ".." / relative).lexically_normal().string();
+}
+
+void RequireProgram(const std::string& path, const std::string& option)
+{
+	if (access(path.c_str(), X_OK) != 0)
+	{
+		throw std::runtime_error("Program not found: " + path + " (build it or pass " + option + "=PATH)");
+	}
+}
+
+std::vector<Engine> MakeEngines(const Args& args, const std::vector<std::string>& files, const fs::path& workDir)
+{
+	const std::string makeArchive = FindProgram(args.makeArchive, "ex1/bin/make_archive");
+	const std::string extractFiles = FindProgram(args.extractFiles, "ex2/bin/extract-files");
+	const std::string archive = (workDir / "bench.tar").string();
+	const std::string input = (workDir / "input.tar").string();
+	const std::string output = (workDir / "out").string();
+	auto removeArchive = [archive] { fs::remove(archive); };
+	auto removeOutput = [output] { fs::remove_all(output); };
+	auto removeCompressed = [&files] { RemoveCompressed(files); };
+
+	std::map<std::string, Engine> known;
+	known["make-S"] = { "make-S", false, "", [=, &files](int) { RunProgram(Concat({ makeArchive, "-S", archive }, files)); },
+		removeArchive };
+	known["make-P"] = { "make-P", true, "make-S", [=, &files](int workers) {
+		RunProgram(Concat({ makeArchive, "-P", std::to_string(workers), archive }, files));
+	}, removeArchive };
+	known["make-isolate"] = { "make-isolate", true, "make-S", [=, &files](int workers) {
+		RunProgram(Concat({ makeArchive, "--isolate", "-P", std::to_string(workers), archive }, files));
+	}, removeArchive };
+	known["extract-S"] = { "extract-S", false, "", [=](int) { RunProgram({ extractFiles, "-S", input, output }); }, removeOutput };
+	known["extract-P"] = { "extract-P", true, "extract-S", [=](int workers) {
+		RunProgram({ extractFiles, "-P", std::to_string(workers), input, output });
+	}, removeOutput };
+	known["verify-P"] = { "verify-P", true, "", [=](int workers) {
+		RunProgram({ extractFiles, "-V", "-P", std::to_string(workers), input });
+	}, [] {} };
+	// Сжатие в этом же процессе, без tar: верхняя оценка того, что даёт пул на этом корпусе
+	known["pool-zlib"] = { "pool-zlib", true, "", [&files](int workers) { RunThreadPoolModel(workers, files); },
+		removeCompressed };
+	known["fork-gzip"] = { "fork-gzip", true, "", [&files](int workers) { RunForkModel(workers, files); }, removeCompressed };
+
+	std::vector<Engine> engines;
+	for (const auto& name: args.engines)
+	{
+		const auto engine = known.find(name);
+		if (engine == known.end())
+		{
+			throw std::invalid_argument("Unknown engine: " + name);
+		}
+		if (name.starts_with("make-"))
+		{
+			RequireProgram(makeArchive, "--make-archive");
+		}
+		if (name.starts_with("extract-") || name.starts_with("verify-"))
+		{
+			RequireProgram(extractFiles, "--extract-files");
+		}
+		engines.push_back(engine->second);
+	}
+
+	// Распаковщикам нужен архив; его сборка не меряется
+	const bool needsInput = std::any_of(engines.begin(), engines.end(), [](const Engine& engine) {
+		return engine.name.starts_with("extract-") || engine.name.starts_with("verify-");
+	});
+	if (needsInput)
+	{
+		RequireProgram(makeArchive, "--make-archive");
+		RunProgram(Concat({ makeArchive, "-P", std::to_string(args.workers.back()), input }, files));
+	}
+	return engines;
+}
+
+Result Measure(Engine& engine, int workers, int repeat)
+{
+	std::vector<double> seconds;
+	std::vector<double> cpuSeconds;
+	for (int i = 0; i < repeat; ++i)
+	{
+		engine.cleanup();
+		const double cpuStart = GetCpuSeconds();
+		const auto start = std::chrono::steady_clock::now();
+		engine.run(workers);
+		seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		cpuSeconds.push_back(GetCpuSeconds() - cpuStart);
+	}
+	engine.cleanup();
+
+	auto median = [](std::vector<double> values) {
+		std::sort(values.begin(), values.end());
+		return values[values.size() / 2];
+	};
+	return { engine.name, workers, median(seconds), median(cpuSeconds), 0 };
+}
+
+void ComputeSpeedups(std::vector<Result>& results, const std::vector<Engine>& engines)
+{
+	for (auto& result: results)
+	{
+		const auto engine = std::find_if(engines.begin(), engines.end(), [&](const Engine& e) { return e.name == result.engine; });
+		const std::string& baselineName = engine->baseline.empty() ? engine->name : engine->baseline;
+		const Result* baseline = nullptr;
+		for (const auto& candidate: results)
+		{
+			if (candidate.engine == baselineName && (!baseline || candidate.workers < baseline->workers))
+			{
+				baseline = &candidate;
+			}
+		}
+		result.speedup = baseline && result.seconds > 0 ? baseline->seconds / result.seconds : 0;
+	}
+}
+
+double GetThroughput(const Result& result, uint64_t totalBytes)
+{
+	return result.seconds > 0 ? static_cast<double>(totalBytes) / result.seconds / 1e6 : 0;
+}
+
+std::vector<std::string> SplitList(const std::string& value, char separator)
+{
+	std::vector<std::string> items;
+	std::istringstream in(value);
+	for (std::string item; std::getline(in, item, separator);)
+	{
+		if (!item.empty())
+		{
+			items.push_back(item);
+		}
+	}
+	return items;
+}
+
+constexpr const char* CSV_HEADER = "corpus,files,bytes,bits_per_byte,engine,workers,seconds,cpu_seconds,mb_per_s,speedup";
+
+// Дописывает строки в CSV: прогоны разных корпусов складываются в один файл для графиков
+void WriteCsv(const std::string& path, const std::string& corpusName, const Corpus& corpus, const std::vector<Result>& results)
+{
+	const bool fresh = !fs::exists(path) || fs::file_size(path) == 0;
+	std::ofstream out(path, std::ios::app);
+	if (!out)
+	{
+		throw std::runtime_error("Failed to write CSV: " + path);
+	}
+	if (fresh)
+	{
+		out << CSV_HEADER << "\n";
+	}
+	for (const auto& result: results)
+	{
+		out << corpusName << "," << corpus.files.size() << "," << corpus.totalBytes << "," << corpus.bitsPerByte << ","
+			<< result.engine << "," << result.workers << "," << result.seconds << "," << result.cpuSeconds << ","
+			<< GetThroughput(result, corpus.totalBytes) << "," << result.speedup << "\n";
+	}
+}
+
+// Сравнивает пропускную способность с прошлым CSV того же корпуса; возвращает число просевших замеров
+size_t CompareWithBaseline(const std::string& path, const std::string& corpusName, const Corpus& corpus,
+	const std::vector<Result>& results, double tolerance)
+{
+	std::ifstream in(path);
+	if (!in)
+	{
+		throw std::runtime_error("Failed to read baseline: " + path);
+	}
+	std::map<std::pair<std::string, int>, double> baseline;
+	for (std::string line; std::getline(in, line);)
+	{
+		const auto fields = SplitList(line, ',');
+		if (fields.size() != 10 || fields[0] != corpusName)
+		{
+			continue;
+		}
+		baseline[{ fields[4], std::stoi(fields[5]) }] = std::stod(fields[8]);
+	}
+
+	size_t regressions = 0;
+	for (const auto& result: results)
+	{
+		const auto before = baseline.find({ result.engine, result.workers });
+		if (before == baseline.end() || before->second <= 0)
+		{
+			continue;
+		}
+		const double now = GetThroughput(result, corpus.totalBytes);
+		const double change = now / before->second - 1;
+		if (change < -tolerance)
+		{
+			++regressions;
+			std::cout << "REGRESSION " << result.engine << " x" << result.workers << ": " << before->second << " -> " << now
+					  << " MB/s (" << change * 100 << "%)\n";
+		}
+	}
+	return regressions;
+}
+
+void PrintResults(const std::vector<Result>& results, uint64_t totalBytes)
+{
+	std::cout << std::left << std::setw(14) << "engine" << std::right << std::setw(8) << "workers" << std::setw(12) << "seconds"
+			  << std::setw(12) << "cpu" << std::setw(12) << "MB/s" << std::setw(10) << "speedup" << "\n";
+	std::cout << std::fixed;
+	for (const auto& result: results)
+	{
+		std::cout << std::left << std::setw(14) << result.engine << std::right << std::setw(8) << result.workers
+				  << std::setprecision(3) << std::setw(12) << result.seconds << std::setw(12) << result.cpuSeconds
+				  << std::setprecision(1) << std::setw(12) << GetThroughput(result, totalBytes)
+				  << std::setprecision(2) << std::setw(10) << result.speedup << "\n";
+	}
+	std::cout << std::defaultfloat << std::setprecision(6);
+}
+
+// Пул на перекошенном корпусе в порядке argv и в порядке «сначала большие», на каждом числе рабочих больше одного.
+// Замеры идут в общий CSV и сравнение с baseline под именем корпуса с суффиксом -skewed
+std::vector<Result> MeasureSkewed(const Args& args, const Corpus& skewed)
+{
+	const auto lptOrder = SortLongestFirst(skewed.files, [](const std::string& file) { return fs::file_size(file); });
+	std::vector<Engine> engines = {
+		{ "pool-argv", true, "", [&skewed](int workers) { RunThreadPoolModel(workers, skewed.files); },
+			[&skewed] { RemoveCompressed(skewed.files); } },
+		{ "pool-lpt", true, "", [&lptOrder](int workers) { RunThreadPoolModel(workers, lptOrder); },
+			[&skewed] { RemoveCompressed(skewed.files); } },
+	};
+	std::vector<Result> results;
+	for (const int workers: args.workers)
+	{
+		if (workers < 2)
+		{
+			continue;
+		}
+		for (auto& engine: engines)
+		{
+			results.push_back(Measure(engine, workers, args.repeat));
+		}
+	}
+	ComputeSpeedups(results, engines);
+	return results;
+}
+
+void PrintLptGain(const std::vector<Result>& results)
+{
+	for (size_t i = 0; i + 1 < results.size(); i += 2)
+	{
+		if (results[i + 1].seconds > 0)
+		{
+			std::cout << "LPT gain x" << results[i].workers << ": " << results[i].seconds / results[i + 1].seconds << "x\n";
+		}
+	}
+}
+
+// 1, 2, 4, … до удвоенного числа ядер: видно и насыщение, и поведение при переподписке
+std::vector<int> GetDefaultWorkers()
+{
+	const int limit = std::max(4, 2 * static_cast<int>(std::thread::hardware_concurrency()));
+	std::vector<int> workers;
+	for (int count = 1; count <= limit; count *= 2)
+	{
+		workers.push_back(count);
+	}
+	return workers;
+}
+
+Args ParseArgs(int argc, char* argv[])
+{
+	Args args;
+	args.engines = SplitList(DEFAULT_ENGINES, ',');
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		const size_t equals = arg.find('=');
+		const std::string name = arg.substr(0, equals);
+		const std::string value = equals == std::string::npos ? std::string() : arg.substr(equals + 1);
+		if (name == "--files")
+		{
+			args.corpus.numFiles = std::stoi(value);
+		}
+		else if (name == "--size")
+		{
+			args.corpus.meanSize = std::stoull(value);
+		}
+		else if (name == "--max-size")
+		{
+			args.corpus.maxSize = std::stoull(value);
+		}
+		else if (name == "--dist")
+		{
+			args.corpus.distribution = ParseSizeDistribution(value);
+		}
+		else if (name == "--alpha")
+		{
+			args.corpus.paretoAlpha = std::stod(value);
+		}
+		else if (name == "--entropy")
+		{
+			args.corpus.entropy = std::stod(value);
+		}
+		else if (name == "--seed")
+		{
+			args.corpus.seed = static_cast<uint32_t>(std::stoul(value));
+		}
+		else if (name == "--workers")
+		{
+			for (const auto& item: SplitList(value, ','))
+			{
+				args.workers.push_back(std::stoi(item));
+			}
+		}
+		else if (name == "--engines")
+		{
+			args.engines = SplitList(value, ',');
+		}
+		else if (name == "--repeat")
+		{
+			args.repeat = std::stoi(value);
+		}
+		else if (name == "--csv")
+		{
+			args.csvPath = value;
+		}
+		else if (name == "--baseline")
+		{
+			args.baselinePath = value;
+		}
+		else if (name == "--tolerance")
+		{
+			args.tolerance = std::stod(value);
+		}
+		else if (name == "--make-archive")
+		{
+			args.makeArchive = value;
+		}
+		else if (name == "--extract-files")
+		{
+			args.extractFiles = value;
+		}
+		else if (name == "--dir")
+		{
+			args.workDir = value;
+		}
+		else if (arg == "--keep")
+		{
+			args.keepCorpus = true;
+		}
+		else if (arg == "--no-skewed")
+		{
+			args.skewed = false;
+		}
+		else
+		{
+			throw std::invalid_argument(
+				"Usage: " + std::string(argv[0]) + " [--files=N] [--size=BYTES] [--max-size=BYTES] [--dist=fixed|uniform|pareto]"
+				+ " [--alpha=A] [--entropy=0..1] [--seed=N] [--workers=1,2,4] [--engines=" + DEFAULT_ENGINES + "]"
+				+ " [--repeat=N] [--csv=FILE] [--baseline=FILE] [--tolerance=0.10] [--make-archive=PATH]"
+				+ " [--extract-files=PATH] [--dir=DIR] [--keep] [--no-skewed]");
+		}
+	}
+
+	if (args.workers.empty())
+	{
+		args.workers = GetDefaultWorkers();
+	}
+	std::sort(args.workers.begin(), args.workers.end());
+	if (args.workers.front() <= 0 || args.repeat <= 0)
+	{
+		throw std::invalid_argument("Worker counts and --repeat must be positive");
+	}
+	return args;
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		Args args = ParseArgs(argc, argv);
+		const fs::path dir = args.workDir.empty()
+			? fs::temp_directory_path() / ("archive_bench_" + std::to_string(getpid()))
+			: fs::path(args.workDir);
+		const std::string corpusName = DescribeCorpus(args.corpus);
+		const Corpus corpus = GenerateCorpus(dir / "corpus", args.corpus);
+		// Как в make_archive -P: большие файлы раздаются первыми
+		const auto files = SortLongestFirst(corpus.files, [](const std::string& file) { return fs::file_size(file); });
+
+		std::cout << "Corpus " << corpusName << ": " << corpus.files.size() << " files, " << corpus.totalBytes << " bytes"
+				  << " (largest " << corpus.largestFile << "), " << corpus.bitsPerByte << " bits/byte\n";
+		std::cout << "Warm page cache, median of " << args.repeat << " runs\n\n";
+
+		auto engines = MakeEngines(args, files, dir);
+		std::vector<Result> results;
+		for (auto& engine: engines)
+		{
+			if (!engine.parallel)
+			{
+				results.push_back(Measure(engine, 1, args.repeat));
+				continue;
+			}
+			for (const int workers: args.workers)
+			{
+				results.push_back(Measure(engine, workers, args.repeat));
+			}
+		}
+		ComputeSpeedups(results, engines);
+		PrintResults(results, corpus.totalBytes);
+
+		if (!args.csvPath.empty())
+		{
+			WriteCsv(args.csvPath, corpusName, corpus, results);
+		}
+		size_t regressions = 0;
+		if (!args.baselinePath.empty())
+		{
+			regressions = CompareWithBaseline(args.baselinePath, corpusName, corpus, results, args.tolerance);
+		}
+
+		if (args.skewed)
+		{
+			const std::string skewedName = corpusName + "-skewed";
+			const Corpus skewed = GenerateSkewedCorpus(dir / "skewed", args.corpus, args.workers.back());
+			std::cout << "\nSkewed corpus: " << skewed.files.size() - 1 << " files of " << args.corpus.meanSize
+					  << " bytes + 1 of " << skewed.largestFile << " bytes last\n\n";
+			const auto skewedResults = MeasureSkewed(args, skewed);
+			PrintResults(skewedResults, skewed.totalBytes);
+			PrintLptGain(skewedResults);
+			if (!args.csvPath.empty())
+			{
+				WriteCsv(args.csvPath, skewedName, skewed, skewedResults);
+			}
+			if (!args.baselinePath.empty())
+			{
+				regressions += CompareWithBaseline(args.baselinePath, skewedName, skewed, skewedResults, args.tolerance);
+			}
+		}
+		if (!args.keepCorpus)
+		{
+			fs::remove_all(dir);
+		}
+		if (regressions > 0)
+		{
+			throw std::runtime_error(std::to_string(regressions) + " measurement(s) regressed beyond tolerance");
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
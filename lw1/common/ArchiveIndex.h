@@ -0,0 +1,160 @@
+#pragma once
+
+#include <zlib.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "Bytes.h"
+
+// Оглавление дописывается после маркера конца tar, поэтому tar -xf его просто не видит:
+// [тело оглавления][трейлер: сигнатура, версия, crc32 тела, смещение тела, размер тела]
+constexpr char ARCHIVE_INDEX_MAGIC[8] = { 'P', 'P', 'A', 'R', 'I', 'D', 'X', '\0' };
+constexpr uint32_t ARCHIVE_INDEX_VERSION = 1;
+constexpr size_t ARCHIVE_INDEX_TRAILER_SIZE = 32;
+
+struct IndexEntry
+{
+	std::string name; // исходное имя файла, без суффикса кодека
+	uint64_t offset = 0; // смещение данных члена от начала архива
+	uint64_t storedSize = 0;
+	uint64_t rawSize = 0;
+	uint32_t crc = 0; // crc32 распакованных данных
+	uint8_t codec = 0;
+};
+
+// Сериализует оглавление вместе с трейлером; indexOffset — где в архиве окажется тело
+inline std::vector<char> SerializeArchiveIndex(std::vector<IndexEntry> entries, uint64_t indexOffset)
+{
+	std::sort(entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs) { return lhs.name < rhs.name; });
+
+	ByteWriter body;
+	body.Put<uint32_t>(static_cast<uint32_t>(entries.size()));
+	for (const auto& entry: entries)
+	{
+		body.Put<uint16_t>(static_cast<uint16_t>(entry.name.size()));
+		body.PutBytes(entry.name.data(), entry.name.size());
+		body.Put(entry.offset);
+		body.Put(entry.storedSize);
+		body.Put(entry.rawSize);
+		body.Put(entry.crc);
+		body.Put(entry.codec);
+	}
+
+	const auto& bytes = body.Bytes();
+	ByteWriter trailer;
+	trailer.PutBytes(ARCHIVE_INDEX_MAGIC, sizeof(ARCHIVE_INDEX_MAGIC));
+	trailer.Put(ARCHIVE_INDEX_VERSION);
+	trailer.Put(static_cast<uint32_t>(crc32(0L, reinterpret_cast<const Bytef*>(bytes.data()), static_cast<uInt>(bytes.size()))));
+	trailer.Put(indexOffset);
+	trailer.Put(static_cast<uint64_t>(bytes.size()));
+
+	std::vector<char> result = std::move(body.Bytes());
+	result.insert(result.end(), trailer.Bytes().begin(), trailer.Bytes().end());
+	return result;
+}
+
+inline void PreadExact(int fd, char* data, size_t size, uint64_t offset)
+{
+	while (size > 0)
+	{
+		const ssize_t readCount = pread(fd, data, size, static_cast<off_t>(offset));
+		if (readCount <= 0)
+		{
+			throw std::runtime_error("Unexpected end of archive");
+		}
+		data += readCount;
+		size -= static_cast<size_t>(readCount);
+		offset += static_cast<uint64_t>(readCount);
+	}
+}
+
+// Оглавление архива; читается с конца файла через pread, сам архив при этом не сканируется
+class ArchiveIndex
+{
+public:
+	// std::nullopt, если у архива нет оглавления (например, он собран обычным tar)
+	static std::optional<ArchiveIndex> Read(int fd)
+	{
+		struct stat info{};
+		if (fstat(fd, &info) != 0 || static_cast<uint64_t>(info.st_size) < ARCHIVE_INDEX_TRAILER_SIZE)
+		{
+			return std::nullopt;
+		}
+		const auto fileSize = static_cast<uint64_t>(info.st_size);
+
+		char trailerBytes[ARCHIVE_INDEX_TRAILER_SIZE];
+		PreadExact(fd, trailerBytes, sizeof(trailerBytes), fileSize - ARCHIVE_INDEX_TRAILER_SIZE);
+		if (std::memcmp(trailerBytes, ARCHIVE_INDEX_MAGIC, sizeof(ARCHIVE_INDEX_MAGIC)) != 0)
+		{
+			return std::nullopt;
+		}
+
+		ByteReader trailer(trailerBytes + sizeof(ARCHIVE_INDEX_MAGIC), sizeof(trailerBytes) - sizeof(ARCHIVE_INDEX_MAGIC));
+		const auto version = trailer.Get<uint32_t>();
+		const auto crc = trailer.Get<uint32_t>();
+		const auto offset = trailer.Get<uint64_t>();
+		const auto size = trailer.Get<uint64_t>();
+		if (version != ARCHIVE_INDEX_VERSION || offset + size + ARCHIVE_INDEX_TRAILER_SIZE != fileSize)
+		{
+			throw std::runtime_error("Unsupported or corrupted archive index");
+		}
+
+		std::vector<char> body(size);
+		PreadExact(fd, body.data(), body.size(), offset);
+		if (crc32(0L, reinterpret_cast<const Bytef*>(body.data()), static_cast<uInt>(body.size())) != crc)
+		{
+			throw std::runtime_error("Archive index checksum mismatch");
+		}
+
+		ArchiveIndex index;
+		index.m_indexOffset = offset;
+		ByteReader reader(body.data(), body.size());
+		const auto count = reader.Get<uint32_t>();
+		index.m_entries.reserve(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			IndexEntry entry;
+			entry.name = reader.GetString(reader.Get<uint16_t>());
+			entry.offset = reader.Get<uint64_t>();
+			entry.storedSize = reader.Get<uint64_t>();
+			entry.rawSize = reader.Get<uint64_t>();
+			entry.crc = reader.Get<uint32_t>();
+			entry.codec = reader.Get<uint8_t>();
+			index.m_entries.push_back(std::move(entry));
+		}
+		if (!reader.AtEnd())
+		{
+			throw std::runtime_error("Corrupted archive index");
+		}
+		return index;
+	}
+
+	// Записи отсортированы по имени — двоичный поиск
+	[[nodiscard]] const IndexEntry* Find(const std::string& name) const
+	{
+		auto it = std::lower_bound(m_entries.begin(), m_entries.end(), name,
+			[](const IndexEntry& entry, const std::string& key) { return entry.name < key; });
+		return it != m_entries.end() && it->name == name ? &*it : nullptr;
+	}
+
+	[[nodiscard]] const std::vector<IndexEntry>& GetEntries() const noexcept
+	{
+		return m_entries;
+	}
+
+	// Где заканчиваются tar-данные и начинается оглавление
+	[[nodiscard]] uint64_t GetIndexOffset() const noexcept
+	{
+		return m_indexOffset;
+	}
+
+private:
+	std::vector<IndexEntry> m_entries;
+	uint64_t m_indexOffset = 0;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Запись и чтение целых чисел в little-endian и сырых байтов: оглавление архива, задания рабочим процессам
+class ByteWriter
+{
+public:
+	template <typename T>
+	void Put(T value)
+	{
+		for (size_t i = 0; i < sizeof(T); ++i)
+		{
+			m_bytes.push_back(static_cast<char>(static_cast<uint64_t>(value) >> (8 * i)));
+		}
+	}
+
+	void PutBytes(const char* data, size_t size)
+	{
+		m_bytes.insert(m_bytes.end(), data, data + size);
+	}
+
+	std::vector<char>& Bytes() noexcept
+	{
+		return m_bytes;
+	}
+
+private:
+	std::vector<char> m_bytes;
+};
+
+class ByteReader
+{
+public:
+	ByteReader(const char* data, size_t size)
+		: m_data(data)
+		, m_size(size)
+	{
+	}
+
+	template <typename T>
+	T Get()
+	{
+		Require(sizeof(T));
+		uint64_t value = 0;
+		for (size_t i = 0; i < sizeof(T); ++i)
+		{
+			value |= static_cast<uint64_t>(static_cast<unsigned char>(m_data[m_position + i])) << (8 * i);
+		}
+		m_position += sizeof(T);
+		return static_cast<T>(value);
+	}
+
+	std::string GetString(size_t size)
+	{
+		Require(size);
+		std::string value(m_data + m_position, size);
+		m_position += size;
+		return value;
+	}
+
+	std::vector<char> GetBytes(size_t size)
+	{
+		Require(size);
+		std::vector<char> value(m_data + m_position, m_data + m_position + size);
+		m_position += size;
+		return value;
+	}
+
+	[[nodiscard]] bool AtEnd() const noexcept
+	{
+		return m_position == m_size;
+	}
+
+private:
+	void Require(size_t size) const
+	{
+		if (m_size - m_position < size)
+		{
+			throw std::runtime_error("Unexpected end of serialized data");
+		}
+	}
+
+	const char* m_data;
+	size_t m_size;
+	size_t m_position = 0;
+};
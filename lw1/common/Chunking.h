@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Bytes.h"
+#include "Codec.h"
+#include "Crc32.h"
+#include "Hash.h"
+
+// Дедупликация (--dedup): файл режется на чанки по содержимому, граница ставится там, где gear-хеш
+// последних 64 байт попал в маску. Вставка в начало файла сдвигает одну границу, а остальные чанки
+// совпадают с уже записанными. Повторный чанк хранится ссылкой на свой литерал в том же архиве
+constexpr size_t CHUNK_MIN_SIZE = 8 * 1024;
+constexpr size_t CHUNK_MAX_SIZE = 128 * 1024;
+constexpr size_t GEAR_WINDOW = 64;
+// Старшие 15 бит зависят от всех 64 последних байтов; граница — в среднем раз в 32 КиБ после минимума
+constexpr uint64_t CHUNK_BOUNDARY_MASK = ~uint64_t{ 0 } << (64 - 15);
+constexpr uint64_t CHUNK_CHECK_SEED = 0x9E3779B97F4A7C15ull;
+
+// Член <file>.cdc: сигнатура, затем записи чанков подряд.
+// Литерал: [1][uint32 число ссылок][uint8 кодек][uint32 размер][uint32 сжатый размер][uint32 CRC32][поток кодека]
+// Ссылка:  [2][uint64 смещение записи литерала в архиве][uint32 размер][uint32 CRC32]
+// Число ссылок писатель проставляет в литералах в конце архива: потоковый распаковщик держит
+// в памяти только те чанки, на которые ещё будут ссылки
+constexpr char CHUNKED_MAGIC[8] = { 'P', 'P', 'C', 'D', 'C', '\0', '\0', '\1' };
+constexpr const char* CHUNKED_SUFFIX = ".cdc";
+constexpr uint8_t CHUNKED_MEMBER_CODEC = 3; // номер в оглавлении после номеров кодеков
+constexpr size_t CHUNK_LITERAL_HEADER_SIZE = 18;
+constexpr size_t CHUNK_REFERENCE_SIZE = 17;
+constexpr size_t CHUNK_REFERENCES_FIELD_OFFSET = 1;
+
+enum ChunkRecordType : uint8_t
+{
+	CHUNK_LITERAL = 1,
+	CHUNK_REFERENCE = 2,
+};
+
+// Таблица gear: по псевдослучайному 64-битному числу (splitmix64) на каждое значение байта
+constexpr std::array<uint64_t, 256> MakeGearTable()
+{
+	std::array<uint64_t, 256> table{};
+	uint64_t state = 0;
+	for (auto& value: table)
+	{
+		state += 0x9E3779B97F4A7C15ull;
+		uint64_t z = state;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		value = z ^ (z >> 31);
+	}
+	return table;
+}
+
+constexpr std::array<uint64_t, 256> GEAR_TABLE = MakeGearTable();
+
+// Границы зависят только от содержимого, а не от того, какими кусками оно пришло в Update
+class ContentChunker
+{
+public:
+	// emit(std::vector<char>) получает каждый законченный чанк
+	template <typename Emit>
+	void Update(const char* data, size_t size, Emit&& emit)
+	{
+		size_t start = 0;
+		size_t i = 0;
+		while (i < size)
+		{
+			const size_t length = m_chunk.size() + (i - start);
+			// Хеш окна зависит только от последних 64 байтов, поэтому до минимума почти всё можно не хешировать
+			if (length + GEAR_WINDOW < CHUNK_MIN_SIZE)
+			{
+				i += std::min(size - i, CHUNK_MIN_SIZE - GEAR_WINDOW - length);
+				continue;
+			}
+			m_hash = (m_hash << 1) + GEAR_TABLE[static_cast<unsigned char>(data[i])];
+			++i;
+			if (length + 1 >= CHUNK_MAX_SIZE || (length + 1 >= CHUNK_MIN_SIZE && (m_hash & CHUNK_BOUNDARY_MASK) == 0))
+			{
+				m_chunk.insert(m_chunk.end(), data + start, data + i);
+				emit(std::move(m_chunk));
+				m_chunk = {};
+				m_hash = 0;
+				start = i;
+			}
+		}
+		m_chunk.insert(m_chunk.end(), data + start, data + size);
+	}
+
+	// Отдаёт последний, возможно короткий, чанк
+	template <typename Emit>
+	void Finish(Emit&& emit)
+	{
+		if (!m_chunk.empty())
+		{
+			emit(std::move(m_chunk));
+		}
+		m_chunk = {};
+		m_hash = 0;
+	}
+
+private:
+	std::vector<char> m_chunk;
+	uint64_t m_hash = 0;
+};
+
+// Два независимых 64-битных хеша и длина: случайного совпадения разных чанков можно не опасаться,
+// поэтому сами байты уже записанных чанков хранить для сравнения не нужно
+struct ChunkKey
+{
+	uint64_t hash = 0;
+	uint64_t check = 0;
+	uint64_t size = 0;
+
+	bool operator==(const ChunkKey&) const = default;
+};
+
+struct ChunkKeyHash
+{
+	size_t operator()(const ChunkKey& key) const noexcept
+	{
+		return static_cast<size_t>(key.hash);
+	}
+};
+
+inline ChunkKey MakeChunkKey(const char* data, size_t size)
+{
+	return { Xxh64::Hash(data, size), Xxh64::Hash(data, size, CHUNK_CHECK_SEED), size };
+}
+
+struct ChunkRecord
+{
+	ChunkRecordType type = CHUNK_LITERAL;
+	uint32_t references = 0;
+	uint8_t codec = 0;
+	uint64_t target = 0; // у ссылки — смещение записи литерала
+	uint32_t rawSize = 0;
+	uint32_t storedSize = 0;
+	uint32_t crc = 0;
+};
+
+inline std::vector<char> MakeChunkLiteralHeader(CodecId codec, uint32_t rawSize, uint32_t storedSize, uint32_t crc)
+{
+	ByteWriter out;
+	out.Put<uint8_t>(CHUNK_LITERAL);
+	out.Put<uint32_t>(0);
+	out.Put<uint8_t>(static_cast<uint8_t>(codec));
+	out.Put(rawSize);
+	out.Put(storedSize);
+	out.Put(crc);
+	return std::move(out.Bytes());
+}
+
+inline std::vector<char> MakeChunkReference(uint64_t target, uint32_t rawSize, uint32_t crc)
+{
+	ByteWriter out;
+	out.Put<uint8_t>(CHUNK_REFERENCE);
+	out.Put(target);
+	out.Put(rawSize);
+	out.Put(crc);
+	return std::move(out.Bytes());
+}
+
+// Полный размер заголовка записи по её первому байту
+inline size_t GetChunkRecordSize(uint8_t type)
+{
+	switch (type)
+	{
+	case CHUNK_LITERAL:
+		return CHUNK_LITERAL_HEADER_SIZE;
+	case CHUNK_REFERENCE:
+		return CHUNK_REFERENCE_SIZE;
+	default:
+		throw std::runtime_error("Corrupted chunk record");
+	}
+}
+
+inline ChunkRecord ParseChunkRecord(const std::vector<char>& header)
+{
+	ByteReader in(header.data(), header.size());
+	ChunkRecord record;
+	record.type = static_cast<ChunkRecordType>(in.Get<uint8_t>());
+	if (record.type == CHUNK_LITERAL)
+	{
+		record.references = in.Get<uint32_t>();
+		record.codec = in.Get<uint8_t>();
+		record.rawSize = in.Get<uint32_t>();
+		record.storedSize = in.Get<uint32_t>();
+		record.crc = in.Get<uint32_t>();
+	}
+	else
+	{
+		record.target = in.Get<uint64_t>();
+		record.rawSize = in.Get<uint32_t>();
+		record.crc = in.Get<uint32_t>();
+	}
+	return record;
+}
+
+// Распаковывает поток кодека литерала и сверяет размер и CRC32
+inline std::vector<char> DecodeChunk(const ChunkRecord& literal, const char* data, size_t size, const std::string& name)
+{
+	std::vector<char> chunk;
+	chunk.reserve(literal.rawSize);
+	const auto decoder = GetCodec(static_cast<CodecId>(literal.codec)).MakeDecoder();
+	decoder->Decode(data, size, [&](const char* part, size_t partSize) { chunk.insert(chunk.end(), part, part + partSize); });
+	if (!decoder->Finished() || chunk.size() != literal.rawSize
+		|| Crc32(0, chunk.data(), chunk.size()) != literal.crc)
+	{
+		throw std::runtime_error("Corrupted chunk: " + name);
+	}
+	return chunk;
+}
@@ -0,0 +1,408 @@
+#pragma once
+
+#include <zlib.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "Crc32.h"
+#include "Gzip.h"
+#include "Lz4.h"
+
+// Кодек члена архива. Номер кодека хранится в оглавлении и манифесте, а суффикс — в имени члена,
+// поэтому распаковщику для обычного потокового разбора оглавление не нужно. Суффикс есть у каждого кодека,
+// и хранение тоже: иначе файл photo.gz, сохранённый как есть, читался бы как член gzip
+enum class CodecId : uint8_t
+{
+	Gzip = 0,
+	Lz4 = 1,
+	Store = 2,
+};
+
+// Оценка кодека для --codec=auto по кускам файла: сжимаем их LZ4 и gzip с тем же уровнем, что и в архиве.
+// Не сжимается ни тем, ни другим (картинки, .zst) — храним как есть и не тратим процессор;
+// LZ4 почти не уступает gzip — берём LZ4 ради скорости; иначе выигрыш gzip в размере того стоит
+constexpr size_t CODEC_SAMPLE_SIZE = 64 * 1024;
+constexpr size_t CODEC_SAMPLE_COUNT = 3;
+constexpr double CODEC_STORE_RATIO = 0.95;
+constexpr double CODEC_LZ4_TOLERANCE = 1.10;
+constexpr const char* STORE_SUFFIX = ".raw";
+
+// Принимает распакованные данные по мере готовности
+class StreamDecoder
+{
+public:
+	using Sink = std::function<void(const char*, size_t)>;
+
+	virtual ~StreamDecoder() = default;
+	virtual void Decode(const char* data, size_t size, const Sink& sink) = 0;
+	// Поток закончился на границе: дальше данных кодека быть не должно
+	[[nodiscard]] virtual bool Finished() const = 0;
+	// CRC32 распакованного, если его попутно считает и сверяет с трейлером сам кодек; верен после Finished
+	[[nodiscard]] virtual std::optional<uint32_t> GetCheckedCrc() const
+	{
+		return std::nullopt;
+	}
+};
+
+class Codec
+{
+public:
+	virtual ~Codec() = default;
+
+	[[nodiscard]] virtual CodecId GetId() const = 0;
+	// Суффикс имени члена; по нему кодек узнаётся без оглавления
+	[[nodiscard]] virtual std::string GetSuffix() const = 0;
+	[[nodiscard]] virtual std::vector<char> MakeHeader(const std::string& name, uint32_t mtime, uint64_t rawSize) const = 0;
+	// Кодирует блок файла. independent — блок нельзя связывать с предыдущим
+	[[nodiscard]] virtual EncodedBlock Encode(const InputBlock& block, bool independent) const = 0;
+	[[nodiscard]] virtual std::vector<char> MakeTrailer(uint32_t crc, uint64_t rawSize) const = 0;
+	[[nodiscard]] virtual std::unique_ptr<StreamDecoder> MakeDecoder() const = 0;
+	// Размер распакованных данных целого члена, если кодек его записывает; это только подсказка, данные ему не сверяются
+	[[nodiscard]] virtual std::optional<uint64_t> ReadRawSize(const char* data, size_t size) const = 0;
+};
+
+inline EncodedBlock MakeEncodedBlock(std::vector<char> data, const InputBlock& block)
+{
+	EncodedBlock encoded;
+	encoded.data = std::move(data);
+	encoded.rawSize = block.data->size();
+	encoded.crc = Crc32(0, block.data->data(), block.data->size());
+	return encoded;
+}
+
+class GzipCodec : public Codec
+{
+public:
+	[[nodiscard]] CodecId GetId() const override
+	{
+		return CodecId::Gzip;
+	}
+
+	[[nodiscard]] std::string GetSuffix() const override
+	{
+		return ".gz";
+	}
+
+	[[nodiscard]] std::vector<char> MakeHeader(const std::string& name, uint32_t mtime, uint64_t) const override
+	{
+		return MakeGzipHeader(name, mtime);
+	}
+
+	[[nodiscard]] EncodedBlock Encode(const InputBlock& block, bool independent) const override
+	{
+		return independent ? block.DeflateIndependent() : block.Deflate();
+	}
+
+	[[nodiscard]] std::vector<char> MakeTrailer(uint32_t crc, uint64_t rawSize) const override
+	{
+		return MakeGzipTrailer(crc, rawSize);
+	}
+
+	[[nodiscard]] std::unique_ptr<StreamDecoder> MakeDecoder() const override
+	{
+		class Decoder : public StreamDecoder
+		{
+		public:
+			void Decode(const char* data, size_t size, const Sink& sink) override
+			{
+				m_inflater.Decompress(data, size, sink);
+			}
+
+			[[nodiscard]] bool Finished() const override
+			{
+				return m_inflater.Finished();
+			}
+
+			[[nodiscard]] std::optional<uint32_t> GetCheckedCrc() const override
+			{
+				return m_inflater.GetCrc();
+			}
+
+		private:
+			GzipInflater m_inflater;
+		};
+		return std::make_unique<Decoder>();
+	}
+
+	// ISIZE последнего члена: верен для файла из одного члена меньше 4 ГБ
+	[[nodiscard]] std::optional<uint64_t> ReadRawSize(const char* data, size_t size) const override
+	{
+		if (size < GZIP_TRAILER_SIZE)
+		{
+			return std::nullopt;
+		}
+		uint32_t rawSize = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			rawSize |= static_cast<uint32_t>(static_cast<unsigned char>(data[size - 4 + i])) << (8 * i);
+		}
+		return rawSize;
+	}
+};
+
+class Lz4Codec : public Codec
+{
+public:
+	[[nodiscard]] CodecId GetId() const override
+	{
+		return CodecId::Lz4;
+	}
+
+	[[nodiscard]] std::string GetSuffix() const override
+	{
+		return ".lz4";
+	}
+
+	[[nodiscard]] std::vector<char> MakeHeader(const std::string&, uint32_t, uint64_t rawSize) const override
+	{
+		return MakeLz4FrameHeader(rawSize);
+	}
+
+	// Блоки кадра всегда независимы, так что словарь не нужен
+	[[nodiscard]] EncodedBlock Encode(const InputBlock& block, bool) const override
+	{
+		return MakeEncodedBlock(Lz4EncodeFrameBlocks(block.data->data(), block.data->size()), block);
+	}
+
+	[[nodiscard]] std::vector<char> MakeTrailer(uint32_t, uint64_t) const override
+	{
+		return MakeLz4FrameEnd();
+	}
+
+	[[nodiscard]] std::unique_ptr<StreamDecoder> MakeDecoder() const override
+	{
+		class Decoder : public StreamDecoder
+		{
+		public:
+			void Decode(const char* data, size_t size, const Sink& sink) override
+			{
+				m_decoder.Decompress(data, size, sink);
+			}
+
+			[[nodiscard]] bool Finished() const override
+			{
+				return m_decoder.Finished();
+			}
+
+		private:
+			Lz4FrameDecoder m_decoder;
+		};
+		return std::make_unique<Decoder>();
+	}
+
+	[[nodiscard]] std::optional<uint64_t> ReadRawSize(const char* data, size_t size) const override
+	{
+		return ReadLz4ContentSize(data, size);
+	}
+};
+
+class StoreCodec : public Codec
+{
+public:
+	[[nodiscard]] CodecId GetId() const override
+	{
+		return CodecId::Store;
+	}
+
+	[[nodiscard]] std::string GetSuffix() const override
+	{
+		return STORE_SUFFIX;
+	}
+
+	[[nodiscard]] std::vector<char> MakeHeader(const std::string&, uint32_t, uint64_t) const override
+	{
+		return {};
+	}
+
+	[[nodiscard]] EncodedBlock Encode(const InputBlock& block, bool) const override
+	{
+		return MakeEncodedBlock(*block.data, block);
+	}
+
+	[[nodiscard]] std::vector<char> MakeTrailer(uint32_t, uint64_t) const override
+	{
+		return {};
+	}
+
+	[[nodiscard]] std::unique_ptr<StreamDecoder> MakeDecoder() const override
+	{
+		class Decoder : public StreamDecoder
+		{
+		public:
+			void Decode(const char* data, size_t size, const Sink& sink) override
+			{
+				if (size > 0)
+				{
+					sink(data, size);
+				}
+			}
+
+			[[nodiscard]] bool Finished() const override
+			{
+				return true;
+			}
+		};
+		return std::make_unique<Decoder>();
+	}
+
+	[[nodiscard]] std::optional<uint64_t> ReadRawSize(const char*, size_t size) const override
+	{
+		return size;
+	}
+};
+
+inline const Codec& GetCodec(CodecId id)
+{
+	static const GzipCodec gzip;
+	static const Lz4Codec lz4;
+	static const StoreCodec store;
+	switch (id)
+	{
+	case CodecId::Gzip:
+		return gzip;
+	case CodecId::Lz4:
+		return lz4;
+	case CodecId::Store:
+		return store;
+	}
+	throw std::runtime_error("Unknown codec: " + std::to_string(static_cast<int>(id)));
+}
+
+// Кодек по суффиксу имени члена. Суффикс дописывает make_archive, так что решает только последний;
+// член без известного суффикса (архив собран не нами) берётся как есть
+inline const Codec& GetCodecForMember(const std::string& memberName)
+{
+	for (CodecId id: { CodecId::Gzip, CodecId::Lz4, CodecId::Store })
+	{
+		const Codec& codec = GetCodec(id);
+		if (memberName.ends_with(codec.GetSuffix()))
+		{
+			return codec;
+		}
+	}
+	return GetCodec(CodecId::Store);
+}
+
+// Имя члена без суффикса его кодека, если суффикс есть
+inline std::string StripCodecSuffix(const std::string& memberName)
+{
+	const std::string suffix = GetCodecForMember(memberName).GetSuffix();
+	return memberName.ends_with(suffix) ? memberName.substr(0, memberName.size() - suffix.size()) : memberName;
+}
+
+// Имя кодека для --codec; std::nullopt — auto, выбор по содержимому файла
+inline std::optional<CodecId> ParseCodecName(const std::string& name)
+{
+	if (name == "auto")
+	{
+		return std::nullopt;
+	}
+	if (name == "gzip")
+	{
+		return CodecId::Gzip;
+	}
+	if (name == "lz4")
+	{
+		return CodecId::Lz4;
+	}
+	if (name == "store")
+	{
+		return CodecId::Store;
+	}
+	throw std::invalid_argument("Unknown codec: " + name + " (use auto, gzip, lz4 or store)");
+}
+
+// Обратное к ParseCodecName
+inline std::string GetCodecName(CodecId id)
+{
+	switch (id)
+	{
+	case CodecId::Gzip:
+		return "gzip";
+	case CodecId::Lz4:
+		return "lz4";
+	case CodecId::Store:
+		return "store";
+	}
+	throw std::invalid_argument("Unknown codec id");
+}
+
+inline CodecId ChooseCodec(const std::vector<std::vector<char>>& samples)
+{
+	size_t rawSize = 0;
+	size_t gzipSize = 0;
+	size_t lz4Size = 0;
+	std::vector<char> lz4Buffer;
+	for (const auto& sample: samples)
+	{
+		lz4Buffer.resize(Lz4CompressBound(sample.size()));
+		rawSize += sample.size();
+		lz4Size += Lz4CompressBlock(sample.data(), sample.size(), lz4Buffer.data());
+		gzipSize += DeflateRawBlock(sample.data(), sample.size(), nullptr, 0, true).data.size();
+	}
+	if (rawSize == 0)
+	{
+		return CodecId::Gzip;
+	}
+	if (static_cast<double>(std::min(gzipSize, lz4Size)) >= CODEC_STORE_RATIO * static_cast<double>(rawSize))
+	{
+		return CodecId::Store;
+	}
+	if (static_cast<double>(lz4Size) <= CODEC_LZ4_TOLERANCE * static_cast<double>(gzipSize))
+	{
+		return CodecId::Lz4;
+	}
+	return CodecId::Gzip;
+}
+
+// Куски для оценки равномерно разнесены по файлу: начало, середина, конец
+inline std::vector<std::pair<uint64_t, size_t>> GetCodecSampleRanges(uint64_t size)
+{
+	std::vector<std::pair<uint64_t, size_t>> ranges;
+	if (size <= CODEC_SAMPLE_SIZE * CODEC_SAMPLE_COUNT)
+	{
+		ranges.emplace_back(0, static_cast<size_t>(size));
+		return ranges;
+	}
+	const uint64_t step = (size - CODEC_SAMPLE_SIZE) / (CODEC_SAMPLE_COUNT - 1);
+	for (size_t i = 0; i < CODEC_SAMPLE_COUNT; ++i)
+	{
+		ranges.emplace_back(i * step, CODEC_SAMPLE_SIZE);
+	}
+	return ranges;
+}
+
+inline CodecId ChooseCodecForData(const char* data, size_t size)
+{
+	std::vector<std::vector<char>> samples;
+	for (const auto& [offset, length]: GetCodecSampleRanges(size))
+	{
+		samples.emplace_back(data + offset, data + offset + length);
+	}
+	return ChooseCodec(samples);
+}
+
+inline CodecId ChooseCodecForFile(const std::string& path, uint64_t size)
+{
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		throw std::runtime_error("Failed to open file: " + path);
+	}
+	std::vector<std::vector<char>> samples;
+	for (const auto& [offset, length]: GetCodecSampleRanges(size))
+	{
+		std::vector<char> sample(length);
+		const ssize_t readCount = pread(fd, sample.data(), sample.size(), static_cast<off_t>(offset));
+		sample.resize(readCount > 0 ? static_cast<size_t>(readCount) : 0);
+		samples.push_back(std::move(sample));
+	}
+	close(fd);
+	return ChooseCodec(samples);
+}
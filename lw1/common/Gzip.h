@@ -0,0 +1,422 @@
+#pragma once
+
+#include <zlib.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#include "Crc32.h"
+
+constexpr size_t GZIP_IO_BUFFER_SIZE = 256 * 1024;
+constexpr size_t GZIP_WINDOW_SIZE = 32 * 1024;
+constexpr size_t PARALLEL_BLOCK_SIZE = 1024 * 1024;
+
+// RAII-обёртка над z_stream для сжатия в формат gzip (RFC 1952)
+class GzipDeflater
+{
+public:
+	explicit GzipDeflater(int level = Z_DEFAULT_COMPRESSION)
+	{
+		if (deflateInit2(&m_stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			throw std::runtime_error("Failed to initialize deflate");
+		}
+	}
+
+	GzipDeflater(const GzipDeflater&) = delete;
+	GzipDeflater& operator=(const GzipDeflater&) = delete;
+
+	~GzipDeflater()
+	{
+		deflateEnd(&m_stream);
+	}
+
+	// Заголовок как у утилиты gzip: исходное имя файла, время модификации, OS = Unix
+	void SetHeader(const std::string& name, uint32_t mtime)
+	{
+		m_name = name;
+		m_header = {};
+		m_header.name = reinterpret_cast<Bytef*>(m_name.data());
+		m_header.time = mtime;
+		m_header.os = 3;
+		if (deflateSetHeader(&m_stream, &m_header) != Z_OK)
+		{
+			throw std::runtime_error("Failed to set gzip header");
+		}
+	}
+
+	void Compress(const char* data, size_t size, bool finish, std::vector<char>& out)
+	{
+		m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		m_stream.avail_in = static_cast<uInt>(size);
+		const int flush = finish ? Z_FINISH : Z_NO_FLUSH;
+
+		int result;
+		do
+		{
+			const size_t offset = out.size();
+			out.resize(offset + GZIP_IO_BUFFER_SIZE);
+			m_stream.next_out = reinterpret_cast<Bytef*>(out.data() + offset);
+			m_stream.avail_out = GZIP_IO_BUFFER_SIZE;
+			result = deflate(&m_stream, flush);
+			if (result == Z_STREAM_ERROR)
+			{
+				throw std::runtime_error("Deflate stream error");
+			}
+			out.resize(out.size() - m_stream.avail_out);
+		} while (m_stream.avail_out == 0 || (finish && result != Z_STREAM_END));
+	}
+
+private:
+	z_stream m_stream{};
+	gz_header m_header{};
+	std::string m_name;
+};
+
+// RAII-обёртка над z_stream для распаковки gzip. Склеенные gzip-члены распаковываются подряд, как в gzip -d
+class GzipInflater
+{
+public:
+	GzipInflater()
+	{
+		if (inflateInit2(&m_stream, 15 + 16) != Z_OK)
+		{
+			throw std::runtime_error("Failed to initialize inflate");
+		}
+	}
+
+	GzipInflater(const GzipInflater&) = delete;
+	GzipInflater& operator=(const GzipInflater&) = delete;
+
+	~GzipInflater()
+	{
+		inflateEnd(&m_stream);
+	}
+
+	// sink(const char* data, size_t size) получает распакованные данные по мере готовности
+	template <typename Sink>
+	void Decompress(const char* data, size_t size, Sink&& sink)
+	{
+		m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		m_stream.avail_in = static_cast<uInt>(size);
+		while (true)
+		{
+			if (m_ended)
+			{
+				if (m_stream.avail_in == 0)
+				{
+					break;
+				}
+				inflateReset(&m_stream);
+				m_ended = false;
+			}
+
+			m_stream.next_out = reinterpret_cast<Bytef*>(m_buffer.data());
+			m_stream.avail_out = static_cast<uInt>(m_buffer.size());
+			const int result = inflate(&m_stream, Z_NO_FLUSH);
+			if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+			{
+				throw std::runtime_error("Corrupted gzip data");
+			}
+
+			const size_t produced = m_buffer.size() - m_stream.avail_out;
+			if (produced > 0)
+			{
+				sink(m_buffer.data(), produced);
+			}
+			m_ended = result == Z_STREAM_END;
+			if (m_ended)
+			{
+				// В adler zlib держит CRC32 члена, уже сверенный с его трейлером
+				m_crc = crc32_combine(m_crc, m_stream.adler, static_cast<z_off_t>(m_stream.total_out));
+			}
+			// Буфер заполнен не до конца — вход исчерпан и внутри zlib ничего не осталось
+			if (!m_ended && m_stream.avail_out != 0)
+			{
+				break;
+			}
+		}
+	}
+
+	// Поток закончился ровно на границе gzip-члена
+	[[nodiscard]] bool Finished() const noexcept
+	{
+		return m_ended;
+	}
+
+	// CRC32 распакованных данных всех законченных членов подряд
+	[[nodiscard]] uint32_t GetCrc() const noexcept
+	{
+		return static_cast<uint32_t>(m_crc);
+	}
+
+private:
+	z_stream m_stream{};
+	std::vector<char> m_buffer = std::vector<char>(GZIP_IO_BUFFER_SIZE);
+	bool m_ended = false;
+	uLong m_crc = crc32(0L, Z_NULL, 0);
+};
+
+// Сжимает файл целиком в процессе, без запуска внешнего gzip
+inline void CompressFile(const std::string& inputPath, const std::string& outputPath, int level = Z_DEFAULT_COMPRESSION)
+{
+	std::ifstream in(inputPath, std::ios::binary);
+	if (!in)
+	{
+		throw std::runtime_error("Failed to open file: " + inputPath);
+	}
+	std::ofstream out(outputPath, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		throw std::runtime_error("Failed to create file: " + outputPath);
+	}
+
+	struct stat info{};
+	stat(inputPath.c_str(), &info);
+
+	GzipDeflater deflater(level);
+	deflater.SetHeader(std::filesystem::path(inputPath).filename().string(), static_cast<uint32_t>(info.st_mtime));
+
+	std::vector<char> inBuffer(GZIP_IO_BUFFER_SIZE);
+	std::vector<char> outBuffer;
+	outBuffer.reserve(GZIP_IO_BUFFER_SIZE);
+	while (true)
+	{
+		in.read(inBuffer.data(), static_cast<std::streamsize>(inBuffer.size()));
+		const auto readCount = static_cast<size_t>(in.gcount());
+		if (in.bad())
+		{
+			throw std::runtime_error("Failed to read file: " + inputPath);
+		}
+		const bool finish = in.eof();
+
+		outBuffer.clear();
+		deflater.Compress(inBuffer.data(), readCount, finish, outBuffer);
+		out.write(outBuffer.data(), static_cast<std::streamsize>(outBuffer.size()));
+		if (!out)
+		{
+			throw std::runtime_error("Failed to write file: " + outputPath);
+		}
+		if (finish)
+		{
+			break;
+		}
+	}
+}
+
+// Закодированный блок файла: сырой deflate-поток у gzip, блоки кадра у LZ4, исходные байты при хранении
+struct EncodedBlock
+{
+	std::vector<char> data;
+	uint32_t crc = 0;
+	size_t rawSize = 0;
+};
+
+// Словарь — последние 32 КБ предыдущего блока, поэтому степень сжатия почти как у цельного потока.
+// Не последний блок завершается Z_SYNC_FLUSH: он выровнен по байту и не помечен BFINAL,
+// так что блоки можно просто склеить в один deflate-поток (как делает pigz)
+inline EncodedBlock DeflateRawBlock(const char* data, size_t size, const char* dict, size_t dictSize,
+	bool last, int level = Z_DEFAULT_COMPRESSION)
+{
+	z_stream stream{};
+	if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		throw std::runtime_error("Failed to initialize deflate");
+	}
+	if (dictSize > 0 && deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dict), static_cast<uInt>(dictSize)) != Z_OK)
+	{
+		deflateEnd(&stream);
+		throw std::runtime_error("Failed to set deflate dictionary");
+	}
+
+	EncodedBlock block;
+	block.rawSize = size;
+	block.crc = Crc32(0, data, size);
+	block.data.resize(deflateBound(&stream, size) + 16);
+
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	stream.avail_in = static_cast<uInt>(size);
+	stream.next_out = reinterpret_cast<Bytef*>(block.data.data());
+	stream.avail_out = static_cast<uInt>(block.data.size());
+	const int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+	const bool ok = last ? result == Z_STREAM_END : (result == Z_OK && stream.avail_in == 0 && stream.avail_out != 0);
+	block.data.resize(block.data.size() - stream.avail_out);
+	deflateEnd(&stream);
+	if (!ok)
+	{
+		throw std::runtime_error("Failed to deflate block");
+	}
+	return block;
+}
+
+inline std::vector<char> MakeGzipHeader(const std::string& name, uint32_t mtime, int level = Z_DEFAULT_COMPRESSION)
+{
+	std::vector<char> header = {
+		'\x1f', '\x8b', 8, 0x08, // ID1 ID2 CM FLG=FNAME
+		static_cast<char>(mtime), static_cast<char>(mtime >> 8),
+		static_cast<char>(mtime >> 16), static_cast<char>(mtime >> 24),
+		static_cast<char>(level == 9 ? 2 : (level == 1 ? 4 : 0)), // XFL, как выставляет zlib
+		3 // OS = Unix
+	};
+	header.reserve(header.size() + name.size() + 1);
+	header.insert(header.end(), name.begin(), name.end());
+	header.push_back('\0');
+	return header;
+}
+
+// Самостоятельный блок (--independent-blocks) пишется отдельным gzip-членом, а его полный размер
+// кладётся в подполе "PB" поля FEXTRA, как в BGZF. Распаковщик по нему находит границы членов,
+// не распаковывая данные, и раздаёт члены разным потокам; для gzip -d это обычные склеенные члены
+constexpr char GZIP_BLOCK_SUBFIELD_ID[2] = { 'P', 'B' };
+constexpr size_t GZIP_BLOCK_PEEK_SIZE = 20; // заголовок до конца подполя PB
+constexpr size_t GZIP_TRAILER_SIZE = 8;
+
+inline std::vector<char> MakeGzipBlockHeader(const std::string& name, uint32_t mtime, size_t dataSize,
+	int level = Z_DEFAULT_COMPRESSION)
+{
+	std::vector<char> header = MakeGzipHeader(name, mtime, level);
+	if (name.empty())
+	{
+		header.resize(10);
+		header[3] = 0;
+	}
+	header[3] |= 0x04; // FEXTRA
+
+	const auto memberSize = static_cast<uint32_t>(header.size() + 10 + dataSize + GZIP_TRAILER_SIZE);
+	const char extra[10] = {
+		8, 0, // XLEN
+		GZIP_BLOCK_SUBFIELD_ID[0], GZIP_BLOCK_SUBFIELD_ID[1], 4, 0,
+		static_cast<char>(memberSize), static_cast<char>(memberSize >> 8),
+		static_cast<char>(memberSize >> 16), static_cast<char>(memberSize >> 24)
+	};
+	// FEXTRA по RFC 1952 стоит раньше имени файла
+	header.insert(header.begin() + 10, extra, extra + sizeof(extra));
+	return header;
+}
+
+// Полный размер gzip-члена из подполя PB; std::nullopt, если член записан не блоками
+inline std::optional<uint64_t> ReadGzipBlockSize(const char* data, size_t size)
+{
+	auto byte = [data](size_t i) { return static_cast<uint32_t>(static_cast<unsigned char>(data[i])); };
+	if (size < 12 || byte(0) != 0x1f || byte(1) != 0x8b || byte(2) != 8 || (byte(3) & 0x04) == 0)
+	{
+		return std::nullopt;
+	}
+	const size_t extraEnd = std::min<size_t>(size, 12 + (byte(10) | byte(11) << 8));
+	for (size_t position = 12; position + 4 <= extraEnd;)
+	{
+		const size_t length = byte(position + 2) | byte(position + 3) << 8;
+		if (data[position] == GZIP_BLOCK_SUBFIELD_ID[0] && data[position + 1] == GZIP_BLOCK_SUBFIELD_ID[1]
+			&& length == 4 && position + 8 <= extraEnd)
+		{
+			return byte(position + 4) | byte(position + 5) << 8 | byte(position + 6) << 16 | byte(position + 7) << 24;
+		}
+		position += 4 + length;
+	}
+	return std::nullopt;
+}
+
+// ISIZE из трейлера gzip-члена: размер распакованных данных по модулю 2^32
+inline uint32_t ReadGzipMemberRawSize(const std::vector<char>& member)
+{
+	uint32_t size = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		size |= static_cast<uint32_t>(static_cast<unsigned char>(member[member.size() - 4 + i])) << (8 * i);
+	}
+	return size;
+}
+
+inline std::vector<char> MakeGzipTrailer(uint32_t crc, uint64_t rawSize)
+{
+	std::vector<char> trailer(8);
+	for (int i = 0; i < 4; ++i)
+	{
+		trailer[i] = static_cast<char>(crc >> (8 * i));
+		trailer[4 + i] = static_cast<char>(rawSize >> (8 * i));
+	}
+	return trailer;
+}
+
+// Блок входного файла; словарём для него служит хвост предыдущего блока
+struct InputBlock
+{
+	std::shared_ptr<const std::vector<char>> data;
+	std::shared_ptr<const std::vector<char>> previous;
+	bool last = false;
+
+	[[nodiscard]] EncodedBlock Deflate(int level = Z_DEFAULT_COMPRESSION) const
+	{
+		const size_t dictSize = previous ? std::min(previous->size(), GZIP_WINDOW_SIZE) : 0;
+		const char* dict = previous ? previous->data() + previous->size() - dictSize : nullptr;
+		return DeflateRawBlock(data->data(), data->size(), dict, dictSize, last, level);
+	}
+
+	// Законченный deflate-поток без словаря: его можно распаковать отдельно от соседних блоков
+	[[nodiscard]] EncodedBlock DeflateIndependent(int level = Z_DEFAULT_COMPRESSION) const
+	{
+		return DeflateRawBlock(data->data(), data->size(), nullptr, 0, true, level);
+	}
+};
+
+// Читает файл блоками фиксированного размера с упреждением на один блок,
+// чтобы знать, какой блок последний. Пустой файл даёт один пустой последний блок
+class BlockReader
+{
+public:
+	BlockReader(const std::string& path, size_t blockSize)
+		: m_path(path)
+		, m_blockSize(blockSize)
+		, m_in(path, std::ios::binary)
+	{
+		if (!m_in)
+		{
+			throw std::runtime_error("Failed to open file: " + path);
+		}
+		m_ahead = ReadBlock();
+	}
+
+	std::optional<InputBlock> Next()
+	{
+		if (!m_ahead)
+		{
+			return std::nullopt;
+		}
+
+		InputBlock block;
+		block.data = std::move(m_ahead);
+		block.previous = m_previous;
+		m_ahead = ReadBlock();
+		block.last = m_ahead->empty();
+		if (block.last)
+		{
+			m_ahead.reset();
+		}
+		m_previous = block.data;
+		return block;
+	}
+
+private:
+	std::shared_ptr<std::vector<char>> ReadBlock()
+	{
+		auto block = std::make_shared<std::vector<char>>(m_blockSize);
+		m_in.read(block->data(), static_cast<std::streamsize>(m_blockSize));
+		if (m_in.bad())
+		{
+			throw std::runtime_error("Failed to read file: " + m_path);
+		}
+		block->resize(static_cast<size_t>(m_in.gcount()));
+		return block;
+	}
+
+	std::string m_path;
+	size_t m_blockSize;
+	std::ifstream m_in;
+	std::shared_ptr<std::vector<char>> m_ahead;
+	std::shared_ptr<const std::vector<char>> m_previous;
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Потоковая реализация XXH64: быстрый некриптографический хеш содержимого файлов
+class Xxh64
+{
+public:
+	explicit Xxh64(uint64_t seed = 0)
+		: m_seed(seed)
+	{
+		m_acc[0] = seed + PRIME1 + PRIME2;
+		m_acc[1] = seed + PRIME2;
+		m_acc[2] = seed;
+		m_acc[3] = seed - PRIME1;
+	}
+
+	void Update(const void* data, size_t size)
+	{
+		auto bytes = static_cast<const unsigned char*>(data);
+		m_totalSize += size;
+
+		if (m_bufferSize > 0)
+		{
+			const size_t fill = std::min(size, STRIPE - m_bufferSize);
+			std::memcpy(m_buffer + m_bufferSize, bytes, fill);
+			m_bufferSize += fill;
+			bytes += fill;
+			size -= fill;
+			if (m_bufferSize < STRIPE)
+			{
+				return;
+			}
+			ProcessStripe(m_buffer);
+			m_bufferSize = 0;
+		}
+
+		for (; size >= STRIPE; bytes += STRIPE, size -= STRIPE)
+		{
+			ProcessStripe(bytes);
+		}
+		std::memcpy(m_buffer, bytes, size);
+		m_bufferSize = size;
+	}
+
+	[[nodiscard]] uint64_t Digest() const
+	{
+		uint64_t hash;
+		if (m_totalSize >= STRIPE)
+		{
+			hash = Rotl(m_acc[0], 1) + Rotl(m_acc[1], 7) + Rotl(m_acc[2], 12) + Rotl(m_acc[3], 18);
+			for (uint64_t acc: m_acc)
+			{
+				hash = (hash ^ Round(0, acc)) * PRIME1 + PRIME4;
+			}
+		}
+		else
+		{
+			hash = m_seed + PRIME5;
+		}
+		hash += m_totalSize;
+
+		const unsigned char* tail = m_buffer;
+		size_t size = m_bufferSize;
+		for (; size >= 8; tail += 8, size -= 8)
+		{
+			hash ^= Round(0, Read<uint64_t>(tail));
+			hash = Rotl(hash, 27) * PRIME1 + PRIME4;
+		}
+		if (size >= 4)
+		{
+			hash ^= Read<uint32_t>(tail) * PRIME1;
+			hash = Rotl(hash, 23) * PRIME2 + PRIME3;
+			tail += 4;
+			size -= 4;
+		}
+		for (; size > 0; ++tail, --size)
+		{
+			hash ^= *tail * PRIME5;
+			hash = Rotl(hash, 11) * PRIME1;
+		}
+
+		hash ^= hash >> 33;
+		hash *= PRIME2;
+		hash ^= hash >> 29;
+		hash *= PRIME3;
+		hash ^= hash >> 32;
+		return hash;
+	}
+
+	static uint64_t Hash(const void* data, size_t size, uint64_t seed = 0)
+	{
+		Xxh64 hasher(seed);
+		hasher.Update(data, size);
+		return hasher.Digest();
+	}
+
+private:
+	static constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+	static constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+	static constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+	static constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+	static constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+	static constexpr size_t STRIPE = 32;
+
+	static uint64_t Rotl(uint64_t value, int shift)
+	{
+		return (value << shift) | (value >> (64 - shift));
+	}
+
+	static uint64_t Round(uint64_t acc, uint64_t input)
+	{
+		acc += input * PRIME2;
+		return Rotl(acc, 31) * PRIME1;
+	}
+
+	template <typename T>
+	static uint64_t Read(const unsigned char* data)
+	{
+		T value;
+		std::memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	void ProcessStripe(const unsigned char* stripe)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			m_acc[i] = Round(m_acc[i], Read<uint64_t>(stripe + 8 * i));
+		}
+	}
+
+	uint64_t m_seed;
+	uint64_t m_acc[4]{};
+	unsigned char m_buffer[STRIPE]{};
+	size_t m_bufferSize = 0;
+	uint64_t m_totalSize = 0;
+};
+
+// XXH32 целиком по буферу: нужен для контрольной суммы заголовка кадра LZ4
+inline uint32_t Xxh32(const void* data, size_t size, uint32_t seed = 0)
+{
+	constexpr uint32_t PRIME1 = 2654435761U;
+	constexpr uint32_t PRIME2 = 2246822519U;
+	constexpr uint32_t PRIME3 = 3266489917U;
+	constexpr uint32_t PRIME4 = 668265263U;
+	constexpr uint32_t PRIME5 = 374761393U;
+	auto rotl = [](uint32_t value, int shift) { return (value << shift) | (value >> (32 - shift)); };
+	auto read32 = [](const unsigned char* bytes) {
+		uint32_t value;
+		std::memcpy(&value, bytes, sizeof(value));
+		return value;
+	};
+	auto round = [&](uint32_t acc, uint32_t input) { return rotl(acc + input * PRIME2, 13) * PRIME1; };
+
+	auto bytes = static_cast<const unsigned char*>(data);
+	const unsigned char* end = bytes + size;
+	uint32_t hash;
+	if (size >= 16)
+	{
+		uint32_t acc[4] = { seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1 };
+		for (; end - bytes >= 16; bytes += 16)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				acc[i] = round(acc[i], read32(bytes + 4 * i));
+			}
+		}
+		hash = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+	}
+	else
+	{
+		hash = seed + PRIME5;
+	}
+	hash += static_cast<uint32_t>(size);
+
+	for (; end - bytes >= 4; bytes += 4)
+	{
+		hash = rotl(hash + read32(bytes) * PRIME3, 17) * PRIME4;
+	}
+	for (; bytes < end; ++bytes)
+	{
+		hash = rotl(hash + *bytes * PRIME5, 11) * PRIME1;
+	}
+
+	hash ^= hash >> 15;
+	hash *= PRIME2;
+	hash ^= hash >> 13;
+	hash *= PRIME3;
+	hash ^= hash >> 16;
+	return hash;
+}
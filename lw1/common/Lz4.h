@@ -0,0 +1,444 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+#include "Hash.h"
+
+// LZ4: блоки и кадры в стандартном формате, так что члены .lz4 читает утилита lz4 -d.
+// Сжатие жадное, с одной хеш-таблицей: быстрее gzip в разы ценой худшей степени сжатия
+constexpr uint32_t LZ4_FRAME_MAGIC = 0x184D2204;
+constexpr size_t LZ4_MAX_BLOCK_SIZE = 4 * 1024 * 1024; // BD = 7
+constexpr size_t LZ4_MIN_MATCH = 4;
+constexpr size_t LZ4_LAST_LITERALS = 5; // последние 5 байт блока — всегда литералы
+constexpr size_t LZ4_MATCH_FIND_LIMIT = 12; // совпадение не может начинаться ближе к концу блока
+constexpr size_t LZ4_MAX_OFFSET = 65535;
+constexpr size_t LZ4_HISTORY_SIZE = 64 * 1024;
+constexpr uint32_t LZ4_UNCOMPRESSED_FLAG = 0x80000000U;
+
+inline size_t Lz4CompressBound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+inline uint32_t Lz4Read32(const char* data)
+{
+	uint32_t value;
+	std::memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+inline void Lz4PutLength(char*& out, size_t length)
+{
+	for (; length >= 255; length -= 255)
+	{
+		*out++ = static_cast<char>(255);
+	}
+	*out++ = static_cast<char>(length);
+}
+
+// Сжимает блок в dst (не меньше Lz4CompressBound(size)); возвращает размер сжатых данных
+inline size_t Lz4CompressBlock(const char* src, size_t size, char* dst)
+{
+	constexpr int HASH_BITS = 16;
+	std::vector<uint32_t> table(size_t{ 1 } << HASH_BITS, 0);
+	auto hash = [](uint32_t sequence) { return (sequence * 2654435761U) >> (32 - HASH_BITS); };
+
+	char* out = dst;
+	auto emit = [&](size_t literalsStart, size_t literalsEnd, size_t offset, size_t matchLength) {
+		const size_t literals = literalsEnd - literalsStart;
+		char* token = out++;
+		*token = static_cast<char>(std::min<size_t>(literals, 15) << 4);
+		if (literals >= 15)
+		{
+			Lz4PutLength(out, literals - 15);
+		}
+		std::memcpy(out, src + literalsStart, literals);
+		out += literals;
+		if (matchLength == 0)
+		{
+			return;
+		}
+		*out++ = static_cast<char>(offset);
+		*out++ = static_cast<char>(offset >> 8);
+		const size_t extra = matchLength - LZ4_MIN_MATCH;
+		*token = static_cast<char>(*token | std::min<size_t>(extra, 15));
+		if (extra >= 15)
+		{
+			Lz4PutLength(out, extra - 15);
+		}
+	};
+
+	size_t anchor = 0;
+	if (size > LZ4_MATCH_FIND_LIMIT)
+	{
+		const size_t matchLimit = size - LZ4_LAST_LITERALS;
+		const size_t findLimit = size - LZ4_MATCH_FIND_LIMIT;
+		// В таблице позиция + 1, чтобы ноль означал «пусто»
+		size_t position = 0;
+		size_t misses = 0;
+		while (position < findLimit)
+		{
+			const uint32_t sequence = Lz4Read32(src + position);
+			const uint32_t slot = hash(sequence);
+			const size_t candidate = table[slot];
+			table[slot] = static_cast<uint32_t>(position + 1);
+			if (candidate == 0 || position - (candidate - 1) > LZ4_MAX_OFFSET || Lz4Read32(src + candidate - 1) != sequence)
+			{
+				// На несжимаемых данных шаг растёт, чтобы не тратить на них время
+				position += 1 + (misses++ >> 6);
+				continue;
+			}
+			misses = 0;
+
+			size_t reference = candidate - 1;
+			size_t start = position;
+			while (start > anchor && reference > 0 && src[start - 1] == src[reference - 1])
+			{
+				--start;
+				--reference;
+			}
+			size_t end = position + LZ4_MIN_MATCH;
+			while (end < matchLimit && src[end] == src[reference + (end - start)])
+			{
+				++end;
+			}
+
+			emit(anchor, start, start - reference, end - start);
+			anchor = end;
+			position = end;
+			if (position >= 2 && position - 2 < findLimit)
+			{
+				table[hash(Lz4Read32(src + position - 2))] = static_cast<uint32_t>(position - 2 + 1);
+			}
+		}
+	}
+	emit(anchor, size, 0, 0);
+	return static_cast<size_t>(out - dst);
+}
+
+// Распаковывает блок в конец out. Ссылки назад допустимы не дальше historyStart — начала истории,
+// которую видит блок (начало самого блока для независимых блоков)
+inline void Lz4DecompressBlock(const char* src, size_t size, std::vector<char>& out, size_t historyStart, size_t maxOutput)
+{
+	const size_t blockStart = out.size();
+	out.resize(blockStart + maxOutput);
+	char* base = out.data();
+	size_t position = blockStart;
+	const size_t limit = blockStart + maxOutput;
+	const char* in = src;
+	const char* end = src + size;
+
+	auto readLength = [&](size_t length) {
+		if (length != 15)
+		{
+			return length;
+		}
+		unsigned char byte;
+		do
+		{
+			if (in == end)
+			{
+				throw std::runtime_error("Corrupted LZ4 block");
+			}
+			byte = static_cast<unsigned char>(*in++);
+			length += byte;
+		} while (byte == 255);
+		return length;
+	};
+
+	while (true)
+	{
+		if (in == end)
+		{
+			throw std::runtime_error("Corrupted LZ4 block");
+		}
+		const auto token = static_cast<unsigned char>(*in++);
+		const size_t literals = readLength(token >> 4);
+		if (static_cast<size_t>(end - in) < literals || limit - position < literals)
+		{
+			throw std::runtime_error("Corrupted LZ4 block");
+		}
+		std::memcpy(base + position, in, literals);
+		in += literals;
+		position += literals;
+		if (in == end)
+		{
+			break;
+		}
+
+		if (end - in < 2)
+		{
+			throw std::runtime_error("Corrupted LZ4 block");
+		}
+		const size_t offset = static_cast<unsigned char>(in[0]) | static_cast<size_t>(static_cast<unsigned char>(in[1])) << 8;
+		in += 2;
+		const size_t length = readLength(token & 15) + LZ4_MIN_MATCH;
+		if (offset == 0 || offset > position - historyStart || limit - position < length)
+		{
+			throw std::runtime_error("Corrupted LZ4 block");
+		}
+		// Источник может перекрываться с приёмником — копируем побайтно, если расстояние меньше длины
+		const char* from = base + position - offset;
+		if (offset >= length)
+		{
+			std::memcpy(base + position, from, length);
+		}
+		else
+		{
+			for (size_t i = 0; i < length; ++i)
+			{
+				base[position + i] = from[i];
+			}
+		}
+		position += length;
+	}
+	out.resize(position);
+}
+
+// Заголовок кадра: блоки независимы, без контрольных сумм блоков и содержимого
+// (crc32 члена и так лежит в оглавлении), с размером содержимого
+inline std::vector<char> MakeLz4FrameHeader(uint64_t contentSize)
+{
+	std::vector<char> header;
+	for (int i = 0; i < 4; ++i)
+	{
+		header.push_back(static_cast<char>(LZ4_FRAME_MAGIC >> (8 * i)));
+	}
+	header.push_back(0x68); // версия 01, независимые блоки, есть размер содержимого
+	header.push_back(0x70); // максимальный блок 4 МБ
+	for (int i = 0; i < 8; ++i)
+	{
+		header.push_back(static_cast<char>(contentSize >> (8 * i)));
+	}
+	header.push_back(static_cast<char>(Xxh32(header.data() + 4, header.size() - 4) >> 8));
+	return header;
+}
+
+// Размер содержимого из заголовка кадра, если он там записан
+inline std::optional<uint64_t> ReadLz4ContentSize(const char* data, size_t size)
+{
+	if (size < 14 || Lz4Read32(data) != LZ4_FRAME_MAGIC || (data[4] & 0x08) == 0)
+	{
+		return std::nullopt;
+	}
+	uint64_t contentSize = 0;
+	for (int i = 0; i < 8; ++i)
+	{
+		contentSize |= static_cast<uint64_t>(static_cast<unsigned char>(data[6 + i])) << (8 * i);
+	}
+	return contentSize;
+}
+
+// Метка конца кадра
+inline std::vector<char> MakeLz4FrameEnd()
+{
+	return std::vector<char>(4, '\0');
+}
+
+// Сжимает данные в последовательность блоков кадра (каждый со своим размером впереди);
+// блок, который не сжался, хранится как есть
+inline std::vector<char> Lz4EncodeFrameBlocks(const char* data, size_t size)
+{
+	std::vector<char> result;
+	std::vector<char> compressed(Lz4CompressBound(std::min(size, LZ4_MAX_BLOCK_SIZE)));
+	for (size_t done = 0; done < size;)
+	{
+		const size_t chunk = std::min(size - done, LZ4_MAX_BLOCK_SIZE);
+		const size_t compressedSize = Lz4CompressBlock(data + done, chunk, compressed.data());
+		const bool stored = compressedSize >= chunk;
+		const uint32_t header = stored ? static_cast<uint32_t>(chunk) | LZ4_UNCOMPRESSED_FLAG : static_cast<uint32_t>(compressedSize);
+		for (int i = 0; i < 4; ++i)
+		{
+			result.push_back(static_cast<char>(header >> (8 * i)));
+		}
+		const char* payload = stored ? data + done : compressed.data();
+		result.insert(result.end(), payload, payload + (stored ? chunk : compressedSize));
+		done += chunk;
+	}
+	return result;
+}
+
+// Потоковая распаковка кадров LZ4 (и нескольких кадров подряд), как у GzipInflater
+class Lz4FrameDecoder
+{
+public:
+	template <typename Sink>
+	void Decompress(const char* data, size_t size, Sink&& sink)
+	{
+		m_input.insert(m_input.end(), data, data + size);
+		while (Step(sink))
+		{
+		}
+		m_input.erase(m_input.begin(), m_input.begin() + static_cast<std::ptrdiff_t>(m_position));
+		m_position = 0;
+	}
+
+	// Поток закончился ровно на границе кадра
+	[[nodiscard]] bool Finished() const noexcept
+	{
+		return m_state == State::Magic && m_framesDone > 0 && m_input.size() == m_position;
+	}
+
+private:
+	enum class State
+	{
+		Magic,
+		Descriptor,
+		Block,
+	};
+
+	[[nodiscard]] size_t Available() const noexcept
+	{
+		return m_input.size() - m_position;
+	}
+
+	[[nodiscard]] uint32_t Peek32(size_t offset = 0) const
+	{
+		return Lz4Read32(m_input.data() + m_position + offset);
+	}
+
+	// Разбирает следующий элемент потока; false — не хватает данных
+	template <typename Sink>
+	bool Step(Sink& sink)
+	{
+		switch (m_state)
+		{
+		case State::Magic:
+			if (Available() < 4)
+			{
+				return false;
+			}
+			if (Peek32() != LZ4_FRAME_MAGIC)
+			{
+				throw std::runtime_error("Corrupted LZ4 data");
+			}
+			m_position += 4;
+			m_state = State::Descriptor;
+			return true;
+		case State::Descriptor:
+			return ReadDescriptor();
+		case State::Block:
+			return ReadBlock(sink);
+		}
+		return false;
+	}
+
+	bool ReadDescriptor()
+	{
+		if (Available() < 3)
+		{
+			return false;
+		}
+		const auto flags = static_cast<unsigned char>(m_input[m_position]);
+		const size_t size = 2 + ((flags & 0x08) ? 8 : 0) + ((flags & 0x01) ? 4 : 0);
+		if (Available() < size + 1)
+		{
+			return false;
+		}
+		const char* descriptor = m_input.data() + m_position;
+		const auto blockCode = (static_cast<unsigned char>(descriptor[1]) >> 4) & 7;
+		if ((flags >> 6) != 1 || blockCode < 4
+			|| static_cast<char>(Xxh32(descriptor, size) >> 8) != descriptor[size])
+		{
+			throw std::runtime_error("Corrupted LZ4 frame header");
+		}
+
+		m_independent = (flags & 0x20) != 0;
+		m_blockChecksum = (flags & 0x10) != 0;
+		m_contentChecksum = (flags & 0x04) != 0;
+		m_maxBlockSize = size_t{ 1 } << (8 + 2 * blockCode);
+		m_contentSize.reset();
+		if (flags & 0x08)
+		{
+			uint64_t contentSize = 0;
+			for (int i = 0; i < 8; ++i)
+			{
+				contentSize |= static_cast<uint64_t>(static_cast<unsigned char>(descriptor[2 + i])) << (8 * i);
+			}
+			m_contentSize = contentSize;
+		}
+		m_produced = 0;
+		m_history.clear();
+		m_position += size + 1;
+		m_state = State::Block;
+		return true;
+	}
+
+	template <typename Sink>
+	bool ReadBlock(Sink& sink)
+	{
+		if (Available() < 4)
+		{
+			return false;
+		}
+		const uint32_t header = Peek32();
+		if (header == 0)
+		{
+			const size_t size = 4 + (m_contentChecksum ? 4 : 0);
+			if (Available() < size)
+			{
+				return false;
+			}
+			if (m_contentSize && *m_contentSize != m_produced)
+			{
+				throw std::runtime_error("Corrupted LZ4 data");
+			}
+			m_position += size;
+			m_state = State::Magic;
+			++m_framesDone;
+			return true;
+		}
+
+		const size_t blockSize = header & ~LZ4_UNCOMPRESSED_FLAG;
+		const size_t size = 4 + blockSize + (m_blockChecksum ? 4 : 0);
+		if (blockSize > m_maxBlockSize)
+		{
+			throw std::runtime_error("Corrupted LZ4 data");
+		}
+		if (Available() < size)
+		{
+			return false;
+		}
+
+		const char* block = m_input.data() + m_position + 4;
+		// Перед данными блока — история предыдущих блоков, если блоки связаны
+		const size_t historySize = m_history.size();
+		if (header & LZ4_UNCOMPRESSED_FLAG)
+		{
+			m_history.insert(m_history.end(), block, block + blockSize);
+		}
+		else
+		{
+			Lz4DecompressBlock(block, blockSize, m_history, m_independent ? historySize : 0, m_maxBlockSize);
+		}
+		sink(m_history.data() + historySize, m_history.size() - historySize);
+		m_produced += m_history.size() - historySize;
+
+		if (m_independent)
+		{
+			m_history.clear();
+		}
+		else if (m_history.size() > LZ4_HISTORY_SIZE)
+		{
+			m_history.erase(m_history.begin(), m_history.end() - LZ4_HISTORY_SIZE);
+		}
+		m_position += size;
+		return true;
+	}
+
+	std::vector<char> m_input;
+	size_t m_position = 0;
+	State m_state = State::Magic;
+	size_t m_framesDone = 0;
+	bool m_independent = true;
+	bool m_blockChecksum = false;
+	bool m_contentChecksum = false;
+	size_t m_maxBlockSize = LZ4_MAX_BLOCK_SIZE;
+	std::optional<uint64_t> m_contentSize;
+	uint64_t m_produced = 0;
+	std::vector<char> m_history;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+
+// Ограниченная очередь, выдающая элементы строго по порядковым номерам.
+// Производитель номера seq ждёт в WaitForSlot, пока seq < (номер следующего к выдаче) + capacity,
+// поэтому в памяти одновременно не больше capacity элементов
+template <typename T>
+class OrderedQueue
+{
+public:
+	explicit OrderedQueue(size_t capacity)
+		: m_capacity(capacity)
+	{
+		if (capacity == 0)
+		{
+			throw std::invalid_argument("Queue capacity must be positive");
+		}
+	}
+
+	OrderedQueue(const OrderedQueue&) = delete;
+	OrderedQueue& operator=(const OrderedQueue&) = delete;
+
+	void WaitForSlot(size_t seq)
+	{
+		std::unique_lock lock(m_mutex);
+		m_changed.wait(lock, [&] { return seq < m_next + m_capacity || m_error; });
+		ThrowIfAbortedLocked();
+	}
+
+	void Push(size_t seq, T item)
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			if (m_error)
+			{
+				return;
+			}
+			m_items.emplace(seq, std::move(item));
+			m_maxSize = std::max(m_maxSize, m_items.size());
+		}
+		m_changed.notify_all();
+	}
+
+	// Возвращает std::nullopt, когда выданы все элементы до номера, переданного в Close
+	std::optional<T> Pop()
+	{
+		std::unique_lock lock(m_mutex);
+		m_changed.wait(lock, [&] {
+			return m_error || m_next == m_end || (!m_items.empty() && m_items.begin()->first == m_next);
+		});
+		ThrowIfAbortedLocked();
+		if (m_next == m_end)
+		{
+			return std::nullopt;
+		}
+
+		auto node = m_items.extract(m_items.begin());
+		++m_next;
+		lock.unlock();
+		m_changed.notify_all();
+		return std::move(node.mapped());
+	}
+
+	void Close(size_t end)
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_end = end;
+		}
+		m_changed.notify_all();
+	}
+
+	void Abort(std::exception_ptr error)
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			if (!m_error)
+			{
+				m_error = error;
+			}
+		}
+		m_changed.notify_all();
+	}
+
+	[[nodiscard]] bool IsAborted()
+	{
+		std::lock_guard lock(m_mutex);
+		return m_error != nullptr;
+	}
+
+	void ThrowIfAborted()
+	{
+		std::lock_guard lock(m_mutex);
+		ThrowIfAbortedLocked();
+	}
+
+	// Сколько готовых элементов ждут выдачи сейчас
+	[[nodiscard]] size_t GetSize()
+	{
+		std::lock_guard lock(m_mutex);
+		return m_items.size();
+	}
+
+	[[nodiscard]] size_t GetCapacity() const noexcept
+	{
+		return m_capacity;
+	}
+
+	// Наибольшее число одновременно лежавших в очереди элементов
+	[[nodiscard]] size_t GetMaxSize()
+	{
+		std::lock_guard lock(m_mutex);
+		return m_maxSize;
+	}
+
+private:
+	void ThrowIfAbortedLocked()
+	{
+		if (m_error)
+		{
+			std::rethrow_exception(m_error);
+		}
+	}
+
+	const size_t m_capacity;
+	std::mutex m_mutex;
+	std::condition_variable m_changed;
+	std::map<size_t, T> m_items;
+	size_t m_next = 0;
+	size_t m_end = static_cast<size_t>(-1);
+	size_t m_maxSize = 0;
+	std::exception_ptr m_error;
+};
@@ -0,0 +1,521 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Рабочий процесс — та же программа, запущенная с этим флагом и номерами концов своих каналов
+constexpr const char* PROCESS_POOL_WORKER_FLAG = "--process-pool-worker";
+
+// Пул заранее запущенных рабочих процессов. Задание — массив байтов: он уходит свободному процессу
+// по каналу, процесс выполняет его обработчиком и присылает ответ обратно. На файл тратится одно
+// сообщение вместо fork + exec. Упавший процесс перезапускается, а его задание повторяется.
+// Перезапуск случается, когда у программы уже идут другие потоки, а fork без exec в многопоточном процессе
+// может унести в ребёнка чужую блокировку malloc или zlib. Поэтому процесс всегда запускается через exec
+// /proc/self/exe, и main первым делом отдаёт его ServeIfWorker.
+// Каналы со стороны пула неблокирующие: один поток ввода-вывода по poll дописывает задания и дочитывает
+// ответы всех процессов понемногу, и медленный процесс не задерживает раздачу остальным
+class ProcessPool
+{
+public:
+	using Handler = std::function<std::vector<char>(const std::vector<char>&)>;
+
+	// Если процесс запущен пулом как рабочий, выполняет задания обработчиком и завершает процесс; иначе ничего не делает
+	static void ServeIfWorker(int argc, char* argv[], const Handler& handler)
+	{
+		if (argc != 4 || std::strcmp(argv[1], PROCESS_POOL_WORKER_FLAG) != 0)
+		{
+			return;
+		}
+		WorkerMain(std::atoi(argv[2]), std::atoi(argv[3]), handler);
+	}
+
+	explicit ProcessPool(int numProcesses, int maxAttempts = 2)
+		: m_maxAttempts(maxAttempts)
+	{
+		if (numProcesses <= 0)
+		{
+			throw std::invalid_argument("Number of processes must be positive");
+		}
+		// Запись в канал упавшего процесса должна вернуть EPIPE, а не убить нас
+		std::signal(SIGPIPE, SIG_IGN);
+		// Канал пробуждения неблокирующий: переполнение не страшно, он и так уже готов к чтению
+		if (pipe2(m_wake, O_CLOEXEC | O_NONBLOCK) != 0)
+		{
+			throw std::runtime_error("Failed to create pipe");
+		}
+
+		m_workers.resize(numProcesses);
+		for (auto& worker: m_workers)
+		{
+			Spawn(worker);
+		}
+		m_ioThread = std::jthread([this](std::stop_token stopToken) { IoLoop(stopToken); });
+	}
+
+	ProcessPool(const ProcessPool&) = delete;
+	ProcessPool& operator=(const ProcessPool&) = delete;
+
+	~ProcessPool()
+	{
+		m_ioThread.request_stop();
+		Wake();
+		m_ioThread.join();
+		for (auto& worker: m_workers)
+		{
+			Stop(worker);
+		}
+		close(m_wake[0]);
+		close(m_wake[1]);
+	}
+
+	std::future<std::vector<char>> Submit(std::vector<char> data)
+	{
+		Job job;
+		job.data = std::move(data);
+		auto future = job.result.get_future();
+		{
+			std::lock_guard lock(m_mutex);
+			m_queue.push_back(std::move(job));
+		}
+		Wake();
+		return future;
+	}
+
+	[[nodiscard]] int GetProcessCount() const noexcept
+	{
+		return static_cast<int>(m_workers.size());
+	}
+
+	// Сколько раз процессы пришлось перезапускать
+	[[nodiscard]] int GetRespawnCount() const noexcept
+	{
+		return m_respawnCount;
+	}
+
+private:
+	struct Job
+	{
+		std::vector<char> data;
+		std::promise<std::vector<char>> result;
+		int attempts = 0;
+	};
+
+	// Сообщение в канале: [uint32 длина][данные]; ответ процесса ещё начинается с байта статуса
+	enum Status : uint8_t
+	{
+		STATUS_OK = 0,
+		STATUS_ERROR = 1,
+	};
+
+	static constexpr size_t RESULT_HEADER_SIZE = sizeof(uint8_t) + sizeof(uint32_t);
+
+	struct Worker
+	{
+		pid_t pid = -1;
+		int jobFd = -1;
+		int resultFd = -1;
+		std::optional<Job> job;
+		// Сколько байтов задания вместе с длиной уже ушло в канал
+		size_t sent = 0;
+		// Ответ собирается по частям: заголовок [статус][длина], затем тело
+		char header[RESULT_HEADER_SIZE]{};
+		size_t headerReceived = 0;
+		std::vector<char> body;
+		size_t bodyReceived = 0;
+	};
+
+	static bool ReadAll(int fd, void* data, size_t size)
+	{
+		auto bytes = static_cast<char*>(data);
+		while (size > 0)
+		{
+			const ssize_t readCount = read(fd, bytes, size);
+			if (readCount < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (readCount <= 0)
+			{
+				return false;
+			}
+			bytes += readCount;
+			size -= static_cast<size_t>(readCount);
+		}
+		return true;
+	}
+
+	static bool WriteAll(int fd, const void* data, size_t size)
+	{
+		auto bytes = static_cast<const char*>(data);
+		while (size > 0)
+		{
+			const ssize_t written = write(fd, bytes, size);
+			if (written < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (written <= 0)
+			{
+				return false;
+			}
+			bytes += written;
+			size -= static_cast<size_t>(written);
+		}
+		return true;
+	}
+
+	static bool WriteMessage(int fd, const char* data, size_t size)
+	{
+		const auto length = static_cast<uint32_t>(size);
+		return WriteAll(fd, &length, sizeof(length)) && WriteAll(fd, data, size);
+	}
+
+	static std::optional<std::vector<char>> ReadMessage(int fd)
+	{
+		uint32_t length = 0;
+		if (!ReadAll(fd, &length, sizeof(length)))
+		{
+			return std::nullopt;
+		}
+		std::vector<char> data(length);
+		if (!ReadAll(fd, data.data(), data.size()))
+		{
+			return std::nullopt;
+		}
+		return data;
+	}
+
+	void Spawn(Worker& worker)
+	{
+		int jobPipe[2];
+		int resultPipe[2];
+		if (pipe2(jobPipe, O_CLOEXEC) != 0)
+		{
+			throw std::runtime_error("Failed to create pipe");
+		}
+		if (pipe2(resultPipe, O_CLOEXEC) != 0)
+		{
+			close(jobPipe[0]);
+			close(jobPipe[1]);
+			throw std::runtime_error("Failed to create pipe");
+		}
+
+		// После fork в многопоточном процессе можно звать только async-signal-safe функции,
+		// поэтому всё для exec готовится заранее
+		std::string jobArg = std::to_string(jobPipe[0]);
+		std::string resultArg = std::to_string(resultPipe[1]);
+		std::string flag = PROCESS_POOL_WORKER_FLAG;
+		std::string exe = "/proc/self/exe";
+		char* const argv[] = { exe.data(), flag.data(), jobArg.data(), resultArg.data(), nullptr };
+
+		const pid_t pid = fork();
+		if (pid < 0)
+		{
+			for (int fd: { jobPipe[0], jobPipe[1], resultPipe[0], resultPipe[1] })
+			{
+				close(fd);
+			}
+			throw std::runtime_error("Failed to fork worker process");
+		}
+		if (pid == 0)
+		{
+			// Через exec проходят только концы этого процесса, остальные дескрипторы пула закрываются сами
+			fcntl(jobPipe[0], F_SETFD, 0);
+			fcntl(resultPipe[1], F_SETFD, 0);
+			execv(exe.c_str(), argv);
+			_exit(127);
+		}
+
+		close(jobPipe[0]);
+		close(resultPipe[1]);
+		fcntl(jobPipe[1], F_SETFL, O_NONBLOCK);
+		fcntl(resultPipe[0], F_SETFL, O_NONBLOCK);
+		worker.pid = pid;
+		worker.jobFd = jobPipe[1];
+		worker.resultFd = resultPipe[0];
+		worker.sent = 0;
+		worker.headerReceived = 0;
+		worker.body.clear();
+		worker.bodyReceived = 0;
+	}
+
+	[[noreturn]] static void WorkerMain(int jobFd, int resultFd, const Handler& handler)
+	{
+		while (auto job = ReadMessage(jobFd))
+		{
+			uint8_t status = STATUS_OK;
+			std::vector<char> result;
+			try
+			{
+				result = handler(*job);
+			}
+			catch (const std::exception& e)
+			{
+				status = STATUS_ERROR;
+				const std::string message = e.what();
+				result.assign(message.begin(), message.end());
+			}
+			if (!WriteAll(resultFd, &status, sizeof(status)) || !WriteMessage(resultFd, result.data(), result.size()))
+			{
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+
+	// Закрывает каналы процесса и дожидается его; возвращает описание причины смерти
+	static std::string Stop(Worker& worker)
+	{
+		if (worker.pid <= 0)
+		{
+			return {};
+		}
+		close(worker.jobFd);
+		close(worker.resultFd);
+		int status = 0;
+		waitpid(worker.pid, &status, 0);
+		worker.pid = -1;
+		worker.jobFd = -1;
+		worker.resultFd = -1;
+		if (WIFSIGNALED(status))
+		{
+			return "killed by signal " + std::to_string(WTERMSIG(status));
+		}
+		return "exited with code " + std::to_string(WEXITSTATUS(status));
+	}
+
+	void Wake()
+	{
+		const char byte = 0;
+		[[maybe_unused]] const ssize_t written = write(m_wake[1], &byte, 1);
+	}
+
+	// Для каждого процесса в poll два дескриптора: канал ответа и, пока задание не ушло целиком, канал задания
+	void IoLoop(std::stop_token stopToken)
+	{
+		std::vector<pollfd> fds;
+		while (!stopToken.stop_requested())
+		{
+			AssignJobs();
+
+			fds.clear();
+			fds.push_back({ m_wake[0], POLLIN, 0 });
+			for (const auto& worker: m_workers)
+			{
+				fds.push_back({ worker.resultFd, POLLIN, 0 });
+				fds.push_back({ HasUnsentJob(worker) ? worker.jobFd : -1, POLLOUT, 0 });
+			}
+			if (poll(fds.data(), fds.size(), -1) < 0)
+			{
+				continue;
+			}
+
+			if (fds[0].revents != 0)
+			{
+				char buffer[256];
+				[[maybe_unused]] const ssize_t readCount = read(m_wake[0], buffer, sizeof(buffer));
+			}
+			for (size_t i = 0; i < m_workers.size(); ++i)
+			{
+				Worker& worker = m_workers[i];
+				if ((fds[2 * i + 2].revents != 0 && !SendJob(worker))
+					|| (fds[2 * i + 1].revents != 0 && !ReceiveResult(worker)))
+				{
+					Respawn(worker);
+				}
+			}
+		}
+	}
+
+	// Каждому свободному процессу — по заданию из очереди; что не влезло в канал сразу, допишет IoLoop
+	void AssignJobs()
+	{
+		for (auto& worker: m_workers)
+		{
+			if (worker.job)
+			{
+				continue;
+			}
+			{
+				std::lock_guard lock(m_mutex);
+				if (m_queue.empty())
+				{
+					return;
+				}
+				worker.job = std::move(m_queue.front());
+				m_queue.pop_front();
+			}
+			worker.sent = 0;
+			if (!SendJob(worker))
+			{
+				Respawn(worker);
+			}
+		}
+	}
+
+	[[nodiscard]] static bool HasUnsentJob(const Worker& worker)
+	{
+		return worker.job && worker.sent < sizeof(uint32_t) + worker.job->data.size();
+	}
+
+	// Пишет, сколько примет канал; false — процесс закрыл канал
+	static bool SendJob(Worker& worker)
+	{
+		const auto length = static_cast<uint32_t>(worker.job->data.size());
+		while (HasUnsentJob(worker))
+		{
+			const bool inLength = worker.sent < sizeof(length);
+			const char* data = inLength ? reinterpret_cast<const char*>(&length) + worker.sent
+										: worker.job->data.data() + (worker.sent - sizeof(length));
+			const size_t size = inLength ? sizeof(length) - worker.sent : sizeof(length) + length - worker.sent;
+			const ssize_t written = write(worker.jobFd, data, size);
+			if (written < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (written < 0 && errno == EAGAIN)
+			{
+				return true;
+			}
+			if (written <= 0)
+			{
+				return false;
+			}
+			worker.sent += static_cast<size_t>(written);
+		}
+		return true;
+	}
+
+	// Дочитывает ответ, сколько есть в канале, и отдаёт его, когда он собран целиком; false — процесс умер
+	// или прислал ответ без задания
+	static bool ReceiveResult(Worker& worker)
+	{
+		while (true)
+		{
+			const bool inHeader = worker.headerReceived < RESULT_HEADER_SIZE;
+			char* data = inHeader ? worker.header + worker.headerReceived : worker.body.data() + worker.bodyReceived;
+			const size_t size = inHeader ? RESULT_HEADER_SIZE - worker.headerReceived : worker.body.size() - worker.bodyReceived;
+			const ssize_t readCount = read(worker.resultFd, data, size);
+			if (readCount < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (readCount < 0 && errno == EAGAIN)
+			{
+				return true;
+			}
+			if (readCount <= 0)
+			{
+				return false;
+			}
+
+			if (inHeader)
+			{
+				worker.headerReceived += static_cast<size_t>(readCount);
+				if (worker.headerReceived < RESULT_HEADER_SIZE)
+				{
+					continue;
+				}
+				uint32_t length = 0;
+				std::memcpy(&length, worker.header + sizeof(uint8_t), sizeof(length));
+				worker.body.resize(length);
+				worker.bodyReceived = 0;
+			}
+			else
+			{
+				worker.bodyReceived += static_cast<size_t>(readCount);
+			}
+			if (worker.headerReceived == RESULT_HEADER_SIZE && worker.bodyReceived == worker.body.size())
+			{
+				if (!worker.job)
+				{
+					return false;
+				}
+				FinishJob(worker);
+			}
+		}
+	}
+
+	static void FinishJob(Worker& worker)
+	{
+		std::vector<char> result = std::move(worker.body);
+		if (static_cast<uint8_t>(worker.header[0]) == STATUS_OK)
+		{
+			worker.job->result.set_value(std::move(result));
+		}
+		else
+		{
+			worker.job->result.set_exception(std::make_exception_ptr(std::runtime_error(std::string(result.begin(), result.end()))));
+		}
+		worker.job.reset();
+		worker.headerReceived = 0;
+		worker.body.clear();
+		worker.bodyReceived = 0;
+	}
+
+	// Процесс упал: задание возвращается в начало очереди, пока не кончатся попытки, а на его место встаёт новый процесс
+	void Respawn(Worker& worker)
+	{
+		const std::string reason = Stop(worker);
+		++m_respawnCount;
+		if (worker.job)
+		{
+			Job job = std::move(*worker.job);
+			worker.job.reset();
+			if (++job.attempts < m_maxAttempts)
+			{
+				std::lock_guard lock(m_mutex);
+				m_queue.push_front(std::move(job));
+			}
+			else
+			{
+				job.result.set_exception(std::make_exception_ptr(std::runtime_error("Worker process " + reason)));
+			}
+		}
+
+		try
+		{
+			Spawn(worker);
+		}
+		catch (...)
+		{
+			FailPending(std::current_exception());
+		}
+	}
+
+	// Без рабочего процесса задания выполнить некому
+	void FailPending(const std::exception_ptr& error)
+	{
+		std::lock_guard lock(m_mutex);
+		for (auto& job: m_queue)
+		{
+			job.result.set_exception(error);
+		}
+		m_queue.clear();
+	}
+
+	int m_maxAttempts;
+	int m_wake[2]{ -1, -1 };
+	std::vector<Worker> m_workers;
+	std::mutex m_mutex;
+	std::deque<Job> m_queue;
+	std::atomic<int> m_respawnCount = 0;
+	std::jthread m_ioThread;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+// Порядок раздачи задач по правилу LPT (longest processing time first):
+// самые долгие задачи стартуют первыми, а мелкие добирают освободившиеся потоки в конце
+template <typename T, typename Cost>
+std::vector<size_t> LongestFirstOrder(const std::vector<T>& items, Cost cost)
+{
+	std::vector<size_t> order(items.size());
+	std::iota(order.begin(), order.end(), size_t{ 0 });
+	std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+		return cost(items[lhs]) > cost(items[rhs]);
+	});
+	return order;
+}
+
+template <typename T, typename Cost>
+std::vector<T> SortLongestFirst(const std::vector<T>& items, Cost cost)
+{
+	std::vector<T> sorted;
+	sorted.reserve(items.size());
+	for (size_t index: LongestFirstOrder(items, cost))
+	{
+		sorted.push_back(items[index]);
+	}
+	return sorted;
+}
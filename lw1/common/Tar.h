@@ -0,0 +1,575 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+constexpr size_t TAR_BLOCK_SIZE = 512;
+constexpr size_t TAR_WRITE_BUFFER_SIZE = 1024 * 1024;
+constexpr size_t TAR_READ_BUFFER_SIZE = 1024 * 1024;
+
+using TarHeader = std::array<char, TAR_BLOCK_SIZE>;
+
+// Как и tar, не храним абсолютные пути
+inline std::string StripLeadingSlashes(const std::string& name)
+{
+	const size_t start = name.find_first_not_of('/');
+	return start == std::string::npos ? std::string() : name.substr(start);
+}
+
+inline void WriteTarOctal(char* field, size_t width, uint64_t value)
+{
+	// Не помещается в восьмеричное поле — пишем в base-256, как GNU tar
+	if (width > 1 && value >= (uint64_t{ 1 } << (3 * (width - 1))))
+	{
+		std::memset(field, 0, width);
+		field[0] = static_cast<char>(0x80);
+		for (size_t i = width - 1; i > 0 && value; --i, value >>= 8)
+		{
+			field[i] = static_cast<char>(value & 0xff);
+		}
+		return;
+	}
+	field[width - 1] = '\0';
+	for (size_t i = width - 1; i > 0; --i, value >>= 3)
+	{
+		field[i - 1] = static_cast<char>('0' + (value & 7));
+	}
+}
+
+inline void FinishTarHeader(TarHeader& header)
+{
+	std::memset(header.data() + 148, ' ', 8);
+	unsigned checksum = 0;
+	for (char c: header)
+	{
+		checksum += static_cast<unsigned char>(c);
+	}
+	WriteTarOctal(header.data() + 148, 7, checksum);
+	header[155] = ' ';
+}
+
+inline TarHeader MakeTarHeader(const std::string& name, uint64_t size, int64_t mtime, unsigned mode, char type = '0')
+{
+	TarHeader header{};
+	std::memcpy(header.data(), name.data(), std::min(name.size(), size_t{ 100 }));
+	WriteTarOctal(header.data() + 100, 8, mode & 07777);
+	WriteTarOctal(header.data() + 108, 8, 0);
+	WriteTarOctal(header.data() + 116, 8, 0);
+	WriteTarOctal(header.data() + 124, 12, size);
+	WriteTarOctal(header.data() + 136, 12, static_cast<uint64_t>(std::max<int64_t>(mtime, 0)));
+	header[156] = type;
+	std::memcpy(header.data() + 257, "ustar", 6);
+	std::memcpy(header.data() + 263, "00", 2);
+	FinishTarHeader(header);
+	return header;
+}
+
+// Потоковая запись tar (ustar + PAX для длинных имён) без внешней утилиты.
+// Размер члена заранее неизвестен: заголовок дописывается через pwrite в EndMember
+class TarWriter
+{
+public:
+	explicit TarWriter(const std::string& path)
+		: m_path(path)
+	{
+		m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (m_fd < 0)
+		{
+			throw std::runtime_error("Failed to create archive: " + path);
+		}
+		m_buffer.reserve(TAR_WRITE_BUFFER_SIZE);
+	}
+
+	TarWriter(const TarWriter&) = delete;
+	TarWriter& operator=(const TarWriter&) = delete;
+
+	~TarWriter()
+	{
+		close(m_fd);
+	}
+
+	// Возвращает смещение данных члена от начала архива
+	uint64_t BeginMember(const std::string& name, int64_t mtime, unsigned mode)
+	{
+		if (m_inMember)
+		{
+			throw std::logic_error("Previous tar member is not finished");
+		}
+
+		std::string storedName = StripLeadingSlashes(name);
+		if (storedName.size() > 100)
+		{
+			WritePaxPath(storedName, mtime);
+			storedName.resize(100);
+		}
+
+		m_headerOffset = m_offset;
+		m_header = MakeTarHeader(storedName, 0, mtime, mode);
+		Write(m_header.data(), m_header.size());
+		m_memberSize = 0;
+		m_inMember = true;
+		return m_offset;
+	}
+
+	void Write(const char* data, size_t size)
+	{
+		if (m_inMember)
+		{
+			m_memberSize += size;
+		}
+		m_offset += size;
+		while (size > 0)
+		{
+			const size_t chunk = std::min(size, TAR_WRITE_BUFFER_SIZE - m_buffer.size());
+			m_buffer.insert(m_buffer.end(), data, data + chunk);
+			data += chunk;
+			size -= chunk;
+			if (m_buffer.size() == TAR_WRITE_BUFFER_SIZE)
+			{
+				Flush();
+			}
+		}
+	}
+
+	// Возвращает итоговый размер данных члена
+	uint64_t EndMember()
+	{
+		const uint64_t size = m_memberSize;
+		m_inMember = false;
+		Pad();
+
+		WriteTarOctal(m_header.data() + 124, 12, size);
+		FinishTarHeader(m_header);
+		Patch(m_headerOffset, m_header.data(), m_header.size());
+		return size;
+	}
+
+	// Перезаписывает уже записанные байты: то, что ещё в буфере, правится в памяти, остальное — через pwrite
+	void Patch(uint64_t offset, const char* data, size_t size)
+	{
+		if (offset + size > m_offset)
+		{
+			throw std::logic_error("Patch beyond the end of archive");
+		}
+		if (offset < m_flushedOffset)
+		{
+			const size_t flushed = static_cast<size_t>(std::min<uint64_t>(size, m_flushedOffset - offset));
+			if (pwrite(m_fd, data, flushed, static_cast<off_t>(offset)) != static_cast<ssize_t>(flushed))
+			{
+				throw std::runtime_error("Failed to write archive: " + m_path);
+			}
+			data += flushed;
+			size -= flushed;
+			offset += flushed;
+		}
+		if (size > 0)
+		{
+			std::memcpy(m_buffer.data() + (offset - m_flushedOffset), data, size);
+		}
+	}
+
+	// Маркер конца архива — два нулевых блока. После него можно дописать служебные данные и вызвать Flush
+	void Finish()
+	{
+		const std::vector<char> zeros(2 * TAR_BLOCK_SIZE, '\0');
+		Write(zeros.data(), zeros.size());
+		Flush();
+	}
+
+	[[nodiscard]] uint64_t GetOffset() const noexcept
+	{
+		return m_offset;
+	}
+
+	void Flush()
+	{
+		const char* data = m_buffer.data();
+		size_t left = m_buffer.size();
+		while (left > 0)
+		{
+			const ssize_t written = write(m_fd, data, left);
+			if (written < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (written <= 0)
+			{
+				throw std::runtime_error("Failed to write archive: " + m_path);
+			}
+			data += written;
+			left -= static_cast<size_t>(written);
+		}
+		m_flushedOffset += m_buffer.size();
+		m_buffer.clear();
+	}
+
+private:
+	void WritePaxPath(const std::string& name, int64_t mtime)
+	{
+		// Длина записи включает собственную запись длины, подбираем её итерацией
+		const std::string body = " path=" + name + "\n";
+		size_t length = body.size();
+		while (std::to_string(length).size() + body.size() != length)
+		{
+			length = std::to_string(length).size() + body.size();
+		}
+		const std::string record = std::to_string(length) + body;
+
+		TarHeader header = MakeTarHeader("././@PaxHeader", record.size(), mtime, 0644, 'x');
+		Write(header.data(), header.size());
+		Write(record.data(), record.size());
+		Pad();
+	}
+
+	void Pad()
+	{
+		const size_t tail = m_offset % TAR_BLOCK_SIZE;
+		if (tail != 0)
+		{
+			const std::vector<char> zeros(TAR_BLOCK_SIZE - tail, '\0');
+			Write(zeros.data(), zeros.size());
+		}
+	}
+
+	std::string m_path;
+	int m_fd = -1;
+	std::vector<char> m_buffer;
+	uint64_t m_offset = 0;
+	uint64_t m_flushedOffset = 0;
+	uint64_t m_headerOffset = 0;
+	uint64_t m_memberSize = 0;
+	TarHeader m_header{};
+	bool m_inMember = false;
+};
+
+inline uint64_t ReadTarNumber(const char* field, size_t width)
+{
+	uint64_t value = 0;
+	if (static_cast<unsigned char>(field[0]) & 0x80)
+	{
+		for (size_t i = 1; i < width; ++i)
+		{
+			value = (value << 8) | static_cast<unsigned char>(field[i]);
+		}
+		return value;
+	}
+	for (size_t i = 0; i < width && field[i] != '\0'; ++i)
+	{
+		if (field[i] >= '0' && field[i] <= '7')
+		{
+			value = (value << 3) | static_cast<uint64_t>(field[i] - '0');
+		}
+	}
+	return value;
+}
+
+inline std::string ReadTarString(const char* field, size_t width)
+{
+	return { field, strnlen(field, width) };
+}
+
+struct TarEntry
+{
+	std::string name;
+	uint64_t size = 0;
+	int64_t mtime = 0;
+	unsigned mode = 0644;
+	char type = '0';
+	uint64_t dataOffset = 0; // смещение данных от начала потока
+
+	[[nodiscard]] bool IsRegularFile() const noexcept
+	{
+		return type == '0' || type == '\0' || type == '7';
+	}
+};
+
+// Потоковое чтение tar из файлового дескриптора (файл, pipe, stdin) без перемотки назад.
+// Понимает ustar-префиксы, PAX-записи path/size и длинные имена GNU tar
+class TarReader
+{
+public:
+	// bytesRead, если задан, — счётчик прочитанных из fd байтов, который можно читать из других потоков
+	explicit TarReader(int fd, std::atomic<uint64_t>* bytesRead = nullptr)
+		: m_fd(fd)
+		, m_buffer(TAR_READ_BUFFER_SIZE)
+		, m_bytesRead(bytesRead)
+	{
+		// Пропускаемые данные обычного файла перепрыгиваем lseek, из трубы — вычитываем
+		struct stat info{};
+		if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+		{
+			const off_t position = lseek(fd, 0, SEEK_CUR);
+			if (position >= 0)
+			{
+				m_seekLimit = static_cast<uint64_t>(info.st_size - position);
+			}
+		}
+	}
+
+	TarReader(const TarReader&) = delete;
+	TarReader& operator=(const TarReader&) = delete;
+
+	// Переходит к следующему члену; std::nullopt — достигнут маркер конца архива
+	std::optional<TarEntry> Next()
+	{
+		if (m_finished)
+		{
+			return std::nullopt;
+		}
+		SkipRest();
+
+		std::optional<std::string> longName;
+		std::optional<uint64_t> paxSize;
+		while (true)
+		{
+			TarHeader header;
+			if (!ReadExact(header.data(), header.size(), true))
+			{
+				return std::nullopt;
+			}
+			if (std::all_of(header.begin(), header.end(), [](char c) { return c == '\0'; }))
+			{
+				m_finished = true;
+				return std::nullopt;
+			}
+			VerifyChecksum(header);
+
+			TarEntry entry;
+			entry.name = ReadTarString(header.data(), 100);
+			entry.mode = static_cast<unsigned>(ReadTarNumber(header.data() + 100, 8));
+			entry.size = ReadTarNumber(header.data() + 124, 12);
+			entry.mtime = static_cast<int64_t>(ReadTarNumber(header.data() + 136, 12));
+			entry.type = header[156];
+			if (std::memcmp(header.data() + 257, "ustar", 5) == 0 && header[345] != '\0')
+			{
+				entry.name = ReadTarString(header.data() + 345, 155) + "/" + entry.name;
+			}
+
+			if (entry.type == 'x' || entry.type == 'g' || entry.type == 'L')
+			{
+				std::string data = ReadSmallData(entry.size);
+				if (entry.type == 'L')
+				{
+					longName = ReadTarString(data.data(), data.size());
+				}
+				else if (entry.type == 'x')
+				{
+					ParsePax(data, longName, paxSize);
+				}
+				continue;
+			}
+
+			if (longName)
+			{
+				entry.name = *longName;
+			}
+			if (paxSize)
+			{
+				entry.size = *paxSize;
+			}
+			entry.dataOffset = m_offset;
+			m_remaining = entry.size;
+			m_padding = (TAR_BLOCK_SIZE - entry.size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+			return entry;
+		}
+	}
+
+	// Читает данные текущего члена; 0 — данные закончились
+	size_t Read(char* data, size_t size)
+	{
+		size = static_cast<size_t>(std::min<uint64_t>(size, m_remaining));
+		if (size > 0 && !ReadExact(data, size, false))
+		{
+			throw std::runtime_error("Unexpected end of archive");
+		}
+		m_remaining -= size;
+		return size;
+	}
+
+	// Пропускает size байтов данных текущего члена, не больше, чем их осталось; возвращает, сколько пропущено
+	uint64_t Skip(uint64_t size)
+	{
+		size = std::min(size, m_remaining);
+		Discard(size);
+		m_remaining -= size;
+		return size;
+	}
+
+	// Пропускает остаток текущего члена
+	void SkipRest()
+	{
+		Discard(m_remaining + m_padding);
+		m_remaining = 0;
+		m_padding = 0;
+	}
+
+	[[nodiscard]] uint64_t GetOffset() const noexcept
+	{
+		return m_offset;
+	}
+
+private:
+	static void VerifyChecksum(TarHeader header)
+	{
+		const auto expected = ReadTarNumber(header.data() + 148, 8);
+		std::memset(header.data() + 148, ' ', 8);
+		uint64_t checksum = 0;
+		for (char c: header)
+		{
+			checksum += static_cast<unsigned char>(c);
+		}
+		if (checksum != expected)
+		{
+			throw std::runtime_error("Corrupted tar header");
+		}
+	}
+
+	static void ParsePax(const std::string& data, std::optional<std::string>& path, std::optional<uint64_t>& size)
+	{
+		// Запись: "<длина> <ключ>=<значение>\n", длина учитывает всю запись
+		for (size_t position = 0; position < data.size();)
+		{
+			const size_t space = data.find(' ', position);
+			if (space == std::string::npos)
+			{
+				break;
+			}
+			const size_t length = std::stoull(data.substr(position, space - position));
+			if (length == 0 || position + length > data.size())
+			{
+				throw std::runtime_error("Corrupted PAX header");
+			}
+			const std::string record = data.substr(space + 1, position + length - space - 2);
+			const size_t equals = record.find('=');
+			if (equals != std::string::npos)
+			{
+				const std::string key = record.substr(0, equals);
+				if (key == "path")
+				{
+					path = record.substr(equals + 1);
+				}
+				else if (key == "size")
+				{
+					size = std::stoull(record.substr(equals + 1));
+				}
+			}
+			position += length;
+		}
+	}
+
+	std::string ReadSmallData(uint64_t size)
+	{
+		if (size > 1024 * 1024)
+		{
+			throw std::runtime_error("Tar extended header is too large");
+		}
+		std::string data(size, '\0');
+		if (!ReadExact(data.data(), data.size(), false))
+		{
+			throw std::runtime_error("Unexpected end of archive");
+		}
+		Discard((TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE);
+		return data;
+	}
+
+	void Discard(uint64_t size)
+	{
+		// Что уже в буфере, просто отбрасываем; остальное перепрыгиваем, если можно
+		const uint64_t beyond = size - std::min<uint64_t>(size, m_length - m_position);
+		if (m_seekLimit && beyond > 0)
+		{
+			if (m_offset + size > *m_seekLimit)
+			{
+				throw std::runtime_error("Unexpected end of archive");
+			}
+			if (lseek(m_fd, static_cast<off_t>(beyond), SEEK_CUR) < 0)
+			{
+				throw std::runtime_error("Failed to seek archive");
+			}
+			m_offset += size;
+			m_position = 0;
+			m_length = 0;
+			return;
+		}
+		while (size > 0)
+		{
+			if (m_position == m_length && !Fill())
+			{
+				throw std::runtime_error("Unexpected end of archive");
+			}
+			const size_t chunk = static_cast<size_t>(std::min<uint64_t>(size, m_length - m_position));
+			m_position += chunk;
+			m_offset += chunk;
+			size -= chunk;
+		}
+	}
+
+	// allowEof: конец потока ровно на границе допустим (архив без маркера конца)
+	bool ReadExact(char* data, size_t size, bool allowEof)
+	{
+		size_t done = 0;
+		while (done < size)
+		{
+			if (m_position == m_length && !Fill())
+			{
+				if (allowEof && done == 0)
+				{
+					return false;
+				}
+				throw std::runtime_error("Unexpected end of archive");
+			}
+			const size_t chunk = std::min(size - done, m_length - m_position);
+			std::memcpy(data + done, m_buffer.data() + m_position, chunk);
+			m_position += chunk;
+			done += chunk;
+		}
+		m_offset += size;
+		return true;
+	}
+
+	bool Fill()
+	{
+		while (true)
+		{
+			const ssize_t readCount = read(m_fd, m_buffer.data(), m_buffer.size());
+			if (readCount < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (readCount < 0)
+			{
+				throw std::runtime_error("Failed to read archive");
+			}
+			m_position = 0;
+			m_length = static_cast<size_t>(readCount);
+			if (m_bytesRead)
+			{
+				m_bytesRead->fetch_add(m_length, std::memory_order_relaxed);
+			}
+			return readCount > 0;
+		}
+	}
+
+	int m_fd;
+	std::vector<char> m_buffer;
+	size_t m_position = 0;
+	size_t m_length = 0;
+	std::atomic<uint64_t>* m_bytesRead;
+	uint64_t m_offset = 0;
+	uint64_t m_remaining = 0;
+	uint64_t m_padding = 0;
+	bool m_finished = false;
+	// Сколько байтов от начала чтения есть в файле; std::nullopt — вход не перемотать (труба)
+	std::optional<uint64_t> m_seekLimit;
+};
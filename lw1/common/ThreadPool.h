@@ -0,0 +1,127 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <algorithm>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Фиксированный пул потоков с общей очередью задач (потоки сами забирают работу).
+// Задачи берут только первые activeLimit потоков, остальные ждут: так число рабочих можно менять на ходу (-P auto)
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int numThreads)
+	{
+		if (numThreads <= 0)
+		{
+			throw std::invalid_argument("Number of threads must be positive");
+		}
+
+		m_activeLimit = numThreads;
+		m_threads.reserve(numThreads);
+		for (int i = 0; i < numThreads; ++i)
+		{
+			m_threads.emplace_back([this, i](std::stop_token stopToken) { WorkerLoop(stopToken, i); });
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			for (auto& thread: m_threads)
+			{
+				thread.request_stop();
+			}
+		}
+		m_hasTasks.notify_all();
+	}
+
+	template <typename F>
+	auto Submit(F&& task) -> std::future<std::invoke_result_t<F>>
+	{
+		using Result = std::invoke_result_t<F>;
+		auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+		auto future = packaged->get_future();
+		bool limited = false;
+		{
+			std::lock_guard lock(m_mutex);
+			m_tasks.emplace_back([packaged] { (*packaged)(); });
+			limited = m_activeLimit < static_cast<int>(m_threads.size());
+		}
+		// Разбуженный ждущий поток задачу не возьмёт, поэтому при ограничении будим всех
+		if (limited)
+		{
+			m_hasTasks.notify_all();
+		}
+		else
+		{
+			m_hasTasks.notify_one();
+		}
+		return future;
+	}
+
+	[[nodiscard]] int GetThreadCount() const noexcept
+	{
+		return static_cast<int>(m_threads.size());
+	}
+
+	// Сколько задач ждут свободного потока
+	[[nodiscard]] size_t GetQueuedCount()
+	{
+		std::lock_guard lock(m_mutex);
+		return m_tasks.size();
+	}
+
+	// Уже начатые задачи доработают, а новые достанутся только первым limit потокам
+	void SetActiveLimit(int limit)
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_activeLimit = std::clamp(limit, 1, static_cast<int>(m_threads.size()));
+		}
+		m_hasTasks.notify_all();
+	}
+
+	[[nodiscard]] int GetActiveLimit()
+	{
+		std::lock_guard lock(m_mutex);
+		return m_activeLimit;
+	}
+
+private:
+	void WorkerLoop(std::stop_token stopToken, int index)
+	{
+		while (true)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock lock(m_mutex);
+				m_hasTasks.wait(lock, [&] { return (!m_tasks.empty() && index < m_activeLimit) || stopToken.stop_requested(); });
+				// Перед остановкой дорабатываем уже поставленные задачи
+				if (m_tasks.empty())
+				{
+					return;
+				}
+				task = std::move(m_tasks.front());
+				m_tasks.pop_front();
+			}
+			task();
+		}
+	}
+
+	std::mutex m_mutex;
+	std::condition_variable m_hasTasks;
+	std::deque<std::function<void()>> m_tasks;
+	int m_activeLimit = 0;
+	std::vector<std::jthread> m_threads;
+};
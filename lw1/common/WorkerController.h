@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "ThreadPool.h"
+
+// -P auto: пул создаётся на AUTO_WORKERS_PER_CORE потоков на ядро, начинает с числа ядер,
+// а контроллер раз в период решает, сколько из них пускать к работе. Решение — восхождение
+// к вершине по пропускной способности: пробный шаг сохраняется, если дал прирост больше шума,
+// иначе откатывается, и следующую пробу ждём несколько периодов. Пробовать рост есть смысл,
+// когда потоки ждут диск (iowait) или простаивают ядра; сверх числа ядер при загруженном
+// процессоре пробуем уменьшение. Если чужих готовых к работе задач на хосте больше, чем ядер,
+// уступаем без проб
+constexpr const char* AUTO_WORKERS = "auto";
+constexpr int AUTO_WORKERS_PER_CORE = 2;
+constexpr int AUTO_MIN_MAX_WORKERS = 4;
+constexpr auto CONTROLLER_SAMPLE_INTERVAL = std::chrono::milliseconds(100);
+constexpr int CONTROLLER_SAMPLES_PER_PERIOD = 10;
+constexpr int CONTROLLER_HOLD_PERIODS = 3;
+constexpr double CONTROLLER_NOISE = 0.05;
+constexpr double CONTROLLER_IOWAIT_HIGH = 0.10;
+constexpr double CONTROLLER_RUNNABLE_SLACK = 0.5;
+
+inline int GetCoreCount()
+{
+	return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+// Размер пула для -P auto: запас сверх ядер нужен на случай, когда упираемся в диск
+inline int GetMaxAutoWorkers()
+{
+	return std::max(AUTO_MIN_MAX_WORKERS, AUTO_WORKERS_PER_CORE * GetCoreCount());
+}
+
+// Счётчики процессорного времени всех ядер из первой строки /proc/stat (в тиках)
+struct CpuTimes
+{
+	uint64_t total = 0;
+	uint64_t idle = 0;
+	uint64_t iowait = 0;
+};
+
+inline CpuTimes ReadCpuTimes()
+{
+	std::ifstream in("/proc/stat");
+	std::string label;
+	CpuTimes times;
+	if (!(in >> label) || label != "cpu")
+	{
+		return times;
+	}
+	uint64_t value = 0;
+	for (int field = 0; field < 10 && in >> value; ++field)
+	{
+		// user nice system idle iowait irq softirq steal guest guest_nice; guest уже учтён в user
+		if (field < 8)
+		{
+			times.total += value;
+		}
+		if (field == 3)
+		{
+			times.idle = value;
+		}
+		if (field == 4)
+		{
+			times.iowait = value;
+		}
+	}
+	return times;
+}
+
+// Число готовых к выполнению задач на хосте: четвёртое поле /proc/loadavg ("2/345")
+inline int ReadRunnableCount()
+{
+	std::ifstream in("/proc/loadavg");
+	double load = 0;
+	std::string tasks;
+	if (!(in >> load >> load >> load >> tasks))
+	{
+		return 0;
+	}
+	return std::atoi(tasks.c_str());
+}
+
+class WorkerController
+{
+public:
+	// progress() — сколько байтов обработано с начала работы; читается из потока контроллера
+	WorkerController(ThreadPool& pool, std::function<uint64_t()> progress, int initialWorkers = GetCoreCount())
+		: m_pool(pool)
+		, m_progress(std::move(progress))
+		, m_cores(GetCoreCount())
+	{
+		m_pool.SetActiveLimit(initialWorkers);
+		std::cerr << "Workers: auto, starting with " << m_pool.GetActiveLimit() << " of " << m_pool.GetThreadCount()
+			<< " on " << m_cores << " cores\n";
+		m_thread = std::jthread([this](std::stop_token stopToken) { Loop(stopToken); });
+	}
+
+	WorkerController(const WorkerController&) = delete;
+	WorkerController& operator=(const WorkerController&) = delete;
+
+private:
+	enum class Move
+	{
+		None,
+		Probe,
+		Revert,
+		Yield,
+	};
+
+	struct Period
+	{
+		double throughput = 0; // байт в секунду
+		double iowait = 0; // доля времени всех ядер
+		double idleCores = 0;
+		double runnable = 0; // в среднем за период
+	};
+
+	void Loop(std::stop_token stopToken)
+	{
+		std::mutex mutex;
+		std::condition_variable_any wakeUp;
+		auto start = std::chrono::steady_clock::now();
+		uint64_t startProgress = m_progress();
+		CpuTimes startTimes = ReadCpuTimes();
+		double runnableSum = 0;
+		int samples = 0;
+
+		std::unique_lock lock(mutex);
+		while (!wakeUp.wait_for(lock, stopToken, CONTROLLER_SAMPLE_INTERVAL, [&] { return stopToken.stop_requested(); }))
+		{
+			runnableSum += ReadRunnableCount();
+			if (++samples < CONTROLLER_SAMPLES_PER_PERIOD)
+			{
+				continue;
+			}
+
+			const auto now = std::chrono::steady_clock::now();
+			const uint64_t progress = m_progress();
+			const CpuTimes times = ReadCpuTimes();
+			const double seconds = std::chrono::duration<double>(now - start).count();
+			const double ticks = static_cast<double>(std::max<uint64_t>(1, times.total - startTimes.total));
+
+			Period period;
+			period.throughput = static_cast<double>(progress - startProgress) / seconds;
+			period.iowait = static_cast<double>(times.iowait - startTimes.iowait) / ticks;
+			period.idleCores = static_cast<double>(times.idle - startTimes.idle) / ticks * m_cores;
+			period.runnable = runnableSum / samples;
+			Decide(period);
+
+			start = now;
+			startProgress = progress;
+			startTimes = times;
+			runnableSum = 0;
+			samples = 0;
+		}
+	}
+
+	void Decide(const Period& period)
+	{
+		const int workers = m_pool.GetActiveLimit();
+		// В runnable попадают и свои рабочие потоки, и сам контроллер; чужих считаем по остатку
+		const double others = std::max(0.0, period.runnable - workers - 1);
+		int next = workers;
+		Move move = Move::None;
+		std::string reason;
+
+		if (workers > 1 && others > CONTROLLER_RUNNABLE_SLACK && others + workers > m_cores + CONTROLLER_RUNNABLE_SLACK
+			&& period.idleCores < 0.5)
+		{
+			next = workers - 1;
+			move = Move::Yield;
+			reason = "host is oversubscribed";
+		}
+		else if (m_lastMove == Move::Probe)
+		{
+			const double gain = m_previous.throughput > 0 ? period.throughput / m_previous.throughput - 1 : 0;
+			if (gain > CONTROLLER_NOISE)
+			{
+				next = workers + m_direction;
+				move = Move::Probe;
+				reason = "throughput " + FormatPercent(gain);
+			}
+			else
+			{
+				next = m_previousWorkers;
+				move = Move::Revert;
+				reason = "no gain (" + FormatPercent(gain) + "), going back";
+				m_hold = CONTROLLER_HOLD_PERIODS;
+			}
+		}
+		else if (m_hold > 0)
+		{
+			--m_hold;
+		}
+		else if (period.iowait > CONTROLLER_IOWAIT_HIGH || period.idleCores >= 1)
+		{
+			next = workers + 1;
+			m_direction = 1;
+			move = Move::Probe;
+			reason = period.iowait > CONTROLLER_IOWAIT_HIGH ? "waiting on disk" : "idle cores";
+		}
+		else if (workers > m_cores)
+		{
+			next = workers - 1;
+			m_direction = -1;
+			move = Move::Probe;
+			reason = "cores are saturated";
+		}
+
+		next = std::clamp(next, 1, m_pool.GetThreadCount());
+		if (next == workers)
+		{
+			move = Move::None;
+		}
+		else
+		{
+			m_pool.SetActiveLimit(next);
+			Log(workers, next, period, reason);
+		}
+		m_previous = period;
+		m_previousWorkers = workers;
+		m_lastMove = move;
+	}
+
+	void Log(int from, int to, const Period& period, const std::string& reason) const
+	{
+		std::ostringstream line;
+		line << std::fixed << std::setprecision(1) << "Workers: " << from << " -> " << to << " ("
+			<< period.throughput / 1e6 << " MB/s, " << period.throughput / 1e6 / from << " MB/s per worker, iowait "
+			<< period.iowait * 100 << "%, runnable " << period.runnable << " on " << m_cores << " cores): " << reason << "\n";
+		std::cerr << line.str();
+	}
+
+	static std::string FormatPercent(double fraction)
+	{
+		std::ostringstream text;
+		text << std::showpos << std::fixed << std::setprecision(1) << fraction * 100 << "%";
+		return text.str();
+	}
+
+	ThreadPool& m_pool;
+	std::function<uint64_t()> m_progress;
+	int m_cores;
+	Period m_previous;
+	int m_previousWorkers = 0;
+	Move m_lastMove = Move::None;
+	int m_direction = 1;
+	int m_hold = 0;
+	std::jthread m_thread;
+};
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "ArchiveIndex.h"
+#include "Chunking.h"
+#include "Codec.h"
+#include "Gzip.h"
+#include "Manifest.h"
+#include "Tar.h"
+
+constexpr size_t COPY_BUFFER_SIZE = 1024 * 1024;
+
+struct InputFile
+{
+	std::string path;
+	uint64_t size = 0;
+	int64_t mtime = 0;
+	int64_t mtimeNs = 0;
+	unsigned mode = 0644;
+};
+
+inline int64_t GetMtimeNs(const struct stat& info)
+{
+	return static_cast<int64_t>(info.st_mtim.tv_sec) * 1'000'000'000 + info.st_mtim.tv_nsec;
+}
+
+inline InputFile StatInputFile(const std::string& path)
+{
+	struct stat info{};
+	if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+	{
+		throw std::runtime_error("Failed to open file: " + path);
+	}
+	return { path, static_cast<uint64_t>(info.st_size), info.st_mtime, GetMtimeNs(info), info.st_mode & 07777u };
+}
+
+// Диапазон уже сжатых данных члена в прошлом архиве
+struct StoredRange
+{
+	uint64_t offset = 0;
+	uint64_t size = 0;
+	uint32_t crc = 0;
+	CodecId codec = CodecId::Gzip;
+};
+
+// Чанк дедуплицированного члена: литерал несёт сжатый новый чанк, ссылка — только номер уже записанного литерала.
+// Литералы нумеруются подряд в порядке членов архива
+struct ChunkPiece
+{
+	uint64_t id = 0;
+	bool reference = false;
+};
+
+// Сжатый кусок члена архива. Куски одного файла идут подряд: первый открывает член, последний закрывает.
+// Кусок с reuse целиком заменяет член байтами из прошлого архива, кусок с standalone — самостоятельный gzip-член.
+// Куски с chunked складываются в член .cdc; последний из них чанка не несёт
+struct ArchivePiece
+{
+	size_t file = 0;
+	bool first = false;
+	bool last = false;
+	EncodedBlock block;
+	uint64_t contentHash = 0; // хеш всего файла, заполнен в последнем куске
+	std::optional<StoredRange> reuse;
+	bool standalone = false;
+	CodecId codec = CodecId::Gzip;
+	bool chunked = false;
+	std::optional<ChunkPiece> chunk;
+};
+
+// Член целиком из прошлого архива
+inline ArchivePiece MakeReusedPiece(size_t file, uint64_t contentHash, const StoredRange& reuse)
+{
+	ArchivePiece piece;
+	piece.file = file;
+	piece.first = true;
+	piece.last = true;
+	piece.contentHash = contentHash;
+	piece.reuse = reuse;
+	piece.codec = reuse.codec;
+	return piece;
+}
+
+inline ArchivePiece MakeEncodedPiece(size_t file, bool first, bool last, EncodedBlock block, uint64_t contentHash,
+	CodecId codec, bool standalone = false)
+{
+	ArchivePiece piece;
+	piece.file = file;
+	piece.first = first;
+	piece.last = last;
+	piece.block = std::move(block);
+	piece.contentHash = contentHash;
+	piece.codec = codec;
+	piece.standalone = standalone;
+	return piece;
+}
+
+// Пишет каждый входной файл членом <file><суффикс кодека> прямо в tar, оборачивая куски заголовком и концом кодека.
+// Попутно собирает оглавление для архива и манифест для следующего инкрементального запуска
+class ArchiveWriter
+{
+public:
+	ArchiveWriter(const std::string& archiveName, const std::vector<InputFile>& files,
+		const std::string& previousArchive = {})
+		: m_tar(archiveName)
+		, m_files(files)
+	{
+		if (!previousArchive.empty())
+		{
+			m_previousFd = open(previousArchive.c_str(), O_RDONLY | O_CLOEXEC);
+			if (m_previousFd < 0)
+			{
+				throw std::runtime_error("Failed to open previous archive: " + previousArchive);
+			}
+		}
+	}
+
+	ArchiveWriter(const ArchiveWriter&) = delete;
+	ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+
+	~ArchiveWriter()
+	{
+		if (m_previousFd >= 0)
+		{
+			close(m_previousFd);
+		}
+	}
+
+	void Write(const ArchivePiece& piece)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const InputFile& file = m_files.at(piece.file);
+		const Codec& codec = GetCodec(piece.codec);
+		const uint64_t rawBefore = piece.first ? 0 : m_rawSize;
+		if (piece.first)
+		{
+			m_memberOffset = m_tar.BeginMember(file.path + (piece.chunked ? CHUNKED_SUFFIX : codec.GetSuffix()), file.mtime, file.mode);
+			m_crc = crc32(0L, Z_NULL, 0);
+			m_rawSize = 0;
+			if (piece.chunked)
+			{
+				m_tar.Write(CHUNKED_MAGIC, sizeof(CHUNKED_MAGIC));
+			}
+			else if (!piece.reuse && !piece.standalone)
+			{
+				const auto header = codec.MakeHeader(std::filesystem::path(file.path).filename().string(), static_cast<uint32_t>(file.mtime), file.size);
+				m_tar.Write(header.data(), header.size());
+			}
+		}
+
+		if (piece.reuse)
+		{
+			CopyFromPrevious(*piece.reuse);
+			m_crc = piece.reuse->crc;
+			m_rawSize = file.size;
+			++m_reusedCount;
+		}
+		else if (piece.chunked)
+		{
+			if (piece.chunk)
+			{
+				WriteChunk(piece);
+			}
+		}
+		else if (piece.standalone)
+		{
+			// Имя файла — только в первом члене, как у gzip -N
+			const std::string name = piece.first ? std::filesystem::path(file.path).filename().string() : std::string();
+			const auto header = MakeGzipBlockHeader(name, static_cast<uint32_t>(file.mtime), piece.block.data.size());
+			const auto trailer = MakeGzipTrailer(piece.block.crc, piece.block.rawSize);
+			m_tar.Write(header.data(), header.size());
+			m_tar.Write(piece.block.data.data(), piece.block.data.size());
+			m_tar.Write(trailer.data(), trailer.size());
+			m_crc = crc32_combine(m_crc, piece.block.crc, static_cast<z_off_t>(piece.block.rawSize));
+			m_rawSize += piece.block.rawSize;
+		}
+		else
+		{
+			m_tar.Write(piece.block.data.data(), piece.block.data.size());
+			m_crc = crc32_combine(m_crc, piece.block.crc, static_cast<z_off_t>(piece.block.rawSize));
+			m_rawSize += piece.block.rawSize;
+		}
+
+		if (piece.last)
+		{
+			if (!piece.reuse && !piece.standalone && !piece.chunked)
+			{
+				const auto trailer = codec.MakeTrailer(m_crc, m_rawSize);
+				m_tar.Write(trailer.data(), trailer.size());
+			}
+			const uint64_t storedSize = m_tar.EndMember();
+			// Ссылки члена .cdc указывают внутрь этого архива, поэтому в следующий такой член не переносится
+			if (!piece.chunked)
+			{
+				m_manifest.Add({ file.path, file.size, file.mtimeNs, piece.contentHash, m_memberOffset, storedSize, m_crc, piece.codec });
+			}
+			m_index.push_back({ StripLeadingSlashes(file.path), m_memberOffset, storedSize, m_rawSize, m_crc,
+				piece.chunked ? CHUNKED_MEMBER_CODEC : static_cast<uint8_t>(piece.codec) });
+		}
+		m_processedBytes += m_rawSize - rawBefore;
+		m_busyTime += std::chrono::steady_clock::now() - start;
+	}
+
+	void Finish()
+	{
+		m_tar.Finish();
+		const auto index = SerializeArchiveIndex(std::move(m_index), m_tar.GetOffset());
+		m_tar.Write(index.data(), index.size());
+		m_tar.Flush();
+		WriteChunkReferences();
+	}
+
+	// Сколько времени ушло собственно на запись архива
+	[[nodiscard]] double GetBusySeconds() const
+	{
+		return std::chrono::duration<double>(m_busyTime).count();
+	}
+
+	[[nodiscard]] Manifest& GetManifest() noexcept
+	{
+		return m_manifest;
+	}
+
+	[[nodiscard]] size_t GetReusedCount() const noexcept
+	{
+		return m_reusedCount;
+	}
+
+	// Сколько байтов входных файлов уже легло в архив; читается из других потоков
+	[[nodiscard]] uint64_t GetProcessedBytes() const noexcept
+	{
+		return m_processedBytes;
+	}
+
+	// Сколько байтов архива уже записано
+	[[nodiscard]] uint64_t GetArchiveSize() const noexcept
+	{
+		return m_tar.GetOffset();
+	}
+
+	// Сколько чанков записано ссылками вместо данных
+	[[nodiscard]] size_t GetChunkReferenceCount() const noexcept
+	{
+		return m_chunkReferenceCount;
+	}
+
+private:
+	// Записанный литерал: где лежит его запись и сколько ссылок на него набралось
+	struct WrittenChunk
+	{
+		uint64_t offset = 0;
+		uint32_t rawSize = 0;
+		uint32_t crc = 0;
+		uint32_t references = 0;
+	};
+
+	void WriteChunk(const ArchivePiece& piece)
+	{
+		if (piece.chunk->reference)
+		{
+			WrittenChunk& target = m_chunks.at(piece.chunk->id);
+			++target.references;
+			++m_chunkReferenceCount;
+			const auto record = MakeChunkReference(target.offset, target.rawSize, target.crc);
+			m_tar.Write(record.data(), record.size());
+			m_crc = crc32_combine(m_crc, target.crc, static_cast<z_off_t>(target.rawSize));
+			m_rawSize += target.rawSize;
+			return;
+		}
+
+		if (piece.chunk->id != m_chunks.size())
+		{
+			throw std::logic_error("Chunks are out of order");
+		}
+		const auto rawSize = static_cast<uint32_t>(piece.block.rawSize);
+		m_chunks.push_back({ m_tar.GetOffset(), rawSize, piece.block.crc, 0 });
+		const auto header = MakeChunkLiteralHeader(piece.codec, rawSize, static_cast<uint32_t>(piece.block.data.size()), piece.block.crc);
+		m_tar.Write(header.data(), header.size());
+		m_tar.Write(piece.block.data.data(), piece.block.data.size());
+		m_crc = crc32_combine(m_crc, piece.block.crc, static_cast<z_off_t>(piece.block.rawSize));
+		m_rawSize += piece.block.rawSize;
+	}
+
+	// Число ссылок на литерал известно только к концу архива — дописываем его на место
+	void WriteChunkReferences()
+	{
+		for (const auto& chunk: m_chunks)
+		{
+			if (chunk.references > 0)
+			{
+				ByteWriter count;
+				count.Put(chunk.references);
+				m_tar.Patch(chunk.offset + CHUNK_REFERENCES_FIELD_OFFSET, count.Bytes().data(), count.Bytes().size());
+			}
+		}
+	}
+
+	void CopyFromPrevious(const StoredRange& range)
+	{
+		if (m_previousFd < 0)
+		{
+			throw std::logic_error("No previous archive to copy from");
+		}
+
+		std::vector<char> buffer(std::min<uint64_t>(range.size, COPY_BUFFER_SIZE));
+		for (uint64_t done = 0; done < range.size;)
+		{
+			const size_t chunk = std::min<uint64_t>(buffer.size(), range.size - done);
+			const ssize_t readCount = pread(m_previousFd, buffer.data(), chunk, static_cast<off_t>(range.offset + done));
+			if (readCount <= 0)
+			{
+				throw std::runtime_error("Failed to read previous archive");
+			}
+			m_tar.Write(buffer.data(), static_cast<size_t>(readCount));
+			done += static_cast<uint64_t>(readCount);
+		}
+	}
+
+	TarWriter m_tar;
+	const std::vector<InputFile>& m_files;
+	int m_previousFd = -1;
+	uint64_t m_memberOffset = 0;
+	uint32_t m_crc = 0;
+	uint64_t m_rawSize = 0;
+	Manifest m_manifest;
+	std::vector<IndexEntry> m_index;
+	size_t m_reusedCount = 0;
+	std::vector<WrittenChunk> m_chunks;
+	size_t m_chunkReferenceCount = 0;
+	std::chrono::steady_clock::duration m_busyTime{};
+	std::atomic<uint64_t> m_processedBytes = 0;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Codec.h"
+
+constexpr const char* MANIFEST_SIGNATURE = "make_archive-manifest 3";
+
+// Что известно о члене архива из прошлого запуска: по нему решаем, можно ли
+// скопировать уже сжатые байты вместо повторного сжатия
+struct ManifestEntry
+{
+	std::string path;
+	uint64_t size = 0;
+	int64_t mtimeNs = 0;
+	uint64_t hash = 0;
+	uint64_t offset = 0; // смещение данных члена в архиве
+	uint64_t storedSize = 0;
+	uint32_t crc = 0; // crc32 исходных данных
+	CodecId codec = CodecId::Gzip;
+};
+
+inline std::string GetManifestPath(const std::string& archiveName)
+{
+	return archiveName + ".manifest";
+}
+
+// Формат — текст: подпись, размер и mtime архива, затем строка на член:
+// size mtime hash offset stored-size crc codec path (через табуляцию).
+// Путь стоит последним, поэтому табуляции в имени файла не ломают разбор
+class Manifest
+{
+public:
+	static Manifest Load(const std::string& path)
+	{
+		Manifest manifest;
+		std::ifstream in(path);
+		std::string line;
+		if (!in || !std::getline(in, line) || line != MANIFEST_SIGNATURE || !std::getline(in, line))
+		{
+			return manifest;
+		}
+		std::istringstream archive(line);
+		std::string tag;
+		archive >> tag >> manifest.m_archiveSize >> manifest.m_archiveMtimeNs;
+		if (!archive || tag != "archive")
+		{
+			throw std::runtime_error("Corrupted manifest: " + path);
+		}
+
+		while (std::getline(in, line))
+		{
+			std::istringstream fields(line);
+			ManifestEntry entry;
+			unsigned codec = 0;
+			fields >> entry.size >> entry.mtimeNs >> std::hex >> entry.hash >> std::dec >> entry.offset >> entry.storedSize >> entry.crc >> codec;
+			if (!fields || fields.get() != '\t' || !std::getline(fields, entry.path))
+			{
+				throw std::runtime_error("Corrupted manifest: " + path);
+			}
+			entry.codec = GetCodec(static_cast<CodecId>(codec)).GetId();
+			manifest.Add(std::move(entry));
+		}
+		return manifest;
+	}
+
+	void Save(const std::string& path) const
+	{
+		std::ofstream out(path, std::ios::trunc);
+		out << MANIFEST_SIGNATURE << '\n';
+		out << "archive " << m_archiveSize << ' ' << m_archiveMtimeNs << '\n';
+		for (const auto& entry: m_entries)
+		{
+			out << entry.size << '\t' << entry.mtimeNs << '\t' << std::hex << entry.hash << std::dec << '\t'
+				<< entry.offset << '\t' << entry.storedSize << '\t' << entry.crc << '\t' << static_cast<unsigned>(entry.codec) << '\t'
+				<< entry.path << '\n';
+		}
+		if (!out)
+		{
+			throw std::runtime_error("Failed to write manifest: " + path);
+		}
+	}
+
+	void Add(ManifestEntry entry)
+	{
+		// Перевод строки в имени не уложить в построчный формат — такой файл просто не будет переиспользован
+		if (entry.path.find('\n') != std::string::npos)
+		{
+			return;
+		}
+		m_index[entry.path] = m_entries.size();
+		m_entries.push_back(std::move(entry));
+	}
+
+	[[nodiscard]] const ManifestEntry* Find(const std::string& path) const
+	{
+		auto it = m_index.find(path);
+		return it == m_index.end() ? nullptr : &m_entries[it->second];
+	}
+
+	[[nodiscard]] bool Empty() const noexcept
+	{
+		return m_entries.empty();
+	}
+
+	[[nodiscard]] size_t Size() const noexcept
+	{
+		return m_entries.size();
+	}
+
+	// Манифест годится, только если архив с тех пор не перезаписывали без него
+	[[nodiscard]] bool Describes(uint64_t archiveSize, int64_t archiveMtimeNs) const noexcept
+	{
+		return m_archiveSize == archiveSize && m_archiveMtimeNs == archiveMtimeNs;
+	}
+
+	void SetArchive(uint64_t archiveSize, int64_t archiveMtimeNs) noexcept
+	{
+		m_archiveSize = archiveSize;
+		m_archiveMtimeNs = archiveMtimeNs;
+	}
+
+private:
+	uint64_t m_archiveSize = 0;
+	int64_t m_archiveMtimeNs = 0;
+	std::vector<ManifestEntry> m_entries;
+	std::unordered_map<std::string, size_t> m_index;
+};
@@ -0,0 +1,510 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "ArchiveWriter.h"
+
+// Стадии конвейера make_archive. Чтение — входные файлы (и их хеширование при --incremental),
+// запись — куски в tar, архив — оглавление, ссылки чанков, переименование и манифест в конце
+enum class Stage
+{
+	Read = 0,
+	Compress = 1,
+	Write = 2,
+	Archive = 3,
+};
+
+constexpr size_t STAGE_COUNT = 4;
+constexpr const char* STAGE_NAMES[STAGE_COUNT] = { "read", "compress", "write", "archive" };
+constexpr size_t NO_FILE = static_cast<size_t>(-1);
+// Доля занятости, начиная с которой стадию или пул считаем узким местом
+constexpr double METRICS_SATURATED = 0.8;
+
+inline double GetThreadCpuSeconds()
+{
+	timespec time{};
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+	return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_nsec) / 1e9;
+}
+
+inline void WriteJsonString(std::ostream& out, const std::string& value)
+{
+	out << '"';
+	for (const char c: value)
+	{
+		if (c == '"' || c == '\\')
+		{
+			out << '\\' << c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec << std::setfill(' ');
+		}
+		else
+		{
+			out << c;
+		}
+	}
+	out << '"';
+}
+
+// Метрики конвейера (--metrics, --trace): время по стенным часам и процессорное время каждой стадии,
+// байты на входе и выходе, занятость рабочих потоков и заполненность очередей. Стадии отмечаются
+// отрезками Span из любых потоков; с --trace каждый отрезок ещё и ложится событием в трассу Chrome
+// (chrome://tracing, Perfetto). С --isolate сжатие идёт в рабочих процессах, и его процессорное время
+// здесь не видно: у стадии остаётся только ожидание ответа
+class PipelineMetrics
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// Отрезок работы стадии в текущем потоке; итог уходит в метрики в деструкторе.
+	// С metrics == nullptr ничего не меряет, так что без --metrics и --trace конвейер не замедляется
+	class Span
+	{
+	public:
+		Span(PipelineMetrics* metrics, Stage stage, size_t file)
+			: m_metrics(metrics)
+			, m_stage(stage)
+			, m_file(file)
+		{
+			if (m_metrics)
+			{
+				m_start = Clock::now();
+				m_cpuStart = GetThreadCpuSeconds();
+			}
+		}
+
+		Span(const Span&) = delete;
+		Span& operator=(const Span&) = delete;
+
+		~Span()
+		{
+			if (m_metrics)
+			{
+				m_metrics->AddSpan(*this, Clock::now(), GetThreadCpuSeconds());
+			}
+		}
+
+		void SetBytes(uint64_t bytesIn, uint64_t bytesOut) noexcept
+		{
+			m_bytesIn = bytesIn;
+			m_bytesOut = bytesOut;
+		}
+
+	private:
+		friend class PipelineMetrics;
+
+		PipelineMetrics* m_metrics;
+		Stage m_stage;
+		size_t m_file;
+		Clock::time_point m_start;
+		double m_cpuStart = 0;
+		uint64_t m_bytesIn = 0;
+		uint64_t m_bytesOut = 0;
+	};
+
+	// Время, которое рабочий поток провёл в задаче целиком; из него считается занятость пула
+	class Task
+	{
+	public:
+		explicit Task(PipelineMetrics* metrics)
+			: m_metrics(metrics)
+		{
+			if (m_metrics)
+			{
+				m_start = Clock::now();
+			}
+		}
+
+		Task(const Task&) = delete;
+		Task& operator=(const Task&) = delete;
+
+		~Task()
+		{
+			if (m_metrics)
+			{
+				m_metrics->AddTask(Clock::now() - m_start);
+			}
+		}
+
+	private:
+		PipelineMetrics* m_metrics;
+		Clock::time_point m_start;
+	};
+
+	PipelineMetrics(std::string mode, int workers, bool trace)
+		: m_mode(std::move(mode))
+		, m_workers(workers)
+		, m_trace(trace)
+		, m_start(Clock::now())
+		, m_end(m_start)
+	{
+	}
+
+	PipelineMetrics(const PipelineMetrics&) = delete;
+	PipelineMetrics& operator=(const PipelineMetrics&) = delete;
+
+	void SetFiles(const std::vector<InputFile>& files)
+	{
+		std::lock_guard lock(m_mutex);
+		m_files.assign(files.size(), {});
+		for (size_t i = 0; i < files.size(); ++i)
+		{
+			m_files[i].path = files[i].path;
+			m_inputBytes += files[i].size;
+		}
+	}
+
+	// Как файл лёг в архив: кодек или "dedup", и взят ли он из прошлого архива
+	void SetFileCodec(size_t file, const std::string& codec, bool reused)
+	{
+		std::lock_guard lock(m_mutex);
+		m_files.at(file).codec = codec;
+		m_files.at(file).reused = reused;
+	}
+
+	// Имя потока в трассе; потоки без имени называются "worker N"
+	void NameThread(const std::string& name)
+	{
+		std::lock_guard lock(m_mutex);
+		m_threadNames[GetThreadIndexLocked()] = name;
+	}
+
+	// ordered — готовые куски, ждущие писателя; pending — задачи, ещё не взятые пулом
+	void SampleQueues(size_t ordered, size_t capacity, size_t pending)
+	{
+		const double ts = GetMicroseconds(Clock::now());
+		std::lock_guard lock(m_mutex);
+		m_ordered.Add(ordered);
+		m_pending.Add(pending);
+		m_orderedCapacity = capacity;
+		if (m_trace)
+		{
+			m_counters.push_back({ ts, ordered, pending });
+		}
+	}
+
+	void Finish()
+	{
+		std::lock_guard lock(m_mutex);
+		m_end = Clock::now();
+	}
+
+	void WriteJson(const std::string& path)
+	{
+		std::lock_guard lock(m_mutex);
+		std::ofstream out(path);
+		if (!out)
+		{
+			throw std::runtime_error("Failed to write metrics: " + path);
+		}
+
+		const double wall = GetWallSecondsLocked();
+		const double utilization = GetWorkerUtilizationLocked();
+		const auto& write = m_stages[static_cast<size_t>(Stage::Write)];
+		const auto& archive = m_stages[static_cast<size_t>(Stage::Archive)];
+		const uint64_t archiveBytes = write.bytesOut + archive.bytesOut;
+		std::string reason;
+		const std::string bound = GetBoundLocked(reason);
+
+		out << std::fixed << std::setprecision(6) << "{\n";
+		out << "  \"mode\": ";
+		WriteJsonString(out, m_mode);
+		out << ",\n  \"workers\": " << m_workers << ",\n";
+		out << "  \"wallSeconds\": " << wall << ",\n";
+		out << "  \"inputBytes\": " << m_inputBytes << ",\n";
+		out << "  \"archiveBytes\": " << archiveBytes << ",\n";
+		out << "  \"compressionRatio\": " << GetRatio(m_inputBytes, archiveBytes) << ",\n";
+		out << "  \"workerBusySeconds\": " << m_workerBusy << ",\n";
+		out << "  \"workerTasks\": " << m_workerTasks << ",\n";
+		out << "  \"workerUtilization\": " << utilization << ",\n";
+		out << "  \"bound\": \"" << bound << "\",\n";
+		out << "  \"boundReason\": ";
+		WriteJsonString(out, reason);
+		out << ",\n  \"stages\": {\n";
+		for (size_t i = 0; i < STAGE_COUNT; ++i)
+		{
+			const auto& stage = m_stages[i];
+			out << "    \"" << STAGE_NAMES[i] << "\": { \"spans\": " << stage.spans
+				<< ", \"wallSeconds\": " << stage.wall
+				<< ", \"cpuSeconds\": " << stage.cpu
+				<< ", \"cpuPerWall\": " << (stage.wall > 0 ? stage.cpu / stage.wall : 0)
+				<< ", \"shareOfRun\": " << (wall > 0 ? stage.wall / wall : 0)
+				<< ", \"bytesIn\": " << stage.bytesIn
+				<< ", \"bytesOut\": " << stage.bytesOut
+				<< ", \"ratio\": " << GetRatio(stage.bytesIn, stage.bytesOut) << " }"
+				<< (i + 1 < STAGE_COUNT ? ",\n" : "\n");
+		}
+		out << "  },\n";
+		out << "  \"queues\": {\n";
+		out << "    \"ordered\": { \"capacity\": " << m_orderedCapacity << ", \"samples\": " << m_ordered.samples
+			<< ", \"mean\": " << m_ordered.GetMean() << ", \"max\": " << m_ordered.max
+			<< ", \"meanOccupancy\": " << (m_orderedCapacity > 0 ? m_ordered.GetMean() / m_orderedCapacity : 0) << " },\n";
+		out << "    \"pool\": { \"samples\": " << m_pending.samples << ", \"mean\": " << m_pending.GetMean()
+			<< ", \"max\": " << m_pending.max << " }\n";
+		out << "  },\n";
+		out << "  \"files\": [";
+		for (size_t i = 0; i < m_files.size(); ++i)
+		{
+			const auto& file = m_files[i];
+			out << (i > 0 ? ",\n" : "\n") << "    { \"path\": ";
+			WriteJsonString(out, file.path);
+			out << ", \"codec\": ";
+			WriteJsonString(out, file.codec);
+			out << ", \"reused\": " << (file.reused ? "true" : "false")
+				<< ", \"bytesIn\": " << file.bytesIn
+				<< ", \"bytesOut\": " << file.bytesOut
+				<< ", \"ratio\": " << GetRatio(file.bytesIn, file.bytesOut)
+				<< ", \"readSeconds\": " << file.wall[static_cast<size_t>(Stage::Read)]
+				<< ", \"compressSeconds\": " << file.wall[static_cast<size_t>(Stage::Compress)]
+				<< ", \"writeSeconds\": " << file.wall[static_cast<size_t>(Stage::Write)]
+				<< ", \"cpuSeconds\": " << file.cpu << " }";
+		}
+		out << (m_files.empty() ? "]\n" : "\n  ]\n");
+		out << "}\n";
+		if (!out.flush())
+		{
+			throw std::runtime_error("Failed to write metrics: " + path);
+		}
+	}
+
+	// Формат Trace Event: отрезки стадий — события "X" в потоках, очереди — счётчики "C"
+	void WriteTrace(const std::string& path)
+	{
+		std::lock_guard lock(m_mutex);
+		std::ofstream out(path);
+		if (!out)
+		{
+			throw std::runtime_error("Failed to write trace: " + path);
+		}
+
+		out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+		out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"make_archive " << m_mode << "\"}}";
+		size_t workers = 0;
+		for (size_t tid = 0; tid < m_threadNames.size(); ++tid)
+		{
+			const std::string& name = m_threadNames[tid];
+			out << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid + 1 << ", \"args\": {\"name\": ";
+			WriteJsonString(out, name.empty() ? "worker " + std::to_string(++workers) : name);
+			out << "}}";
+		}
+		for (const auto& event: m_events)
+		{
+			out << ",\n{\"name\": \"" << STAGE_NAMES[static_cast<size_t>(event.stage)] << "\", \"cat\": \"pipeline\", \"ph\": \"X\""
+				<< ", \"pid\": 1, \"tid\": " << event.thread + 1 << ", \"ts\": " << event.ts << ", \"dur\": " << event.dur
+				<< ", \"args\": {";
+			if (event.file != NO_FILE)
+			{
+				out << "\"file\": ";
+				WriteJsonString(out, m_files.at(event.file).path);
+				out << ", ";
+			}
+			out << "\"bytesIn\": " << event.bytesIn << ", \"bytesOut\": " << event.bytesOut << "}}";
+		}
+		for (const auto& counter: m_counters)
+		{
+			out << ",\n{\"name\": \"queues\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << counter.ts
+				<< ", \"args\": {\"ordered\": " << counter.ordered << ", \"pool\": " << counter.pending << "}}";
+		}
+		out << "\n]}\n";
+		if (!out.flush())
+		{
+			throw std::runtime_error("Failed to write trace: " + path);
+		}
+	}
+
+private:
+	struct StageTotals
+	{
+		size_t spans = 0;
+		double wall = 0;
+		double cpu = 0;
+		uint64_t bytesIn = 0;
+		uint64_t bytesOut = 0;
+	};
+
+	// bytesIn — сколько прочитано из файла, bytesOut — сколько его байтов легло в архив
+	struct FileTotals
+	{
+		std::string path;
+		std::string codec;
+		bool reused = false;
+		uint64_t bytesIn = 0;
+		uint64_t bytesOut = 0;
+		std::array<double, STAGE_COUNT> wall{};
+		double cpu = 0;
+	};
+
+	struct Samples
+	{
+		size_t samples = 0;
+		double sum = 0;
+		size_t max = 0;
+
+		void Add(size_t value)
+		{
+			++samples;
+			sum += static_cast<double>(value);
+			max = std::max(max, value);
+		}
+
+		[[nodiscard]] double GetMean() const
+		{
+			return samples > 0 ? sum / static_cast<double>(samples) : 0;
+		}
+	};
+
+	struct TraceEvent
+	{
+		Stage stage = Stage::Read;
+		size_t thread = 0;
+		size_t file = NO_FILE;
+		double ts = 0;
+		double dur = 0;
+		uint64_t bytesIn = 0;
+		uint64_t bytesOut = 0;
+	};
+
+	struct TraceCounter
+	{
+		double ts = 0;
+		size_t ordered = 0;
+		size_t pending = 0;
+	};
+
+	void AddSpan(const Span& span, Clock::time_point end, double cpuEnd)
+	{
+		const double wall = std::chrono::duration<double>(end - span.m_start).count();
+		const double cpu = cpuEnd - span.m_cpuStart;
+		std::lock_guard lock(m_mutex);
+		auto& stage = m_stages[static_cast<size_t>(span.m_stage)];
+		++stage.spans;
+		stage.wall += wall;
+		stage.cpu += cpu;
+		stage.bytesIn += span.m_bytesIn;
+		stage.bytesOut += span.m_bytesOut;
+		if (span.m_file != NO_FILE)
+		{
+			auto& file = m_files.at(span.m_file);
+			file.wall[static_cast<size_t>(span.m_stage)] += wall;
+			file.cpu += cpu;
+			if (span.m_stage == Stage::Read)
+			{
+				file.bytesIn += span.m_bytesIn;
+			}
+			else if (span.m_stage == Stage::Write)
+			{
+				file.bytesOut += span.m_bytesOut;
+			}
+		}
+		if (m_trace)
+		{
+			const double ts = GetMicroseconds(span.m_start);
+			m_events.push_back({ span.m_stage, GetThreadIndexLocked(), span.m_file, ts, GetMicroseconds(end) - ts,
+				span.m_bytesIn, span.m_bytesOut });
+		}
+	}
+
+	void AddTask(Clock::duration busy)
+	{
+		std::lock_guard lock(m_mutex);
+		m_workerBusy += std::chrono::duration<double>(busy).count();
+		++m_workerTasks;
+	}
+
+	size_t GetThreadIndexLocked()
+	{
+		const auto [entry, inserted] = m_threads.try_emplace(std::this_thread::get_id(), m_threads.size());
+		if (inserted)
+		{
+			m_threadNames.emplace_back();
+		}
+		return entry->second;
+	}
+
+	[[nodiscard]] double GetMicroseconds(Clock::time_point time) const
+	{
+		return std::chrono::duration<double, std::micro>(time - m_start).count();
+	}
+
+	[[nodiscard]] double GetWallSecondsLocked() const
+	{
+		return std::chrono::duration<double>(m_end - m_start).count();
+	}
+
+	[[nodiscard]] double GetWorkerUtilizationLocked() const
+	{
+		const double capacity = GetWallSecondsLocked() * m_workers;
+		return capacity > 0 ? m_workerBusy / capacity : 0;
+	}
+
+	// Грубая оценка узкого места. Если рабочие заняты почти всё время, решает, на что уходит их время:
+	// на чтение файлов — диск, на сжатие — процессор. Если простаивают, а писатель или чтение в
+	// раздающем потоке заняты почти всё время — диск. Иначе работа стоит в ожидании порядка и раздачи
+	std::string GetBoundLocked(std::string& reason) const
+	{
+		const double wall = GetWallSecondsLocked();
+		const auto& read = m_stages[static_cast<size_t>(Stage::Read)];
+		const auto& compress = m_stages[static_cast<size_t>(Stage::Compress)];
+		const auto& write = m_stages[static_cast<size_t>(Stage::Write)];
+		if (GetWorkerUtilizationLocked() >= METRICS_SATURATED)
+		{
+			if (read.wall > compress.wall)
+			{
+				reason = "workers are saturated and spend most of their time reading input";
+				return "disk";
+			}
+			reason = "workers are saturated and spend most of their time compressing";
+			return "cpu";
+		}
+		if (wall > 0 && write.wall / wall >= METRICS_SATURATED)
+		{
+			reason = "workers are idle while the archive writer is busy";
+			return "disk";
+		}
+		if (wall > 0 && read.wall / wall >= METRICS_SATURATED)
+		{
+			reason = "workers are idle while input is being read";
+			return "disk";
+		}
+		reason = "neither workers nor I/O are saturated: time goes to ordering and dispatch";
+		return "scheduling";
+	}
+
+	static double GetRatio(uint64_t bytesIn, uint64_t bytesOut)
+	{
+		return bytesOut > 0 ? static_cast<double>(bytesIn) / static_cast<double>(bytesOut) : 0;
+	}
+
+	std::mutex m_mutex;
+	std::string m_mode;
+	int m_workers;
+	bool m_trace;
+	Clock::time_point m_start;
+	Clock::time_point m_end;
+	std::array<StageTotals, STAGE_COUNT> m_stages{};
+	std::vector<FileTotals> m_files;
+	uint64_t m_inputBytes = 0;
+	double m_workerBusy = 0;
+	size_t m_workerTasks = 0;
+	Samples m_ordered;
+	Samples m_pending;
+	size_t m_orderedCapacity = 0;
+	std::unordered_map<std::thread::id, size_t> m_threads;
+	std::vector<std::string> m_threadNames;
+	std::vector<TraceEvent> m_events;
+	std::vector<TraceCounter> m_counters;
+};
@@ -3,135 +3,735 @@
 #include <string>
 #include <chrono>
 #include <cstdlib>
-#include <unistd.h>
-#include <sys/wait.h>
+#include <fstream>
+#include <iterator>
+#include <optional>
 #include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include "ArchiveWriter.h"
+#include "Chunking.h"
+#include "Codec.h"
+#include "Hash.h"
+#include "Metrics.h"
+#include "OrderedQueue.h"
+#include "ProcessPool.h"
+#include "Schedule.h"
+#include "ThreadPool.h"
+#include "WorkerController.h"
 
 struct Args
 {
 	std::string mode;
 	int numProcesses = 0;
+	bool autoWorkers = false;
 	std::string archiveName;
 	std::vector<std::string> files;
+	bool incremental = false;
+	bool independentBlocks = false;
+	bool isolate = false;
+	bool dedup = false;
+	// По умолчанию все члены .gz, как у gzip; выбор по содержимому только с --codec=auto
+	std::optional<CodecId> codec = CodecId::Gzip;
+	std::string metricsPath;
+	std::string tracePath;
 };
 
-void CompressFile(const std::string& filename)
+constexpr size_t QUEUE_PIECES_PER_THREAD = 4;
+
+// Как сжимать: каким кодеком (std::nullopt — выбрать по содержимому), самостоятельными блоками
+// или цепочкой со словарём, в потоках пула или (--isolate) в рабочих процессах, с дедупликацией чанков или без.
+// metrics — куда отмечать стадии (--metrics, --trace); nullptr — не мерить
+struct CompressionOptions
+{
+	std::optional<CodecId> codec;
+	bool independentBlocks = false;
+	ProcessPool* processes = nullptr;
+	bool dedup = false;
+	PipelineMetrics* metrics = nullptr;
+};
+
+// Чанки, уже записанные в архив литералами: ключ чанка → номер литерала
+using ChunkTable = std::unordered_map<ChunkKey, uint64_t, ChunkKeyHash>;
+
+enum JobKind : uint8_t
+{
+	JOB_ENCODE_BLOCK = 0,
+	JOB_COMPRESS_FILE = 1,
+};
+
+constexpr uint8_t JOB_AUTO_CODEC = 0xFF;
+
+std::vector<InputFile> StatInputFiles(const std::vector<std::string>& files)
 {
-	std::string command = "gzip -c " + filename + " > " + filename + ".gz";
-	if (system(command.c_str()))
+	std::vector<InputFile> inputs;
+	inputs.reserve(files.size());
+	for (const auto& file: files)
 	{
-		throw std::runtime_error("Failed to compress file: " + filename);
+		inputs.push_back(StatInputFile(file));
 	}
+	return inputs;
 }
 
-void CreateArchive(const std::string& archiveName, const std::vector<std::string>& files)
+// Файл такого размера выгоднее резать на блоки, чем отдавать одному потоку целиком
+bool IsLargeFile(const InputFile& file)
 {
-	std::string command = "tar -cf " + archiveName + " ";
-	for (const auto& file: files)
+	return file.size >= 2 * PARALLEL_BLOCK_SIZE;
+}
+
+uint64_t HashFile(const std::string& filename)
+{
+	BlockReader reader(filename, PARALLEL_BLOCK_SIZE);
+	Xxh64 hasher;
+	while (auto block = reader.Next())
 	{
-		command += file + ".gz ";
+		hasher.Update(block->data->data(), block->data->size());
 	}
-	if (system(command.c_str()))
+	return hasher.Digest();
+}
+
+// Файл не менялся, если совпали размер и mtime; при другом mtime решает хеш содержимого.
+// Член, сжатый не тем кодеком, что задан в --codec (по умолчанию gzip), не переиспользуется, а сжимается заново
+std::optional<StoredRange> FindReusable(size_t index, const InputFile& file, const Manifest& previous,
+	const CompressionOptions& options, uint64_t& hash)
+{
+	const ManifestEntry* entry = previous.Find(file.path);
+	if (!entry || entry->size != file.size || (options.codec && *options.codec != entry->codec))
 	{
-		throw std::runtime_error("Failed to create archive: " + archiveName);
+		return std::nullopt;
+	}
+	PipelineMetrics* metrics = options.metrics;
+	if (entry->mtimeNs != file.mtimeNs)
+	{
+		PipelineMetrics::Span span(metrics, Stage::Read, index);
+		span.SetBytes(file.size, file.size);
+		if (HashFile(file.path) != entry->hash)
+		{
+			return std::nullopt;
+		}
 	}
+	hash = entry->hash;
+	return StoredRange{ entry->offset, entry->storedSize, entry->crc, entry->codec };
 }
 
-void SequentialMode(const std::string& archiveName, const std::vector<std::string>& files)
+struct CompressedFile
+{
+	EncodedBlock block;
+	uint64_t hash = 0;
+	CodecId codec = CodecId::Gzip;
+};
+
+CompressedFile CompressFileContents(const std::string& path, std::optional<CodecId> codec,
+	PipelineMetrics* metrics = nullptr, size_t file = NO_FILE)
+{
+	std::vector<char> data;
+	{
+		PipelineMetrics::Span span(metrics, Stage::Read, file);
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+		{
+			throw std::runtime_error("Failed to open file: " + path);
+		}
+		data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		if (in.bad())
+		{
+			throw std::runtime_error("Failed to read file: " + path);
+		}
+		span.SetBytes(data.size(), data.size());
+	}
+
+	PipelineMetrics::Span span(metrics, Stage::Compress, file);
+	const CodecId chosen = codec ? *codec : ChooseCodecForData(data.data(), data.size());
+	const uint64_t hash = Xxh64::Hash(data.data(), data.size());
+	const size_t rawSize = data.size();
+	InputBlock block{ std::make_shared<const std::vector<char>>(std::move(data)), nullptr, true };
+	EncodedBlock encoded = GetCodec(chosen).Encode(block, false);
+	span.SetBytes(rawSize, encoded.data.size());
+	return { std::move(encoded), hash, chosen };
+}
+
+void PutBlock(ByteWriter& out, const EncodedBlock& block)
+{
+	out.Put(block.crc);
+	out.Put<uint64_t>(block.rawSize);
+	out.Put<uint64_t>(block.data.size());
+	out.PutBytes(block.data.data(), block.data.size());
+}
+
+EncodedBlock GetBlock(ByteReader& in)
+{
+	EncodedBlock block;
+	block.crc = in.Get<uint32_t>();
+	block.rawSize = in.Get<uint64_t>();
+	block.data = in.GetBytes(in.Get<uint64_t>());
+	return block;
+}
+
+// Обработчик заданий в рабочем процессе (--isolate): блок приходит вместе со словарём, мелкий файл — по имени
+std::vector<char> RunCompressionJob(const std::vector<char>& job)
+{
+	ByteReader in(job.data(), job.size());
+	ByteWriter out;
+	const auto kind = in.Get<uint8_t>();
+	if (kind == JOB_ENCODE_BLOCK)
+	{
+		const Codec& codec = GetCodec(static_cast<CodecId>(in.Get<uint8_t>()));
+		InputBlock block;
+		block.last = in.Get<uint8_t>() != 0;
+		const bool independent = in.Get<uint8_t>() != 0;
+		auto dict = in.GetBytes(in.Get<uint64_t>());
+		if (!dict.empty())
+		{
+			block.previous = std::make_shared<const std::vector<char>>(std::move(dict));
+		}
+		block.data = std::make_shared<const std::vector<char>>(in.GetBytes(in.Get<uint64_t>()));
+		PutBlock(out, codec.Encode(block, independent));
+	}
+	else if (kind == JOB_COMPRESS_FILE)
+	{
+		const auto codec = in.Get<uint8_t>();
+		const auto compressed = CompressFileContents(in.GetString(in.Get<uint32_t>()),
+			codec == JOB_AUTO_CODEC ? std::nullopt : std::optional(static_cast<CodecId>(codec)));
+		PutBlock(out, compressed.block);
+		out.Put(compressed.hash);
+		out.Put<uint8_t>(static_cast<uint8_t>(compressed.codec));
+	}
+	else
+	{
+		throw std::runtime_error("Unknown job kind");
+	}
+	return std::move(out.Bytes());
+}
+
+EncodedBlock EncodeInputBlock(size_t index, const InputBlock& block, CodecId codec, const CompressionOptions& options)
+{
+	PipelineMetrics::Span span(options.metrics, Stage::Compress, index);
+	if (!options.processes)
+	{
+		EncodedBlock encoded = GetCodec(codec).Encode(block, options.independentBlocks);
+		span.SetBytes(block.data->size(), encoded.data.size());
+		return encoded;
+	}
+
+	// Процессу нужен только хвост предыдущего блока — ровно то, что станет словарём
+	const bool useDict = codec == CodecId::Gzip && !options.independentBlocks;
+	const size_t dictSize = block.previous && useDict ? std::min(block.previous->size(), GZIP_WINDOW_SIZE) : 0;
+	ByteWriter job;
+	job.Put<uint8_t>(JOB_ENCODE_BLOCK);
+	job.Put<uint8_t>(static_cast<uint8_t>(codec));
+	job.Put<uint8_t>(block.last);
+	job.Put<uint8_t>(options.independentBlocks);
+	job.Put<uint64_t>(dictSize);
+	if (dictSize > 0)
+	{
+		job.PutBytes(block.previous->data() + block.previous->size() - dictSize, dictSize);
+	}
+	job.Put<uint64_t>(block.data->size());
+	job.PutBytes(block.data->data(), block.data->size());
+
+	const auto result = options.processes->Submit(std::move(job.Bytes())).get();
+	ByteReader reader(result.data(), result.size());
+	EncodedBlock encoded = GetBlock(reader);
+	span.SetBytes(block.data->size(), encoded.data.size());
+	return encoded;
+}
+
+ArchivePiece CompressWholeFile(size_t index, const InputFile& file, const Manifest& previous, const CompressionOptions& options)
+{
+	uint64_t hash = 0;
+	if (auto reuse = FindReusable(index, file, previous, options, hash))
+	{
+		return MakeReusedPiece(index, hash, *reuse);
+	}
+	if (!options.processes)
+	{
+		auto compressed = CompressFileContents(file.path, options.codec, options.metrics, index);
+		return MakeEncodedPiece(index, true, true, std::move(compressed.block), compressed.hash, compressed.codec);
+	}
+
+	// Рабочий процесс сам читает файл, поэтому здесь чтение и сжатие — один отрезок
+	PipelineMetrics::Span span(options.metrics, Stage::Compress, index);
+	ByteWriter job;
+	job.Put<uint8_t>(JOB_COMPRESS_FILE);
+	job.Put<uint8_t>(options.codec ? static_cast<uint8_t>(*options.codec) : JOB_AUTO_CODEC);
+	job.Put<uint32_t>(static_cast<uint32_t>(file.path.size()));
+	job.PutBytes(file.path.data(), file.path.size());
+	const auto result = options.processes->Submit(std::move(job.Bytes())).get();
+	ByteReader reader(result.data(), result.size());
+	EncodedBlock block = GetBlock(reader);
+	const auto contentHash = reader.Get<uint64_t>();
+	const auto codec = GetCodec(static_cast<CodecId>(reader.Get<uint8_t>())).GetId();
+	span.SetBytes(file.size, block.data.size());
+	return MakeEncodedPiece(index, true, true, std::move(block), contentHash, codec);
+}
+
+std::optional<InputBlock> ReadNextBlock(BlockReader& reader, size_t index, PipelineMetrics* metrics)
+{
+	PipelineMetrics::Span span(metrics, Stage::Read, index);
+	auto block = reader.Next();
+	if (block)
+	{
+		span.SetBytes(block->data->size(), block->data->size());
+	}
+	return block;
+}
+
+// Отдаёт в emit задачи, из которых складывается член архива: одну на неизменённый файл
+// и по одной на каждый блок файла, который нужно сжать. Кодек выбирается один на файл.
+// Самостоятельные блоки gzip сжимаются без словаря и становятся отдельными gzip-членами,
+// чтобы распаковщик мог разобрать их параллельно
+template <typename Emit>
+void EmitBlockPieces(size_t index, const InputFile& file, const Manifest& previous, const CompressionOptions& options, Emit&& emit)
+{
+	uint64_t hash = 0;
+	if (auto reuse = FindReusable(index, file, previous, options, hash))
+	{
+		emit([index, hash, reuse] { return MakeReusedPiece(index, hash, *reuse); });
+		return;
+	}
+
+	const CodecId codec = options.codec ? *options.codec : ChooseCodecForFile(file.path, file.size);
+	const bool standalone = codec == CodecId::Gzip && options.independentBlocks;
+
+	BlockReader reader(file.path, PARALLEL_BLOCK_SIZE);
+	Xxh64 hasher;
+	bool first = true;
+	while (auto block = ReadNextBlock(reader, index, options.metrics))
+	{
+		hasher.Update(block->data->data(), block->data->size());
+		const uint64_t fileHash = block->last ? hasher.Digest() : 0;
+		emit([index, first, fileHash, codec, standalone, options, block = *block] {
+			return MakeEncodedPiece(index, first, block.last, EncodeInputBlock(index, block, codec, options), fileHash, codec, standalone);
+		});
+		first = false;
+	}
+}
+
+// Литерал — полный поток кодека, чтобы его можно было распаковать отдельно от соседей
+EncodedBlock EncodeChunk(size_t index, const std::shared_ptr<const std::vector<char>>& data, CodecId codec,
+	CompressionOptions options)
+{
+	options.independentBlocks = true;
+	EncodedBlock encoded = EncodeInputBlock(index, { data, nullptr, true }, codec, options);
+	const Codec& chunkCodec = GetCodec(codec);
+	std::vector<char> stream = chunkCodec.MakeHeader({}, 0, encoded.rawSize);
+	const auto trailer = chunkCodec.MakeTrailer(encoded.crc, encoded.rawSize);
+	stream.reserve(stream.size() + encoded.data.size() + trailer.size());
+	stream.insert(stream.end(), encoded.data.begin(), encoded.data.end());
+	stream.insert(stream.end(), trailer.begin(), trailer.end());
+	encoded.data = std::move(stream);
+	return encoded;
+}
+
+// Режет файл на чанки по содержимому (--dedup). Новый чанк сжимается отдельной задачей, а повторный
+// сразу становится ссылкой на свой литерал: его не нужно ни сжимать, ни записывать ещё раз.
+// Таблица чанков общая на весь архив, поэтому файлы режутся по одному в порядке членов
+template <typename Emit>
+void EmitChunkPieces(size_t index, const InputFile& file, const Manifest& previous, const CompressionOptions& options,
+	ChunkTable& chunks, Emit&& emit)
+{
+	uint64_t hash = 0;
+	if (auto reuse = FindReusable(index, file, previous, options, hash))
+	{
+		emit([index, hash, reuse] { return MakeReusedPiece(index, hash, *reuse); });
+		return;
+	}
+
+	const CodecId codec = options.codec ? *options.codec : ChooseCodecForFile(file.path, file.size);
+	auto makePiece = [index, codec](bool first, bool last, EncodedBlock block, uint64_t fileHash, std::optional<ChunkPiece> chunk) {
+		ArchivePiece piece = MakeEncodedPiece(index, first, last, std::move(block), fileHash, codec);
+		piece.chunked = true;
+		piece.chunk = chunk;
+		return piece;
+	};
+
+	bool first = true;
+	auto emitChunk = [&](std::vector<char> chunk) {
+		const auto [entry, inserted] = chunks.try_emplace(MakeChunkKey(chunk.data(), chunk.size()), chunks.size());
+		const ChunkPiece piece{ entry->second, !inserted };
+		if (inserted)
+		{
+			emit([makePiece, index, first, codec, options, piece, data = std::make_shared<const std::vector<char>>(std::move(chunk))] {
+				return makePiece(first, false, EncodeChunk(index, data, codec, options), 0, piece);
+			});
+		}
+		else
+		{
+			emit([makePiece, first, piece] { return makePiece(first, false, {}, 0, piece); });
+		}
+		first = false;
+	};
+
+	BlockReader reader(file.path, PARALLEL_BLOCK_SIZE);
+	ContentChunker chunker;
+	Xxh64 hasher;
+	while (auto block = ReadNextBlock(reader, index, options.metrics))
+	{
+		hasher.Update(block->data->data(), block->data->size());
+		chunker.Update(block->data->data(), block->data->size(), emitChunk);
+	}
+	chunker.Finish(emitChunk);
+	emit([makePiece, first, fileHash = hasher.Digest()] { return makePiece(first, true, {}, fileHash, std::nullopt); });
+}
+
+// Прошлый манифест, если он описывает именно тот архив, что лежит на диске
+Manifest LoadPreviousManifest(const std::string& archiveName)
+{
+	struct stat info{};
+	if (stat(archiveName.c_str(), &info) != 0)
+	{
+		return {};
+	}
+	auto manifest = Manifest::Load(GetManifestPath(archiveName));
+	if (!manifest.Describes(static_cast<uint64_t>(info.st_size), GetMtimeNs(info)))
+	{
+		return {};
+	}
+	return manifest;
+}
+
+// В инкрементальном режиме прошлый архив нужен до конца записи, поэтому новый пишем рядом
+std::string GetOutputPath(const Args& args)
+{
+	return args.incremental ? args.archiveName + ".tmp" : args.archiveName;
+}
+
+void CommitArchive(const Args& args, ArchiveWriter& writer, PipelineMetrics* metrics)
+{
+	PipelineMetrics::Span span(metrics, Stage::Archive, NO_FILE);
+	const uint64_t archiveSize = writer.GetArchiveSize();
+	writer.Finish();
+	span.SetBytes(0, writer.GetArchiveSize() - archiveSize);
+	if (!args.incremental)
+	{
+		return;
+	}
+
+	std::filesystem::rename(GetOutputPath(args), args.archiveName);
+	struct stat info{};
+	if (stat(args.archiveName.c_str(), &info) != 0)
+	{
+		throw std::runtime_error("Failed to create archive: " + args.archiveName);
+	}
+
+	Manifest& manifest = writer.GetManifest();
+	manifest.SetArchive(static_cast<uint64_t>(info.st_size), GetMtimeNs(info));
+	const std::string manifestPath = GetManifestPath(args.archiveName);
+	manifest.Save(manifestPath + ".tmp");
+	std::filesystem::rename(manifestPath + ".tmp", manifestPath);
+
+	std::cout << "Reused " << writer.GetReusedCount() << " of " << manifest.Size() << " files\n";
+}
+
+void WritePiece(ArchiveWriter& writer, const ArchivePiece& piece, PipelineMetrics* metrics)
+{
+	PipelineMetrics::Span span(metrics, Stage::Write, piece.file);
+	const uint64_t processed = writer.GetProcessedBytes();
+	const uint64_t archiveSize = writer.GetArchiveSize();
+	writer.Write(piece);
+	span.SetBytes(writer.GetProcessedBytes() - processed, writer.GetArchiveSize() - archiveSize);
+	if (metrics && piece.last)
+	{
+		metrics->SetFileCodec(piece.file, piece.chunked ? "dedup" : GetCodecName(piece.codec), piece.reuse.has_value());
+	}
+}
+
+// Файлы метрик пишутся, когда архив уже готов и все отрезки закрыты
+void WriteMetrics(const Args& args, PipelineMetrics* metrics)
+{
+	if (!metrics)
+	{
+		return;
+	}
+	metrics->Finish();
+	if (!args.metricsPath.empty())
+	{
+		metrics->WriteJson(args.metricsPath);
+	}
+	if (!args.tracePath.empty())
+	{
+		metrics->WriteTrace(args.tracePath);
+	}
+}
+
+void PrintDedupStats(const Args& args, const ArchiveWriter& writer)
+{
+	if (args.dedup)
+	{
+		std::cout << "Deduplicated chunks: " << writer.GetChunkReferenceCount() << "\n";
+	}
+}
+
+void SequentialMode(const Args& args)
 {
 	auto start = std::chrono::high_resolution_clock::now();
 
-	for (const auto& file: files)
+	std::optional<PipelineMetrics> metrics;
+	if (!args.metricsPath.empty() || !args.tracePath.empty())
 	{
-		CompressFile(file);
+		metrics.emplace(args.mode, 1, !args.tracePath.empty());
+		metrics->NameThread("main");
 	}
+	PipelineMetrics* const metricsPtr = metrics ? &*metrics : nullptr;
 
-	CreateArchive(archiveName, files);
+	const auto inputs = StatInputFiles(args.files);
+	if (metrics)
+	{
+		metrics->SetFiles(inputs);
+	}
+	const Manifest previous = args.incremental ? LoadPreviousManifest(args.archiveName) : Manifest{};
+	ArchiveWriter writer(GetOutputPath(args), inputs, previous.Empty() ? std::string() : args.archiveName);
+	const CompressionOptions options{ args.codec, args.independentBlocks, nullptr, args.dedup, metricsPtr };
+	ChunkTable chunks;
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		auto write = [&](auto&& makePiece) {
+			ArchivePiece piece = [&] {
+				PipelineMetrics::Task task(metricsPtr);
+				return makePiece();
+			}();
+			WritePiece(writer, piece, metricsPtr);
+		};
+		if (options.dedup)
+		{
+			EmitChunkPieces(i, inputs[i], previous, options, chunks, write);
+		}
+		else
+		{
+			EmitBlockPieces(i, inputs[i], previous, options, write);
+		}
+	}
+	CommitArchive(args, writer, metricsPtr);
+	PrintDedupStats(args, writer);
+	WriteMetrics(args, metricsPtr);
 
 	auto end = std::chrono::high_resolution_clock::now();
 	std::chrono::duration<double> elapsed = end - start;
 	std::cout << "Total time: " << elapsed.count() << " seconds\n";
 }
 
-void ParallelMode(int numProcesses, const std::string& archiveName, const std::vector<std::string>& files)
+// Раздаёт работу пулу в порядке членов архива: мелкий файл — одна задача,
+// большой — по задаче на блок, с дедупликацией — по задаче на чанк. Номер куска задаёт его место в архиве
+void DispatchPieces(ThreadPool& pool, const std::vector<InputFile>& inputs, const Manifest& previous,
+	const CompressionOptions& options, OrderedQueue<ArchivePiece>& queue)
 {
-	auto start = std::chrono::high_resolution_clock::now();
+	ChunkTable chunks;
+	size_t seq = 0;
 
-	std::vector<pid_t> pids;
-	//TODO: разбить на функции
-	for (const auto& file: files)
-	{
-		if (pids.size() >= numProcesses)
-		{
-			int status;
-			pid_t finishedPid = waitpid(-1, &status, 0);
-			//TODO: std::erase
-			auto it = std::find(pids.begin(), pids.end(), finishedPid);
-			if (it != pids.end())
+	auto submitAt = [&](size_t pieceSeq, auto&& makePiece) {
+		pool.Submit([&queue, metrics = options.metrics, pieceSeq, makePiece = std::move(makePiece)] {
+			if (queue.IsAborted())
 			{
-				pids.erase(it);
+				return;
 			}
-		}
+			try
+			{
+				// Задача учтена до Push: после последнего Push писатель может сразу закончить
+				ArchivePiece piece = [&] {
+					PipelineMetrics::Task task(metrics);
+					return makePiece();
+				}();
+				queue.Push(pieceSeq, std::move(piece));
+			}
+			catch (...)
+			{
+				queue.Abort(std::current_exception());
+			}
+		});
+	};
+	auto submit = [&](auto&& makePiece) {
+		queue.WaitForSlot(seq);
+		submitAt(seq++, std::forward<decltype(makePiece)>(makePiece));
+	};
 
-		pid_t pid = fork();
-		if (pid == 0)
+	for (size_t i = 0; i < inputs.size();)
+	{
+		if (options.dedup)
 		{
-			CompressFile(file);
-			_exit(0);//TODO: return bool
+			EmitChunkPieces(i, inputs[i], previous, options, chunks, submit);
+			++i;
+			continue;
 		}
-		else if (pid > 0)
+		if (IsLargeFile(inputs[i]))
 		{
-			pids.push_back(pid);
+			EmitBlockPieces(i, inputs[i], previous, options, submit);
+			++i;
+			continue;
 		}
-		else
+
+		// Подряд идущие мелкие файлы занимают по одному номеру, поэтому пачку размером с окно очереди
+		// можно раздать от больших к мелким (LPT), а писатель всё равно выдаст их в порядке argv
+		std::vector<size_t> batch;
+		for (; i < inputs.size() && !IsLargeFile(inputs[i]) && batch.size() < queue.GetCapacity(); ++i)
+		{
+			batch.push_back(i);
+		}
+		queue.WaitForSlot(seq + batch.size() - 1);
+		for (const size_t order: LongestFirstOrder(batch, [&inputs](size_t index) { return inputs[index].size; }))
 		{
-			throw std::runtime_error("Failed to fork process");
+			const size_t index = batch[order];
+			submitAt(seq + order, [index, &file = inputs[index], &previous, &options] {
+				return CompressWholeFile(index, file, previous, options);
+			});
 		}
+		seq += batch.size();
+	}
+	queue.Close(seq);
+}
+
+void ParallelMode(const Args& args)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// С --isolate сжимают рабочие процессы: та же программа, запущенная пулом через exec
+	std::optional<ProcessPool> processes;
+	if (args.isolate)
+	{
+		processes.emplace(args.numProcesses);
+	}
+	std::optional<PipelineMetrics> metrics;
+	if (!args.metricsPath.empty() || !args.tracePath.empty())
+	{
+		metrics.emplace(args.mode, args.numProcesses, !args.tracePath.empty());
+		metrics->NameThread("dispatcher");
 	}
+	PipelineMetrics* const metricsPtr = metrics ? &*metrics : nullptr;
+	const CompressionOptions options{ args.codec, args.independentBlocks, processes ? &*processes : nullptr, args.dedup, metricsPtr };
 
-	for (pid_t pid: pids)
+	// Члены архива идут в порядке argv, как в последовательном режиме; порядок раздачи выбирает DispatchPieces
+	const auto inputs = StatInputFiles(args.files);
+	if (metrics)
 	{
-		waitpid(pid, nullptr, 0);
+		metrics->SetFiles(inputs);
+	}
+	const Manifest previous = args.incremental ? LoadPreviousManifest(args.archiveName) : Manifest{};
+	ArchiveWriter writer(GetOutputPath(args), inputs, previous.Empty() ? std::string() : args.archiveName);
+	OrderedQueue<ArchivePiece> queue(QUEUE_PIECES_PER_THREAD * args.numProcesses);
+	ThreadPool pool(args.numProcesses);
+	std::optional<WorkerController> controller;
+	if (args.autoWorkers)
+	{
+		controller.emplace(pool, [&writer] { return writer.GetProcessedBytes(); });
 	}
 
-	auto archiveStart = std::chrono::high_resolution_clock::now();
-	CreateArchive(archiveName, files);
-	auto end = std::chrono::high_resolution_clock::now();
+	// Архив пишется одновременно со сжатием, в один проход и без промежуточных .gz
+	std::jthread writerThread([&] {
+		if (metrics)
+		{
+			metrics->NameThread("writer");
+		}
+		try
+		{
+			while (auto piece = queue.Pop())
+			{
+				if (metrics)
+				{
+					metrics->SampleQueues(queue.GetSize(), queue.GetCapacity(), pool.GetQueuedCount());
+				}
+				WritePiece(writer, *piece, metricsPtr);
+			}
+		}
+		catch (...)
+		{
+			queue.Abort(std::current_exception());
+		}
+	});
+
+	try
+	{
+		DispatchPieces(pool, inputs, previous, options, queue);
+	}
+	catch (...)
+	{
+		queue.Abort(std::current_exception());
+	}
+	writerThread.join();
+	controller.reset();
+	queue.ThrowIfAborted();
+	CommitArchive(args, writer, metricsPtr);
+	PrintDedupStats(args, writer);
+	WriteMetrics(args, metricsPtr);
 
+	auto end = std::chrono::high_resolution_clock::now();
 	std::chrono::duration<double> totalElapsed = end - start;
-	std::chrono::duration<double> archiveElapsed = end - archiveStart;
 
 	std::cout << "Total time: " << totalElapsed.count() << " seconds\n";
-	std::cout << "Archive creation time: " << archiveElapsed.count() << " seconds\n";
+	std::cout << "Archive creation time: " << writer.GetBusySeconds() << " seconds\n";
+	if (processes && processes->GetRespawnCount() > 0)
+	{
+		std::cerr << "Worker processes restarted: " << processes->GetRespawnCount() << "\n";
+	}
 }
 
 Args ParseArgs(int argc, char* argv[])
 {
 	Args args;
 
-	if (argc < 4)
+	std::vector<std::string> positional;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--incremental")
+		{
+			args.incremental = true;
+		}
+		else if (arg == "--independent-blocks")
+		{
+			args.independentBlocks = true;
+		}
+		else if (arg == "--isolate")
+		{
+			args.isolate = true;
+		}
+		else if (arg == "--dedup")
+		{
+			args.dedup = true;
+		}
+		else if (arg.starts_with("--codec="))
+		{
+			args.codec = ParseCodecName(arg.substr(std::string("--codec=").size()));
+		}
+		else if (arg.starts_with("--metrics="))
+		{
+			args.metricsPath = arg.substr(std::string("--metrics=").size());
+		}
+		else if (arg.starts_with("--trace="))
+		{
+			args.tracePath = arg.substr(std::string("--trace=").size());
+		}
+		else if (arg.starts_with("--"))
+		{
+			throw std::invalid_argument("Unknown option: " + arg);
+		}
+		else
+		{
+			positional.push_back(std::move(arg));
+		}
+	}
+
+	if (positional.size() < 3)
 	{
 		throw std::invalid_argument(
-			"Usage: " + std::string(argv[0]) + " -S|-P NUM-PROCESSES ARCHIVE-NAME [INPUT-FILES]");
+			"Usage: " + std::string(argv[0]) + " [--incremental] [--independent-blocks] [--isolate] [--dedup] [--codec=gzip|lz4|store|auto] [--metrics=FILE] [--trace=FILE] -S|-P NUM-PROCESSES|auto ARCHIVE-NAME [INPUT-FILES]");
 	}
 
-	args.mode = argv[1];
+	args.mode = positional[0];
 	if (args.mode == "-S")
 	{
-		args.archiveName = argv[2];
-		for (int i = 3; i < argc; ++i)
-		{
-			args.files.emplace_back(argv[i]);
-		}
+		args.archiveName = positional[1];
+		args.files.assign(positional.begin() + 2, positional.end());
 	}
 	else if (args.mode == "-P")
 	{
-		args.numProcesses = std::stoi(argv[2]);
-		args.archiveName = argv[3];
-		for (int i = 4; i < argc; ++i)
+		// auto — пул на GetMaxAutoWorkers потоков, сколько из них работает, решает WorkerController
+		args.autoWorkers = positional[1] == AUTO_WORKERS;
+		args.numProcesses = args.autoWorkers ? GetMaxAutoWorkers() : std::stoi(positional[1]);
+		if (args.numProcesses <= 0)
 		{
-			args.files.emplace_back(argv[i]);
+			throw std::invalid_argument("NUM-PROCESSES must be a positive integer");
 		}
+		args.archiveName = positional[2];
+		args.files.assign(positional.begin() + 3, positional.end());
 	}
 	else
 	{
@@ -143,17 +743,18 @@ Args ParseArgs(int argc, char* argv[])
 
 int main(int argc, char* argv[])
 {
+	ProcessPool::ServeIfWorker(argc, argv, RunCompressionJob);
 	try
 	{
 		Args args = ParseArgs(argc, argv);
 
 		if (args.mode == "-S")
 		{
-			SequentialMode(args.archiveName, args.files);
+			SequentialMode(args);
 		}
 		else if (args.mode == "-P")
 		{
-			ParallelMode(args.numProcesses, args.archiveName, args.files);
+			ParallelMode(args);
 		}
 	}
 	catch (const std::exception& e)
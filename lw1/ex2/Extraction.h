@@ -0,0 +1,410 @@
+#pragma once
+
+#include <zlib.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <filesystem>
+#include <fnmatch.h>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "ArchiveIndex.h"
+#include "Chunking.h"
+#include "Codec.h"
+#include "Crc32.h"
+#include "Gzip.h"
+#include "Tar.h"
+#include "WriteBehind.h"
+
+namespace fs = std::filesystem;
+
+// Путь внутри выходной папки; имена с ".." не выпускаем за её пределы
+inline fs::path MakeOutputPath(const std::string& outputFolder, const std::string& name)
+{
+	const fs::path relative = fs::path(name).relative_path();
+	for (const auto& part: relative)
+	{
+		if (part == "..")
+		{
+			throw std::runtime_error("Unsafe member name: " + name);
+		}
+	}
+	fs::path path = fs::path(outputFolder) / relative;
+	fs::create_directories(path.parent_path());
+	return path;
+}
+
+// Имя файла, в который распакуется член: без суффикса кодека или .cdc
+inline std::string GetOutputName(const std::string& memberName)
+{
+	if (memberName.ends_with(CHUNKED_SUFFIX))
+	{
+		return memberName.substr(0, memberName.size() - std::strlen(CHUNKED_SUFFIX));
+	}
+	return StripCodecSuffix(memberName);
+}
+
+// Суффикс, который make_archive дописывает к имени члена с этим номером кодека в оглавлении
+inline std::string GetMemberSuffix(uint8_t indexCodec)
+{
+	return indexCodec == CHUNKED_MEMBER_CODEC ? CHUNKED_SUFFIX : GetCodec(static_cast<CodecId>(indexCodec)).GetSuffix();
+}
+
+// Запись оглавления для члена tar: её имя вместе с суффиксом её же кодека совпадает с именем члена целиком
+inline const IndexEntry* FindMemberEntry(const ArchiveIndex& index, const std::string& memberName)
+{
+	const std::string name = StripLeadingSlashes(memberName);
+	for (const uint8_t codec: { static_cast<uint8_t>(CodecId::Gzip), static_cast<uint8_t>(CodecId::Lz4),
+			 static_cast<uint8_t>(CodecId::Store), CHUNKED_MEMBER_CODEC })
+	{
+		const std::string suffix = GetMemberSuffix(codec);
+		if (!name.ends_with(suffix))
+		{
+			continue;
+		}
+		const IndexEntry* entry = index.Find(name.substr(0, name.size() - suffix.size()));
+		if (entry && entry->codec == codec)
+		{
+			return entry;
+		}
+	}
+	// Архивы до суффикса .raw хранили несжатые члены под исходным именем
+	const IndexEntry* entry = index.Find(name);
+	return entry && entry->codec == static_cast<uint8_t>(CodecId::Store) ? entry : nullptr;
+}
+
+// Выбор членов по --include и --exclude. Шаблон fnmatch (* совпадает и с '/') сверяется с именем файла
+// и с каждым каталогом на пути к нему, так что шаблон каталога выбирает всё поддерево.
+// Без --include выбрано всё; --exclude сильнее --include
+class MemberFilter
+{
+public:
+	void Include(const std::string& pattern)
+	{
+		m_includes.push_back(Normalize(pattern));
+	}
+
+	void Exclude(const std::string& pattern)
+	{
+		m_excludes.push_back(Normalize(pattern));
+	}
+
+	[[nodiscard]] bool IsEmpty() const noexcept
+	{
+		return m_includes.empty() && m_excludes.empty();
+	}
+
+	[[nodiscard]] bool Matches(const std::string& name) const
+	{
+		const std::string path = Normalize(name);
+		return (m_includes.empty() || MatchesAny(m_includes, path)) && !MatchesAny(m_excludes, path);
+	}
+
+private:
+	static std::string Normalize(const std::string& name)
+	{
+		std::string path = StripLeadingSlashes(name);
+		while (path.ends_with('/'))
+		{
+			path.pop_back();
+		}
+		return path;
+	}
+
+	static bool MatchesAny(const std::vector<std::string>& patterns, const std::string& path)
+	{
+		for (const auto& pattern: patterns)
+		{
+			for (size_t end = path.find('/'); ; end = path.find('/', end + 1))
+			{
+				const std::string prefix = path.substr(0, end);
+				if (fnmatch(pattern.c_str(), prefix.c_str(), 0) == 0)
+				{
+					return true;
+				}
+				if (end == std::string::npos)
+				{
+					break;
+				}
+			}
+		}
+		return false;
+	}
+
+	std::vector<std::string> m_includes;
+	std::vector<std::string> m_excludes;
+};
+
+// Выходной файл, который пишется подряд. expectedSize — размер, если он известен заранее: под него сразу
+// выделяется место. С writer данные пишет поток отложенной записи, и он же закрывает файл
+class OutputFile
+{
+public:
+	OutputFile(fs::path path, unsigned mode, int64_t mtime, std::optional<uint64_t> expectedSize = std::nullopt,
+		WriteBehind* writer = nullptr)
+		: m_handle(std::make_shared<OutputHandle>(std::move(path), mode, mtime))
+		, m_writer(writer)
+		, m_out(m_handle, writer, 0, expectedSize ? static_cast<size_t>(std::min<uint64_t>(*expectedSize, WRITE_BUFFER_SIZE)) : WRITE_BUFFER_SIZE)
+	{
+		if (expectedSize)
+		{
+			m_handle->Preallocate(*expectedSize);
+		}
+	}
+
+	void Write(const char* data, size_t size)
+	{
+		m_out.Write(data, size);
+		m_crc = Crc32(m_crc, data, size);
+		m_size += size;
+	}
+
+	void Close()
+	{
+		m_out.Flush();
+		m_handle->Trim(m_size);
+		if (m_writer)
+		{
+			m_writer->Close(m_handle);
+		}
+		else
+		{
+			m_handle->Close();
+		}
+	}
+
+	[[nodiscard]] uint32_t GetCrc() const noexcept
+	{
+		return m_crc;
+	}
+
+	[[nodiscard]] uint64_t GetSize() const noexcept
+	{
+		return m_size;
+	}
+
+	[[nodiscard]] const fs::path& GetPath() const noexcept
+	{
+		return m_handle->GetPath();
+	}
+
+private:
+	std::shared_ptr<OutputHandle> m_handle;
+	WriteBehind* m_writer;
+	BufferedWriter m_out;
+	uint32_t m_crc = 0;
+	uint64_t m_size = 0;
+};
+
+// Выходной файл, который по кускам пишут несколько потоков: каждый кусок ложится по своему смещению.
+// Закрывает файл тот, кто завершил последний кусок, — читатель архива (Seal) или распаковщик (CompleteSegment)
+class SegmentedOutput
+{
+public:
+	SegmentedOutput(fs::path path, unsigned mode, int64_t mtime, WriteBehind* writer = nullptr)
+		: m_handle(std::make_shared<OutputHandle>(std::move(path), mode, mtime))
+		, m_writer(writer)
+	{
+	}
+
+	SegmentedOutput(const SegmentedOutput&) = delete;
+	SegmentedOutput& operator=(const SegmentedOutput&) = delete;
+
+	// Пишет сразу, минуя отложенную запись: после возврата данные можно прочитать из файла
+	void WriteAt(const char* data, size_t size, uint64_t offset)
+	{
+		m_handle->WriteAt(data, size, offset);
+	}
+
+	// Писатель одного куска, начинающегося с offset; size — сколько примерно в нём будет байтов
+	[[nodiscard]] BufferedWriter OpenSegment(uint64_t offset, size_t size = WRITE_BUFFER_SIZE)
+	{
+		return BufferedWriter(m_handle, m_writer, offset, size);
+	}
+
+	void AddSegment()
+	{
+		std::lock_guard lock(m_mutex);
+		++m_pending;
+	}
+
+	// true — кусок был последним и файл пора закрывать
+	bool CompleteSegment()
+	{
+		std::lock_guard lock(m_mutex);
+		--m_pending;
+		return m_sealed && m_pending == 0;
+	}
+
+	// Новых кусков не будет; true — все уже записаны
+	bool Seal()
+	{
+		std::lock_guard lock(m_mutex);
+		m_sealed = true;
+		return m_pending == 0;
+	}
+
+	void Close()
+	{
+		if (m_writer)
+		{
+			m_writer->Close(m_handle);
+		}
+		else
+		{
+			m_handle->Close();
+		}
+	}
+
+	[[nodiscard]] const fs::path& GetPath() const noexcept
+	{
+		return m_handle->GetPath();
+	}
+
+private:
+	std::shared_ptr<OutputHandle> m_handle;
+	WriteBehind* m_writer;
+	std::mutex m_mutex;
+	size_t m_pending = 0;
+	bool m_sealed = false;
+};
+
+// Распаковывает данные кодека, целиком лежащие в памяти
+inline void DecodeBuffer(const Codec& codec, const std::vector<char>& data, OutputFile& out)
+{
+	const auto decoder = codec.MakeDecoder();
+	decoder->Decode(data.data(), data.size(), [&](const char* chunk, size_t size) { out.Write(chunk, size); });
+	if (!decoder->Finished())
+	{
+		throw std::runtime_error("Truncated compressed data: " + out.GetPath().string());
+	}
+}
+
+// Член целиком в памяти, так что размер файла обычно виден по заголовку или трейлеру кодека
+inline void DecodeMemberToFile(const Codec& codec, const std::vector<char>& data, const fs::path& path, unsigned mode,
+	int64_t mtime, WriteBehind* writer = nullptr)
+{
+	OutputFile out(path, mode, mtime, codec.ReadRawSize(data.data(), data.size()), writer);
+	DecodeBuffer(codec, data, out);
+	out.Close();
+}
+
+// Распаковывает самостоятельный gzip-член, начиная с offset выходного файла; writeAt(data, size, offset) пишет кусок.
+// rawSize — ISIZE из трейлера, если член записан блоками и по нему уже посчитаны смещения следующих
+template <typename WriteAt>
+void InflateSegment(const std::vector<char>& member, uint64_t offset, std::optional<uint32_t> rawSize,
+	const fs::path& path, WriteAt&& writeAt)
+{
+	GzipInflater inflater;
+	uint64_t produced = 0;
+	inflater.Decompress(member.data(), member.size(), [&](const char* data, size_t size) {
+		writeAt(data, size, offset + produced);
+		produced += size;
+	});
+	if (!inflater.Finished() || (rawSize && produced != *rawSize))
+	{
+		throw std::runtime_error("Corrupted gzip block: " + path.string());
+	}
+}
+
+inline ChunkRecord PreadChunkRecord(int archiveFd, uint64_t offset)
+{
+	std::vector<char> header(1);
+	PreadExact(archiveFd, header.data(), 1, offset);
+	header.resize(GetChunkRecordSize(static_cast<uint8_t>(header[0])));
+	PreadExact(archiveFd, header.data(), header.size(), offset);
+	return ParseChunkRecord(header);
+}
+
+// Собирает член .cdc: литералы читаются на месте, за данными ссылки идём по смещению её литерала
+inline void ReassembleIndexedChunks(int archiveFd, const IndexEntry& entry, OutputFile& out)
+{
+	char magic[sizeof(CHUNKED_MAGIC)]{};
+	if (entry.storedSize >= sizeof(magic))
+	{
+		PreadExact(archiveFd, magic, sizeof(magic), entry.offset);
+	}
+	if (std::memcmp(magic, CHUNKED_MAGIC, sizeof(magic)) != 0)
+	{
+		throw std::runtime_error("Member is corrupted: " + entry.name);
+	}
+
+	std::vector<char> stored;
+	const uint64_t end = entry.offset + entry.storedSize;
+	for (uint64_t position = entry.offset + sizeof(magic); position < end;)
+	{
+		const ChunkRecord record = PreadChunkRecord(archiveFd, position);
+		uint64_t literalOffset = position;
+		ChunkRecord literal = record;
+		if (record.type == CHUNK_REFERENCE)
+		{
+			literalOffset = record.target;
+			literal = PreadChunkRecord(archiveFd, literalOffset);
+			if (literal.type != CHUNK_LITERAL || literal.crc != record.crc)
+			{
+				throw std::runtime_error("Member is corrupted: " + entry.name);
+			}
+			position += CHUNK_REFERENCE_SIZE;
+		}
+		else
+		{
+			position += CHUNK_LITERAL_HEADER_SIZE + record.storedSize;
+		}
+
+		stored.resize(literal.storedSize);
+		PreadExact(archiveFd, stored.data(), stored.size(), literalOffset + CHUNK_LITERAL_HEADER_SIZE);
+		const auto chunk = DecodeChunk(literal, stored.data(), stored.size(), entry.name);
+		out.Write(chunk.data(), chunk.size());
+	}
+}
+
+inline void DecodeIndexedMember(int archiveFd, const IndexEntry& entry, OutputFile& out)
+{
+	const auto decoder = GetCodec(static_cast<CodecId>(entry.codec)).MakeDecoder();
+	auto sink = [&](const char* data, size_t size) { out.Write(data, size); };
+
+	std::vector<char> buffer(GZIP_IO_BUFFER_SIZE);
+	for (uint64_t done = 0; done < entry.storedSize;)
+	{
+		const size_t chunk = std::min<uint64_t>(buffer.size(), entry.storedSize - done);
+		PreadExact(archiveFd, buffer.data(), chunk, entry.offset + done);
+		decoder->Decode(buffer.data(), chunk, sink);
+		done += chunk;
+	}
+	if (!decoder->Finished())
+	{
+		throw std::runtime_error("Member is corrupted: " + entry.name);
+	}
+}
+
+// Распаковывает один член по оглавлению: читаются только его байты, остальной архив не трогаем
+inline void ExtractIndexedMember(int archiveFd, const IndexEntry& entry, const std::string& outputFolder)
+{
+	// Заголовок ustar всегда лежит прямо перед данными члена: берём из него права и mtime
+	TarHeader header;
+	PreadExact(archiveFd, header.data(), header.size(), entry.offset - TAR_BLOCK_SIZE);
+	const auto mode = static_cast<unsigned>(ReadTarNumber(header.data() + 100, 8));
+	const auto mtime = static_cast<int64_t>(ReadTarNumber(header.data() + 136, 12));
+
+	OutputFile out(MakeOutputPath(outputFolder, entry.name), mode, mtime, entry.rawSize);
+	if (entry.codec == CHUNKED_MEMBER_CODEC)
+	{
+		ReassembleIndexedChunks(archiveFd, entry, out);
+	}
+	else
+	{
+		DecodeIndexedMember(archiveFd, entry, out);
+	}
+
+	out.Close();
+	if (out.GetSize() != entry.rawSize || out.GetCrc() != entry.crc)
+	{
+		throw std::runtime_error("Member is corrupted: " + entry.name);
+	}
+}
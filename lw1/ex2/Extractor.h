@@ -0,0 +1,580 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Bytes.h"
+#include "Chunking.h"
+#include "Extraction.h"
+#include "ProcessPool.h"
+#include "Tar.h"
+#include "ThreadPool.h"
+#include "WriteBehind.h"
+
+// Окно — сколько сжатых данных может быть прочитано, но не распаковано. Столько же могут занимать
+// распакованные литералы, ждущие своих ссылок; так что пик памяти — около двух окон
+// и ещё очередь отложенной записи (WRITE_BEHIND_CAPACITY)
+constexpr size_t DEFAULT_WINDOW_SIZE = 256 * 1024 * 1024;
+
+enum ExtractionJobKind : uint8_t
+{
+	JOB_DECODE_MEMBER = 0,
+	JOB_DECODE_SEGMENT = 1,
+};
+
+// Обработчик заданий в рабочем процессе (--isolate): сжатые байты приходят в задании,
+// а результат процесс сам пишет в выходной файл
+inline std::vector<char> RunExtractionJob(const std::vector<char>& job)
+{
+	ByteReader in(job.data(), job.size());
+	const auto kind = in.Get<uint8_t>();
+	const fs::path path = in.GetString(in.Get<uint32_t>());
+	if (kind == JOB_DECODE_MEMBER)
+	{
+		const Codec& codec = GetCodec(static_cast<CodecId>(in.Get<uint8_t>()));
+		const auto mode = in.Get<uint32_t>();
+		const auto mtime = in.Get<int64_t>();
+		DecodeMemberToFile(codec, in.GetBytes(in.Get<uint64_t>()), path, mode, mtime);
+	}
+	else if (kind == JOB_DECODE_SEGMENT)
+	{
+		const auto offset = in.Get<uint64_t>();
+		const bool hasRawSize = in.Get<uint8_t>() != 0;
+		const auto rawSize = in.Get<uint32_t>();
+		const auto member = in.GetBytes(in.Get<uint64_t>());
+
+		const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			throw std::runtime_error("Failed to open file: " + path.string());
+		}
+		try
+		{
+			InflateSegment(member, offset, hasRawSize ? std::optional(rawSize) : std::nullopt, path,
+				[&](const char* data, size_t size, uint64_t at) { PwriteExact(fd, data, size, at, path); });
+		}
+		catch (...)
+		{
+			close(fd);
+			throw;
+		}
+		if (close(fd) != 0)
+		{
+			throw std::runtime_error("Failed to write file: " + path.string());
+		}
+	}
+	else
+	{
+		throw std::runtime_error("Unknown job kind");
+	}
+	return {};
+}
+
+// Ограничивает объём сжатых данных, прочитанных из архива, но ещё не распакованных
+class MemoryBudget
+{
+public:
+	explicit MemoryBudget(size_t capacity)
+		: m_capacity(capacity)
+	{
+	}
+
+	// Кусок больше всего бюджета ждёт, пока бюджет не опустеет, и идёт один
+	void Acquire(size_t size)
+	{
+		size = std::min(size, m_capacity);
+		std::unique_lock lock(m_mutex);
+		m_released.wait(lock, [&] { return m_used + size <= m_capacity; });
+		m_used += size;
+	}
+
+	void Release(size_t size)
+	{
+		size = std::min(size, m_capacity);
+		{
+			std::lock_guard lock(m_mutex);
+			m_used -= size;
+		}
+		m_released.notify_all();
+	}
+
+private:
+	const size_t m_capacity;
+	size_t m_used = 0;
+	std::mutex m_mutex;
+	std::condition_variable m_released;
+};
+
+// Возвращает память в бюджет, когда задача распаковки закончилась, в том числе с ошибкой
+struct BudgetRelease
+{
+	MemoryBudget& budget;
+	size_t size;
+	~BudgetRelease() { budget.Release(size); }
+};
+
+// Разбирает tar-поток в одном потоке и сразу отдаёт каждый прочитанный сжатый член пулу распаковки:
+// чтение архива и распаковка идут одновременно, сжатые данные на диск не попадают.
+// Без пула (numThreads == 0) всё распаковывается в читающем потоке. С processes задача потока
+// только пересылает сжатые байты рабочему процессу и ждёт его ответа. Распакованное пишет на диск
+// отдельный поток отложенной записи, так что распаковка не ждёт диска, пока не заполнится его очередь
+class Extractor
+{
+public:
+	// filter — какие члены распаковывать; остальные пропускаются по заголовку, не распаковываясь
+	Extractor(std::string outputFolder, int numThreads, size_t window = DEFAULT_WINDOW_SIZE, ProcessPool* processes = nullptr,
+		MemberFilter filter = {})
+		: m_outputFolder(std::move(outputFolder))
+		, m_filter(std::move(filter))
+		, m_window(window)
+		, m_budget(window)
+		, m_processes(processes)
+	{
+		if (numThreads > 0)
+		{
+			m_pool = std::make_unique<ThreadPool>(numThreads);
+		}
+	}
+
+	void Run(int archiveFd)
+	{
+		TarReader reader(archiveFd, &m_bytesRead);
+		while (auto entry = reader.Next())
+		{
+			ExtractMember(reader, *entry);
+		}
+		for (auto& result: m_results)
+		{
+			result.get();
+		}
+		m_results.clear();
+		m_writeBehind.Finish();
+	}
+
+	// Пул распаковки; nullptr, если всё идёт в читающем потоке
+	[[nodiscard]] ThreadPool* GetPool() const noexcept
+	{
+		return m_pool.get();
+	}
+
+	// Сколько байтов архива уже прочитано; можно звать из другого потока, пока идёт Run
+	[[nodiscard]] uint64_t GetBytesRead() const noexcept
+	{
+		return m_bytesRead.load(std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] size_t GetMemberCount() const noexcept
+	{
+		return m_memberCount;
+	}
+
+private:
+	void ExtractMember(TarReader& reader, const TarEntry& entry)
+	{
+		if (entry.type == '5')
+		{
+			if (m_filter.Matches(entry.name))
+			{
+				fs::create_directories(MakeOutputPath(m_outputFolder, entry.name));
+			}
+			return;
+		}
+		if (!entry.IsRegularFile())
+		{
+			return;
+		}
+
+		const std::string name = GetOutputName(entry.name);
+		const bool selected = m_filter.Matches(name);
+		if (entry.name.ends_with(CHUNKED_SUFFIX))
+		{
+			// Литералы невыбранного члена могут понадобиться ссылкам выбранных, поэтому его записи всё равно разбираем
+			m_memberCount += selected;
+			ExtractChunked(reader, entry, selected ? std::optional(MakeOutputPath(m_outputFolder, name)) : std::nullopt);
+			return;
+		}
+		// Данные пропущенного члена TarReader перепрыгнет на следующем Next
+		if (!selected)
+		{
+			return;
+		}
+		++m_memberCount;
+
+		// Кодек — по суффиксу имени; член без суффикса известного кодека хранится как есть
+		const Codec& codec = GetCodecForMember(entry.name);
+		const fs::path outputPath = MakeOutputPath(m_outputFolder, name);
+
+		if (codec.GetId() == CodecId::Store || !m_pool)
+		{
+			const auto expectedSize = codec.GetId() == CodecId::Store ? std::optional(entry.size) : std::nullopt;
+			OutputFile out(outputPath, entry.mode, entry.mtime, expectedSize, &m_writeBehind);
+			StreamMember(reader, {}, codec, out);
+			out.Close();
+			return;
+		}
+
+		// По заголовку первого gzip-члена видно, записан ли файл самостоятельными блоками
+		std::vector<char> head;
+		if (codec.GetId() == CodecId::Gzip)
+		{
+			head.resize(static_cast<size_t>(std::min<uint64_t>(GZIP_BLOCK_PEEK_SIZE, entry.size)));
+			reader.Read(head.data(), head.size());
+			const auto blockSize = ReadGzipBlockSize(head.data(), head.size());
+			if (blockSize && *blockSize < entry.size)
+			{
+				ExtractBlocks(reader, entry, std::move(head), outputPath);
+				return;
+			}
+		}
+
+		// Один поток делить не на что. Член больше окна целиком в память не берём — распаковываем потоково прямо здесь
+		if (entry.size > m_window)
+		{
+			OutputFile out(outputPath, entry.mode, entry.mtime, std::nullopt, &m_writeBehind);
+			StreamMember(reader, head, codec, out);
+			out.Close();
+			return;
+		}
+
+		const auto size = static_cast<size_t>(entry.size);
+		m_budget.Acquire(size);
+		const size_t headSize = head.size();
+		auto data = std::make_shared<std::vector<char>>(std::move(head));
+		data->resize(size);
+		reader.Read(data->data() + headSize, size - headSize);
+		m_results.push_back(m_pool->Submit([this, &codec, data, outputPath, entry] {
+			BudgetRelease release{ m_budget, data->size() };
+			if (!m_processes)
+			{
+				DecodeMemberToFile(codec, *data, outputPath, entry.mode, entry.mtime, &m_writeBehind);
+				return;
+			}
+			ByteWriter job;
+			job.Put<uint8_t>(JOB_DECODE_MEMBER);
+			PutPath(job, outputPath);
+			job.Put<uint8_t>(static_cast<uint8_t>(codec.GetId()));
+			job.Put<uint32_t>(entry.mode);
+			job.Put<int64_t>(entry.mtime);
+			job.Put<uint64_t>(data->size());
+			job.PutBytes(data->data(), data->size());
+			m_processes->Submit(std::move(job.Bytes())).get();
+		}));
+	}
+
+	// Файл из самостоятельных gzip-членов: каждый член распаковывается отдельной задачей прямо на своё место
+	// в выходном файле. Место известно до распаковки — это сумма ISIZE предыдущих членов
+	void ExtractBlocks(TarReader& reader, const TarEntry& entry, std::vector<char> head, const fs::path& outputPath)
+	{
+		auto output = std::make_shared<SegmentedOutput>(outputPath, entry.mode, entry.mtime, &m_writeBehind);
+		uint64_t remaining = entry.size - head.size();
+		uint64_t outputOffset = 0;
+		while (!head.empty())
+		{
+			// Член без подполя PB (например, дописанный обычным gzip) забирает весь остаток файла
+			const auto blockSize = ReadGzipBlockSize(head.data(), head.size());
+			const uint64_t memberSize = blockSize ? *blockSize : head.size() + remaining;
+			if (memberSize < head.size() + GZIP_TRAILER_SIZE || memberSize > head.size() + remaining)
+			{
+				throw std::runtime_error("Corrupted gzip block: " + outputPath.string());
+			}
+
+			m_budget.Acquire(memberSize);
+			const size_t headSize = head.size();
+			auto member = std::make_shared<std::vector<char>>(std::move(head));
+			member->resize(memberSize);
+			reader.Read(member->data() + headSize, memberSize - headSize);
+			remaining -= memberSize - headSize;
+
+			const std::optional<uint32_t> rawSize = blockSize ? std::optional(ReadGzipMemberRawSize(*member)) : std::nullopt;
+			const uint64_t offset = outputOffset;
+			outputOffset += rawSize.value_or(0);
+			output->AddSegment();
+			m_results.push_back(m_pool->Submit([this, output, member, offset, rawSize] {
+				BudgetRelease release{ m_budget, member->size() };
+				if (m_processes)
+				{
+					ByteWriter job;
+					job.Put<uint8_t>(JOB_DECODE_SEGMENT);
+					PutPath(job, output->GetPath());
+					job.Put(offset);
+					job.Put<uint8_t>(rawSize.has_value());
+					job.Put<uint32_t>(rawSize.value_or(0));
+					job.Put<uint64_t>(member->size());
+					job.PutBytes(member->data(), member->size());
+					m_processes->Submit(std::move(job.Bytes())).get();
+				}
+				else
+				{
+					// Куски члена идут подряд, так что смещение каждого уже учтено писателем
+					auto segment = output->OpenSegment(offset, rawSize.value_or(WRITE_BUFFER_SIZE));
+					InflateSegment(*member, offset, rawSize, output->GetPath(),
+						[&](const char* data, size_t size, uint64_t) { segment.Write(data, size); });
+					segment.Flush();
+				}
+				if (output->CompleteSegment())
+				{
+					output->Close();
+				}
+			}));
+
+			head.resize(static_cast<size_t>(std::min<uint64_t>(GZIP_BLOCK_PEEK_SIZE, remaining)));
+			reader.Read(head.data(), head.size());
+			remaining -= head.size();
+		}
+		if (output->Seal())
+		{
+			output->Close();
+		}
+	}
+
+	// Дедуплицированный член: литералы распаковываются задачами пула прямо на своё место в выходном файле,
+	// ссылка берёт уже распакованный литерал из кеша. В кеше литерал живёт, пока на него остаются ссылки.
+	// Литерал, не поместившийся в окно кеша, в памяти не держится: его ссылки дочитывают байты из выходного
+	// файла, куда литерал уже записан. Архив при этом перечитывать не нужно, так что он может идти из трубы.
+	// Без outputPath член не выбран: распаковываются только литералы, на которые есть ссылки, и они остаются
+	// в кеше — вытеснять их некуда, файла у члена не будет. Чанки мелкие, поэтому их распаковка не уходит
+	// в рабочие процессы даже с --isolate
+	void ExtractChunked(TarReader& reader, const TarEntry& entry, const std::optional<fs::path>& outputPath)
+	{
+		const std::string memberName = outputPath ? outputPath->string() : entry.name;
+		char magic[sizeof(CHUNKED_MAGIC)];
+		if (reader.Read(magic, sizeof(magic)) != sizeof(magic) || std::memcmp(magic, CHUNKED_MAGIC, sizeof(magic)) != 0)
+		{
+			throw std::runtime_error("Corrupted chunked member: " + memberName);
+		}
+
+		std::shared_ptr<SegmentedOutput> output;
+		if (outputPath)
+		{
+			output = std::make_shared<SegmentedOutput>(*outputPath, entry.mode, entry.mtime, &m_writeBehind);
+		}
+		uint64_t outputOffset = 0;
+		while (true)
+		{
+			const uint64_t recordOffset = reader.GetOffset();
+			std::vector<char> header(1);
+			if (reader.Read(header.data(), 1) == 0)
+			{
+				break;
+			}
+			header.resize(GetChunkRecordSize(static_cast<uint8_t>(header[0])));
+			ReadRecordBytes(reader, header.data() + 1, header.size() - 1, memberName);
+			const ChunkRecord record = ParseChunkRecord(header);
+			const uint64_t offset = outputOffset;
+			outputOffset += record.rawSize;
+			if (output)
+			{
+				output->AddSegment();
+			}
+
+			if (record.type == CHUNK_LITERAL)
+			{
+				if (!output && record.references == 0)
+				{
+					if (reader.Skip(record.storedSize) != record.storedSize)
+					{
+						throw std::runtime_error("Corrupted chunked member: " + memberName);
+					}
+					continue;
+				}
+				m_budget.Acquire(record.storedSize);
+				auto stored = std::make_shared<std::vector<char>>(record.storedSize);
+				ReadRecordBytes(reader, stored->data(), stored->size(), memberName);
+				auto decoded = std::make_shared<std::promise<SharedChunk>>();
+				const bool spilled = output && m_cachedBytes + record.rawSize > m_window;
+				if (record.references > 0)
+				{
+					m_chunkCache[recordOffset] = { decoded->get_future().share(), record.crc, record.references,
+						spilled ? 0 : record.rawSize, outputPath.value_or(fs::path()), offset };
+					m_cachedBytes += spilled ? 0 : record.rawSize;
+				}
+				RunTask([this, output, stored, decoded, record, offset, spilled, memberName] {
+					BudgetRelease release{ m_budget, stored->size() };
+					try
+					{
+						auto chunk = std::make_shared<const std::vector<char>>(
+							DecodeChunk(record, stored->data(), stored->size(), memberName));
+						// Вытесненный литерал ссылки прочитают из файла, поэтому он пишется сразу, мимо отложенной записи,
+						// и готов только после неё
+						if (!spilled)
+						{
+							decoded->set_value(chunk);
+						}
+						if (output)
+						{
+							WriteSegment(*output, *chunk, offset, spilled);
+						}
+						if (spilled)
+						{
+							decoded->set_value(nullptr);
+						}
+					}
+					catch (...)
+					{
+						decoded->set_exception(std::current_exception());
+						throw;
+					}
+				});
+				continue;
+			}
+
+			const auto cached = m_chunkCache.find(record.target);
+			if (cached == m_chunkCache.end() || cached->second.crc != record.crc)
+			{
+				throw std::runtime_error("Dangling chunk reference: " + memberName);
+			}
+			const CachedChunk source = cached->second;
+			if (--cached->second.remaining == 0)
+			{
+				m_cachedBytes -= cached->second.cachedSize;
+				m_chunkCache.erase(cached);
+			}
+			if (!output)
+			{
+				continue;
+			}
+			// Литерал распаковывает задача, поставленная раньше, так что она уже выполняется или готова
+			RunTask([output, source, record, offset] {
+				SharedChunk data = source.chunk.get();
+				if (!data)
+				{
+					data = ReadBackChunk(source.path, source.offset, record.rawSize);
+				}
+				if (data->size() != record.rawSize || (source.cachedSize == 0 && Crc32(0, data->data(), data->size()) != record.crc))
+				{
+					throw std::runtime_error("Corrupted chunk: " + output->GetPath().string());
+				}
+				WriteSegment(*output, *data, offset);
+			});
+		}
+		if (output && output->Seal())
+		{
+			output->Close();
+		}
+	}
+
+	static void ReadRecordBytes(TarReader& reader, char* data, size_t size, const std::string& memberName)
+	{
+		if (reader.Read(data, size) != size)
+		{
+			throw std::runtime_error("Corrupted chunked member: " + memberName);
+		}
+	}
+
+	// Вытесненный литерал уже лежит в выходном файле своего члена
+	static std::shared_ptr<const std::vector<char>> ReadBackChunk(const fs::path& path, uint64_t offset, uint32_t size)
+	{
+		const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			throw std::runtime_error("Failed to read back chunk: " + path.string());
+		}
+		auto data = std::make_shared<std::vector<char>>(size);
+		try
+		{
+			PreadExact(fd, data->data(), data->size(), offset);
+		}
+		catch (...)
+		{
+			close(fd);
+			throw;
+		}
+		close(fd);
+		return data;
+	}
+
+	static void WriteSegment(SegmentedOutput& output, const std::vector<char>& data, uint64_t offset, bool immediate = false)
+	{
+		if (immediate)
+		{
+			output.WriteAt(data.data(), data.size(), offset);
+		}
+		else
+		{
+			auto segment = output.OpenSegment(offset, data.size());
+			segment.Write(data.data(), data.size());
+			segment.Flush();
+		}
+		if (output.CompleteSegment())
+		{
+			output.Close();
+		}
+	}
+
+	// Без пула задача выполняется сразу в читающем потоке
+	void RunTask(std::function<void()> task)
+	{
+		if (m_pool)
+		{
+			m_results.push_back(m_pool->Submit(std::move(task)));
+		}
+		else
+		{
+			task();
+		}
+	}
+
+	static void PutPath(ByteWriter& job, const fs::path& path)
+	{
+		const std::string& value = path.native();
+		job.Put<uint32_t>(static_cast<uint32_t>(value.size()));
+		job.PutBytes(value.data(), value.size());
+	}
+
+	// head — уже прочитанное начало члена
+	static void StreamMember(TarReader& reader, const std::vector<char>& head, const Codec& codec, OutputFile& out)
+	{
+		const auto decoder = codec.MakeDecoder();
+		auto consume = [&](const char* data, size_t size) {
+			decoder->Decode(data, size, [&](const char* chunk, size_t chunkSize) { out.Write(chunk, chunkSize); });
+		};
+
+		consume(head.data(), head.size());
+		std::vector<char> buffer(GZIP_IO_BUFFER_SIZE);
+		while (const size_t size = reader.Read(buffer.data(), buffer.size()))
+		{
+			consume(buffer.data(), size);
+		}
+		if (!decoder->Finished())
+		{
+			throw std::runtime_error("Truncated compressed data: " + out.GetPath().string());
+		}
+	}
+
+	std::string m_outputFolder;
+	MemberFilter m_filter;
+	size_t m_window;
+	MemoryBudget m_budget;
+	ProcessPool* m_processes;
+	// Пул объявлен позже, поэтому разрушается раньше: его задачи ещё могут ставить записи в очередь
+	WriteBehind m_writeBehind;
+	std::unique_ptr<ThreadPool> m_pool;
+	std::atomic<uint64_t> m_bytesRead = 0;
+	using SharedChunk = std::shared_ptr<const std::vector<char>>;
+
+	// Распакованный литерал, на который в архиве ещё остались ссылки; ключ — смещение его записи.
+	// У вытесненного литерала (cachedSize == 0) future несёт nullptr, а данные лежат в path по offset
+	struct CachedChunk
+	{
+		std::shared_future<SharedChunk> chunk;
+		uint32_t crc = 0;
+		uint32_t remaining = 0;
+		uint32_t cachedSize = 0;
+		fs::path path;
+		uint64_t offset = 0;
+	};
+
+	std::vector<std::future<void>> m_results;
+	std::unordered_map<uint64_t, CachedChunk> m_chunkCache;
+	uint64_t m_cachedBytes = 0;
+	size_t m_memberCount = 0;
+};
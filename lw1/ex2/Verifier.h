@@ -0,0 +1,409 @@
+#pragma once
+
+#include <zlib.h>
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ArchiveIndex.h"
+#include "Chunking.h"
+#include "Codec.h"
+#include "Crc32.h"
+#include "Extractor.h"
+#include "Tar.h"
+#include "ThreadPool.h"
+
+constexpr size_t VERIFY_PART_SIZE = 4 * 1024 * 1024;
+
+// Проверка архива без записи на диск (-V). Члены разбираются так же, как при распаковке, и раздаются пулу,
+// но распакованные данные сразу выбрасываются: от них остаются только CRC32 и размер. Трейлеры кодеков
+// проверяет сам распаковщик, а CRC32 и размер файла целиком сверяются с оглавлением, если оно есть
+class Verifier
+{
+public:
+	explicit Verifier(int numThreads, size_t window = DEFAULT_WINDOW_SIZE)
+		: m_window(window)
+		, m_budget(window)
+	{
+		if (numThreads > 0)
+		{
+			m_pool = std::make_unique<ThreadPool>(numThreads);
+		}
+	}
+
+	// index может быть nullptr — тогда проверяются только данные кодеков
+	void Run(int archiveFd, const ArchiveIndex* index)
+	{
+		TarReader reader(archiveFd, &m_bytesRead);
+		while (auto entry = reader.Next())
+		{
+			VerifyMember(reader, *entry, index);
+		}
+		m_archiveBytes = reader.GetOffset();
+		for (auto& member: m_members)
+		{
+			FinishMember(member);
+		}
+		m_members.clear();
+	}
+
+	// Пул распаковки; nullptr, если всё идёт в читающем потоке
+	[[nodiscard]] ThreadPool* GetPool() const noexcept
+	{
+		return m_pool.get();
+	}
+
+	// Сколько байтов архива уже прочитано; можно звать из другого потока, пока идёт Run
+	[[nodiscard]] uint64_t GetBytesRead() const noexcept
+	{
+		return m_bytesRead.load(std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] size_t GetMemberCount() const noexcept
+	{
+		return m_memberCount;
+	}
+
+	// "имя: причина" для каждого испорченного члена
+	[[nodiscard]] const std::vector<std::string>& GetProblems() const noexcept
+	{
+		return m_problems;
+	}
+
+	// Сколько байтов проверено после распаковки
+	[[nodiscard]] uint64_t GetVerifiedBytes() const noexcept
+	{
+		return m_verifiedBytes;
+	}
+
+	[[nodiscard]] uint64_t GetArchiveBytes() const noexcept
+	{
+		return m_archiveBytes;
+	}
+
+private:
+	// CRC32 и размер куска файла; куски члена склеиваются по порядку через crc32_combine
+	struct Part
+	{
+		uint32_t crc = 0;
+		uint64_t size = 0;
+	};
+
+	struct MemberCheck
+	{
+		std::string name;
+		const IndexEntry* expected = nullptr;
+		std::vector<std::future<Part>> parts;
+	};
+
+	void VerifyMember(TarReader& reader, const TarEntry& entry, const ArchiveIndex* index)
+	{
+		if (!entry.IsRegularFile())
+		{
+			return;
+		}
+		++m_memberCount;
+
+		// С оглавлением кодек берётся из записи члена; по суффиксу имени — только у архива без оглавления
+		MemberCheck member;
+		member.expected = index ? FindMemberEntry(*index, entry.name) : nullptr;
+		if (index && !member.expected)
+		{
+			m_problems.push_back(entry.name + ": member is not in the archive index");
+			return;
+		}
+		const bool chunked = member.expected ? member.expected->codec == CHUNKED_MEMBER_CODEC : entry.name.ends_with(CHUNKED_SUFFIX);
+		const Codec& codec = member.expected && !chunked ? GetCodec(static_cast<CodecId>(member.expected->codec))
+														 : GetCodecForMember(entry.name);
+		if (member.expected)
+		{
+			member.name = member.expected->name;
+		}
+		else
+		{
+			member.name = chunked ? entry.name.substr(0, entry.name.size() - std::strlen(CHUNKED_SUFFIX)) : StripCodecSuffix(entry.name);
+		}
+		try
+		{
+			if (chunked)
+			{
+				VerifyChunks(reader, member);
+			}
+			else if (codec.GetId() == CodecId::Store)
+			{
+				VerifyStored(reader, entry, member);
+			}
+			else
+			{
+				VerifyEncoded(reader, entry, codec, member);
+			}
+		}
+		catch (const std::exception& e)
+		{
+			// Остаток члена пропустит следующий Next
+			m_problems.push_back(member.name + ": " + e.what());
+			return;
+		}
+		m_members.push_back(std::move(member));
+	}
+
+	void FinishMember(MemberCheck& member)
+	{
+		Part total;
+		try
+		{
+			for (auto& result: member.parts)
+			{
+				const Part part = result.get();
+				total.crc = static_cast<uint32_t>(crc32_combine(total.crc, part.crc, static_cast<z_off_t>(part.size)));
+				total.size += part.size;
+			}
+		}
+		catch (const std::exception& e)
+		{
+			m_problems.push_back(member.name + ": " + e.what());
+			return;
+		}
+		m_verifiedBytes += total.size;
+		if (member.expected && (total.crc != member.expected->crc || total.size != member.expected->rawSize))
+		{
+			m_problems.push_back(member.name + ": CRC32 or size does not match the index");
+		}
+	}
+
+	// Хранимый без сжатия член режется на куски, чтобы CRC большого файла считали несколько потоков
+	void VerifyStored(TarReader& reader, const TarEntry& entry, MemberCheck& member)
+	{
+		for (uint64_t remaining = entry.size; remaining > 0;)
+		{
+			const auto size = static_cast<size_t>(std::min<uint64_t>(remaining, VERIFY_PART_SIZE));
+			m_budget.Acquire(size);
+			auto data = std::make_shared<std::vector<char>>(size);
+			reader.Read(data->data(), size);
+			remaining -= size;
+			member.parts.push_back(Submit([this, data] {
+				BudgetRelease release{ m_budget, data->size() };
+				return Part{ Crc32(0, data->data(), data->size()), data->size() };
+			}));
+		}
+	}
+
+	void VerifyEncoded(TarReader& reader, const TarEntry& entry, const Codec& codec, MemberCheck& member)
+	{
+		std::vector<char> head;
+		if (codec.GetId() == CodecId::Gzip)
+		{
+			head.resize(static_cast<size_t>(std::min<uint64_t>(GZIP_BLOCK_PEEK_SIZE, entry.size)));
+			reader.Read(head.data(), head.size());
+			const auto blockSize = ReadGzipBlockSize(head.data(), head.size());
+			if (blockSize && *blockSize < entry.size)
+			{
+				VerifyBlocks(reader, entry, std::move(head), member);
+				return;
+			}
+		}
+
+		if (!m_pool || entry.size > m_window)
+		{
+			member.parts.push_back(MakeReady(StreamPart(reader, head, codec)));
+			return;
+		}
+
+		const auto size = static_cast<size_t>(entry.size);
+		m_budget.Acquire(size);
+		const size_t headSize = head.size();
+		auto data = std::make_shared<std::vector<char>>(std::move(head));
+		data->resize(size);
+		reader.Read(data->data() + headSize, size - headSize);
+		member.parts.push_back(Submit([this, &codec, data] {
+			BudgetRelease release{ m_budget, data->size() };
+			return DecodePart(codec, data->data(), data->size());
+		}));
+	}
+
+	// Самостоятельные gzip-члены проверяются независимо, как и распаковываются
+	void VerifyBlocks(TarReader& reader, const TarEntry& entry, std::vector<char> head, MemberCheck& member)
+	{
+		uint64_t remaining = entry.size - head.size();
+		while (!head.empty())
+		{
+			const auto blockSize = ReadGzipBlockSize(head.data(), head.size());
+			const uint64_t memberSize = blockSize ? *blockSize : head.size() + remaining;
+			if (memberSize < head.size() + GZIP_TRAILER_SIZE || memberSize > head.size() + remaining)
+			{
+				throw std::runtime_error("Corrupted gzip block");
+			}
+
+			m_budget.Acquire(memberSize);
+			const size_t headSize = head.size();
+			auto block = std::make_shared<std::vector<char>>(std::move(head));
+			block->resize(memberSize);
+			reader.Read(block->data() + headSize, memberSize - headSize);
+			remaining -= memberSize - headSize;
+			member.parts.push_back(Submit([this, block] {
+				BudgetRelease release{ m_budget, block->size() };
+				return DecodePart(GetCodec(CodecId::Gzip), block->data(), block->size());
+			}));
+
+			head.resize(static_cast<size_t>(std::min<uint64_t>(GZIP_BLOCK_PEEK_SIZE, remaining)));
+			reader.Read(head.data(), head.size());
+			remaining -= head.size();
+		}
+	}
+
+	// Литерал распаковывается и сверяется со своим CRC32 один раз; ссылке достаточно того,
+	// что её литерал уже встречался с тем же CRC32
+	void VerifyChunks(TarReader& reader, MemberCheck& member)
+	{
+		char magic[sizeof(CHUNKED_MAGIC)];
+		if (reader.Read(magic, sizeof(magic)) != sizeof(magic) || std::memcmp(magic, CHUNKED_MAGIC, sizeof(magic)) != 0)
+		{
+			throw std::runtime_error("Corrupted chunked member");
+		}
+
+		while (true)
+		{
+			const uint64_t recordOffset = reader.GetOffset();
+			std::vector<char> header(1);
+			if (reader.Read(header.data(), 1) == 0)
+			{
+				return;
+			}
+			header.resize(GetChunkRecordSize(static_cast<uint8_t>(header[0])));
+			if (reader.Read(header.data() + 1, header.size() - 1) != header.size() - 1)
+			{
+				throw std::runtime_error("Corrupted chunked member");
+			}
+			const ChunkRecord record = ParseChunkRecord(header);
+
+			if (record.type == CHUNK_REFERENCE)
+			{
+				const auto literal = m_literals.find(record.target);
+				if (literal == m_literals.end() || literal->second.crc != record.crc)
+				{
+					throw std::runtime_error("Dangling chunk reference");
+				}
+				if (--literal->second.remaining == 0)
+				{
+					m_literals.erase(literal);
+				}
+				member.parts.push_back(MakeReady({ record.crc, record.rawSize }));
+				continue;
+			}
+
+			if (record.references > 0)
+			{
+				m_literals[recordOffset] = { record.crc, record.references };
+			}
+			m_budget.Acquire(record.storedSize);
+			auto stored = std::make_shared<std::vector<char>>(record.storedSize);
+			if (reader.Read(stored->data(), stored->size()) != stored->size())
+			{
+				m_budget.Release(record.storedSize);
+				throw std::runtime_error("Corrupted chunked member");
+			}
+			member.parts.push_back(Submit([this, stored, record, name = member.name] {
+				BudgetRelease release{ m_budget, stored->size() };
+				DecodeChunk(record, stored->data(), stored->size(), name);
+				return Part{ record.crc, record.rawSize };
+			}));
+		}
+	}
+
+	// Распаковывает в никуда: от данных остаются только CRC32 и размер
+	static Part DecodePart(const Codec& codec, const char* data, size_t size)
+	{
+		Part part;
+		const auto decoder = codec.MakeDecoder();
+		ConsumePart(*decoder, data, size, part);
+		return FinishPart(*decoder, part);
+	}
+
+	// head — уже прочитанное начало члена
+	static Part StreamPart(TarReader& reader, const std::vector<char>& head, const Codec& codec)
+	{
+		Part part;
+		const auto decoder = codec.MakeDecoder();
+		ConsumePart(*decoder, head.data(), head.size(), part);
+		std::vector<char> buffer(GZIP_IO_BUFFER_SIZE);
+		while (const size_t size = reader.Read(buffer.data(), buffer.size()))
+		{
+			ConsumePart(*decoder, buffer.data(), size, part);
+		}
+		return FinishPart(*decoder, part);
+	}
+
+	// CRC32 распакованного считаем сами, только если кодек не посчитал его уже (gzip сверяет его с трейлером)
+	static void ConsumePart(StreamDecoder& decoder, const char* data, size_t size, Part& part)
+	{
+		const bool ownCrc = !decoder.GetCheckedCrc();
+		decoder.Decode(data, size, [&](const char* chunk, size_t chunkSize) {
+			if (ownCrc)
+			{
+				part.crc = Crc32(part.crc, chunk, chunkSize);
+			}
+			part.size += chunkSize;
+		});
+	}
+
+	static Part FinishPart(const StreamDecoder& decoder, Part part)
+	{
+		if (!decoder.Finished())
+		{
+			throw std::runtime_error("Truncated compressed data");
+		}
+		if (const auto crc = decoder.GetCheckedCrc())
+		{
+			part.crc = *crc;
+		}
+		return part;
+	}
+
+	static std::future<Part> MakeReady(Part part)
+	{
+		std::promise<Part> ready;
+		ready.set_value(part);
+		return ready.get_future();
+	}
+
+	// Без пула кусок проверяется сразу в читающем потоке; ошибка остаётся в future, как у задачи пула
+	template <typename Task>
+	std::future<Part> Submit(Task&& task)
+	{
+		if (m_pool)
+		{
+			return m_pool->Submit(std::forward<Task>(task));
+		}
+		std::promise<Part> result;
+		try
+		{
+			result.set_value(task());
+		}
+		catch (...)
+		{
+			result.set_exception(std::current_exception());
+		}
+		return result.get_future();
+	}
+
+	// Литерал, на который в архиве ещё остались ссылки; ключ — смещение его записи
+	struct LiteralCheck
+	{
+		uint32_t crc = 0;
+		uint32_t remaining = 0;
+	};
+
+	size_t m_window;
+	MemoryBudget m_budget;
+	std::unique_ptr<ThreadPool> m_pool;
+	std::atomic<uint64_t> m_bytesRead = 0;
+	std::vector<MemberCheck> m_members;
+	std::unordered_map<uint64_t, LiteralCheck> m_literals;
+	std::vector<std::string> m_problems;
+	size_t m_memberCount = 0;
+	uint64_t m_verifiedBytes = 0;
+	uint64_t m_archiveBytes = 0;
+};
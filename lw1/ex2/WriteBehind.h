@@ -0,0 +1,399 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fcntl.h>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Распакованные данные копятся в больших буферах, выровненных по странице, и уходят на диск одним pwrite.
+// Буферы, отданные на запись, вместе не больше WRITE_BEHIND_CAPACITY: если диск не успевает, распаковщик ждёт
+constexpr size_t WRITE_BUFFER_SIZE = 1024 * 1024;
+constexpr size_t WRITE_BUFFER_ALIGNMENT = 4096;
+constexpr size_t WRITE_BEHIND_CAPACITY = 64 * 1024 * 1024;
+
+inline void RestoreFileAttributes(const fs::path& path, unsigned mode, int64_t mtime)
+{
+	chmod(path.c_str(), mode & 07777);
+	const timespec times[2] = { { 0, UTIME_OMIT }, { static_cast<time_t>(mtime), 0 } };
+	utimensat(AT_FDCWD, path.c_str(), times, 0);
+}
+
+inline void PwriteExact(int fd, const char* data, size_t size, uint64_t offset, const fs::path& path)
+{
+	while (size > 0)
+	{
+		const ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+		if (written <= 0)
+		{
+			throw std::runtime_error("Failed to write file: " + path.string());
+		}
+		data += written;
+		size -= static_cast<size_t>(written);
+		offset += static_cast<uint64_t>(written);
+	}
+}
+
+class WriteBuffer
+{
+public:
+	// Ёмкость округляется вверх до целых страниц
+	explicit WriteBuffer(size_t capacity = WRITE_BUFFER_SIZE)
+		: m_capacity((std::max<size_t>(capacity, 1) + WRITE_BUFFER_ALIGNMENT - 1) / WRITE_BUFFER_ALIGNMENT * WRITE_BUFFER_ALIGNMENT)
+		, m_data(static_cast<char*>(std::aligned_alloc(WRITE_BUFFER_ALIGNMENT, m_capacity)))
+	{
+		if (!m_data)
+		{
+			throw std::bad_alloc();
+		}
+	}
+
+	// Берёт сколько влезет и возвращает, сколько взято
+	size_t Append(const char* data, size_t size)
+	{
+		const size_t taken = std::min(size, m_capacity - m_size);
+		std::memcpy(m_data.get() + m_size, data, taken);
+		m_size += taken;
+		return taken;
+	}
+
+	void Clear() noexcept
+	{
+		m_size = 0;
+	}
+
+	[[nodiscard]] bool IsFull() const noexcept
+	{
+		return m_size == m_capacity;
+	}
+
+	[[nodiscard]] const char* GetData() const noexcept
+	{
+		return m_data.get();
+	}
+
+	[[nodiscard]] size_t GetSize() const noexcept
+	{
+		return m_size;
+	}
+
+	[[nodiscard]] size_t GetCapacity() const noexcept
+	{
+		return m_capacity;
+	}
+
+private:
+	struct Free
+	{
+		void operator()(char* data) const noexcept { std::free(data); }
+	};
+
+	size_t m_capacity;
+	std::unique_ptr<char, Free> m_data;
+	size_t m_size = 0;
+};
+
+// Открытый выходной файл; при закрытии получает права и время модификации из архива, как после tar -x.
+// Закрыть его может поток отложенной записи, уже после распаковщика, поэтому владеют им через shared_ptr
+class OutputHandle
+{
+public:
+	OutputHandle(fs::path path, unsigned mode, int64_t mtime)
+		: m_path(std::move(path))
+		, m_mode(mode)
+		, m_mtime(mtime)
+		, m_fd(open(m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+	{
+		if (m_fd < 0)
+		{
+			throw std::runtime_error("Failed to create file: " + m_path.string());
+		}
+	}
+
+	OutputHandle(const OutputHandle&) = delete;
+	OutputHandle& operator=(const OutputHandle&) = delete;
+
+	~OutputHandle()
+	{
+		if (m_fd >= 0)
+		{
+			close(m_fd);
+		}
+	}
+
+	// Место под файл известного размера выделяется сразу, одним куском, а не по мере записи — так файл
+	// не дробится на ext4 и xfs. Файловая система может не уметь этого, тогда просто пишем как есть
+	void Preallocate(uint64_t size)
+	{
+		if (size > 0 && posix_fallocate(m_fd, 0, static_cast<off_t>(size)) == 0)
+		{
+			m_preallocated = size;
+		}
+	}
+
+	// Подсказка о размере оказалась больше настоящего — лишний хвост отрезаем
+	void Trim(uint64_t size)
+	{
+		if (m_preallocated > size && ftruncate(m_fd, static_cast<off_t>(size)) != 0)
+		{
+			throw std::runtime_error("Failed to write file: " + m_path.string());
+		}
+	}
+
+	void WriteAt(const char* data, size_t size, uint64_t offset)
+	{
+		PwriteExact(m_fd, data, size, offset, m_path);
+	}
+
+	void Close()
+	{
+		const int result = close(m_fd);
+		m_fd = -1;
+		if (result != 0)
+		{
+			throw std::runtime_error("Failed to write file: " + m_path.string());
+		}
+		RestoreFileAttributes(m_path, m_mode, m_mtime);
+	}
+
+	[[nodiscard]] const fs::path& GetPath() const noexcept
+	{
+		return m_path;
+	}
+
+private:
+	fs::path m_path;
+	unsigned m_mode;
+	int64_t m_mtime;
+	int m_fd;
+	uint64_t m_preallocated = 0;
+};
+
+// Отложенная запись: распаковщик отдаёт заполненный буфер и сразу возвращается к работе, а на диск буферы
+// пишет отдельный поток в порядке поступления. Поэтому закрытие файла, поставленное после его записей,
+// выполнится после них. Ошибка записи всплывает в Finish
+class WriteBehind
+{
+public:
+	explicit WriteBehind(size_t capacity = WRITE_BEHIND_CAPACITY)
+		: m_capacity(capacity)
+		, m_thread([this] { Loop(); })
+	{
+	}
+
+	WriteBehind(const WriteBehind&) = delete;
+	WriteBehind& operator=(const WriteBehind&) = delete;
+
+	// Уже поставленное в очередь дописывается
+	~WriteBehind()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wakeUp.notify_all();
+	}
+
+	// Ждёт, только если очередь уже заполнена; буфер больше всей очереди ждёт, пока она не опустеет
+	void Write(std::shared_ptr<OutputHandle> handle, WriteBuffer buffer, uint64_t offset)
+	{
+		const size_t size = std::min(buffer.GetCapacity(), m_capacity);
+		{
+			std::unique_lock lock(m_mutex);
+			m_released.wait(lock, [&] { return m_used + size <= m_capacity; });
+			m_used += size;
+			m_queue.push_back({ std::move(handle), std::move(buffer), offset });
+		}
+		m_wakeUp.notify_one();
+	}
+
+	// Полноразмерные буферы после записи возвращаются в запас: новый буфер — это mmap и page fault на каждую страницу
+	WriteBuffer TakeBuffer(size_t capacity)
+	{
+		if (capacity >= WRITE_BUFFER_SIZE)
+		{
+			std::lock_guard lock(m_mutex);
+			if (!m_spare.empty())
+			{
+				WriteBuffer buffer = std::move(m_spare.back());
+				m_spare.pop_back();
+				return buffer;
+			}
+		}
+		return WriteBuffer(capacity);
+	}
+
+	void Close(std::shared_ptr<OutputHandle> handle)
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_queue.push_back({ std::move(handle), std::nullopt, 0 });
+		}
+		m_wakeUp.notify_one();
+	}
+
+	// Дожидается записи всего, что уже поставлено в очередь
+	void Finish()
+	{
+		std::unique_lock lock(m_mutex);
+		m_released.wait(lock, [&] { return m_queue.empty() && !m_busy; });
+		if (m_error)
+		{
+			std::rethrow_exception(std::exchange(m_error, nullptr));
+		}
+	}
+
+private:
+	// Без буфера — закрытие файла
+	struct Request
+	{
+		std::shared_ptr<OutputHandle> handle;
+		std::optional<WriteBuffer> buffer;
+		uint64_t offset = 0;
+	};
+
+	void Loop()
+	{
+		while (true)
+		{
+			std::optional<Request> request;
+			bool failed = false;
+			{
+				std::unique_lock lock(m_mutex);
+				m_wakeUp.wait(lock, [&] { return !m_queue.empty() || m_stopping; });
+				if (m_queue.empty())
+				{
+					return;
+				}
+				request = std::move(m_queue.front());
+				m_queue.pop_front();
+				m_busy = true;
+				failed = m_error != nullptr;
+			}
+
+			size_t released = 0;
+			try
+			{
+				// После ошибки только освобождаем буферы: файл всё равно закроет деструктор OutputHandle
+				if (request->buffer)
+				{
+					released = std::min(request->buffer->GetCapacity(), m_capacity);
+					if (!failed)
+					{
+						request->handle->WriteAt(request->buffer->GetData(), request->buffer->GetSize(), request->offset);
+					}
+				}
+				else if (!failed)
+				{
+					request->handle->Close();
+				}
+			}
+			catch (...)
+			{
+				std::lock_guard lock(m_mutex);
+				m_error = std::current_exception();
+			}
+
+			{
+				std::lock_guard lock(m_mutex);
+				if (request->buffer && request->buffer->GetCapacity() == WRITE_BUFFER_SIZE
+					&& (m_spare.size() + 1) * WRITE_BUFFER_SIZE <= m_capacity)
+				{
+					request->buffer->Clear();
+					m_spare.push_back(std::move(*request->buffer));
+				}
+				m_used -= released;
+				m_busy = false;
+			}
+			request.reset();
+			m_released.notify_all();
+		}
+	}
+
+	const size_t m_capacity;
+	size_t m_used = 0;
+	bool m_busy = false;
+	bool m_stopping = false;
+	std::exception_ptr m_error;
+	std::deque<Request> m_queue;
+	std::vector<WriteBuffer> m_spare;
+	std::mutex m_mutex;
+	std::condition_variable m_wakeUp;
+	std::condition_variable m_released;
+	std::jthread m_thread;
+};
+
+// Собирает подряд идущие куски, начиная с offset, в большие буферы. С WriteBehind заполненный буфер уходит
+// в очередь, и распаковщик продолжает; без него буфер пишется сразу и используется снова
+class BufferedWriter
+{
+public:
+	BufferedWriter(std::shared_ptr<OutputHandle> handle, WriteBehind* writer, uint64_t offset = 0,
+		size_t bufferSize = WRITE_BUFFER_SIZE)
+		: m_handle(std::move(handle))
+		, m_writer(writer)
+		, m_offset(offset)
+		, m_bufferSize(std::min(bufferSize, WRITE_BUFFER_SIZE))
+	{
+	}
+
+	void Write(const char* data, size_t size)
+	{
+		while (size > 0)
+		{
+			if (!m_buffer)
+			{
+				m_buffer.emplace(m_writer ? m_writer->TakeBuffer(m_bufferSize) : WriteBuffer(m_bufferSize));
+			}
+			const size_t taken = m_buffer->Append(data, size);
+			data += taken;
+			size -= taken;
+			if (m_buffer->IsFull())
+			{
+				Flush();
+			}
+		}
+	}
+
+	void Flush()
+	{
+		if (!m_buffer || m_buffer->GetSize() == 0)
+		{
+			return;
+		}
+		const uint64_t offset = m_offset;
+		m_offset += m_buffer->GetSize();
+		if (m_writer)
+		{
+			m_writer->Write(m_handle, std::move(*m_buffer), offset);
+			m_buffer.reset();
+		}
+		else
+		{
+			m_handle->WriteAt(m_buffer->GetData(), m_buffer->GetSize(), offset);
+			m_buffer->Clear();
+		}
+	}
+
+private:
+	std::shared_ptr<OutputHandle> m_handle;
+	WriteBehind* m_writer;
+	uint64_t m_offset;
+	size_t m_bufferSize;
+	std::optional<WriteBuffer> m_buffer;
+};
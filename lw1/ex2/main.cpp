@@ -6,139 +6,397 @@
 #include <vector>
 #include <string>
 #include <chrono>
+#include <cerrno>
 #include <cstdlib>
+#include <algorithm>
+#include <future>
+#include <fcntl.h>
 #include <unistd.h>
-#include <sys/wait.h>
+#include <optional>
 #include <stdexcept>
 #include <filesystem>
+#include "ArchiveIndex.h"
+#include "Extraction.h"
+#include "Extractor.h"
+#include "ProcessPool.h"
+#include "Tar.h"
+#include "ThreadPool.h"
+#include "Verifier.h"
+#include "WorkerController.h"
 
 namespace fs = std::filesystem;
 
+// Имя архива "-" — читать его из stdin, например из трубы
+constexpr const char* STDIN_ARCHIVE = "-";
+constexpr size_t DRAIN_BUFFER_SIZE = 64 * 1024;
+
 struct Args
 {
 	std::string mode;
 	int numProcesses = 0;
+	bool autoWorkers = false;
 	std::string archiveName;
 	std::string outputFolder;
+	std::vector<std::string> members;
+	MemberFilter filter;
+	bool isolate = false;
+	bool verify = false;
+	size_t window = DEFAULT_WINDOW_SIZE;
 };
 
-void DecompressFile(const std::string& filename)
+int OpenArchive(const std::string& archiveName)
 {
-	std::string command = "gzip -d " + filename;
-	if (system(command.c_str()))
+	if (archiveName == STDIN_ARCHIVE)
+	{
+		return STDIN_FILENO;
+	}
+	const int fd = open(archiveName.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
 	{
-		throw std::runtime_error("Failed to decompress file: " + filename);
+		throw std::runtime_error("Failed to open archive: " + archiveName);
 	}
+	return fd;
 }
 
-void SequentialMode(const std::string& archiveName, const std::string& outputFolder)
+void CloseArchive(int fd)
 {
-	auto start = std::chrono::high_resolution_clock::now();
+	if (fd != STDIN_FILENO)
+	{
+		close(fd);
+	}
+}
 
-	std::string extractCommand = "tar -xf " + archiveName + " -C " + outputFolder;
-	if (system(extractCommand.c_str()))
+// Распаковщик останавливается на маркере конца tar, а за ним ещё идёт оглавление. Дочитываем stdin,
+// чтобы пишущий в трубу не получил SIGPIPE
+void DrainArchive(int fd)
+{
+	if (fd != STDIN_FILENO)
 	{
-		throw std::runtime_error("Failed to extract files from archive: " + archiveName);
+		return;
 	}
+	std::vector<char> buffer(DRAIN_BUFFER_SIZE);
+	while (true)
+	{
+		const ssize_t readCount = read(fd, buffer.data(), buffer.size());
+		if (readCount == 0 || (readCount < 0 && errno != EINTR))
+		{
+			return;
+		}
+	}
+}
 
-	std::vector<std::string> files;
-	for (const auto& entry: fs::directory_iterator(outputFolder))
+// Члены по оглавлению раздаются пулу все сразу, в порядке их смещений в архиве
+void ExtractIndexedEntries(int fd, std::vector<const IndexEntry*> entries, int numThreads, const std::string& outputFolder)
+{
+	std::sort(entries.begin(), entries.end(), [](const IndexEntry* a, const IndexEntry* b) { return a->offset < b->offset; });
+	ThreadPool pool(std::max(numThreads, 1));
+	std::vector<std::future<void>> results;
+	for (const IndexEntry* entry: entries)
+	{
+		results.push_back(pool.Submit([fd, entry, &outputFolder] { ExtractIndexedMember(fd, *entry, outputFolder); }));
+	}
+	for (auto& result: results)
 	{
-		if (entry.path().extension() == ".gz")
+		result.get();
+	}
+}
+
+// Выборочная распаковка по оглавлению: читаются только байты выбранных членов.
+// false — оглавления нет (труба или архив без него), выбирать придётся по заголовкам tar
+bool ExtractSelectedByIndex(int fd, int numThreads, const Args& args)
+{
+	const auto index = ArchiveIndex::Read(fd);
+	if (!index)
+	{
+		return false;
+	}
+	std::vector<const IndexEntry*> entries;
+	for (const auto& entry: index->GetEntries())
+	{
+		if (args.filter.Matches(entry.name))
 		{
-			files.push_back(entry.path().string());
+			entries.push_back(&entry);
 		}
 	}
+	if (entries.empty())
+	{
+		throw std::runtime_error("No members match --include/--exclude");
+	}
+	ExtractIndexedEntries(fd, std::move(entries), numThreads, args.outputFolder);
+	return true;
+}
 
-	for (const auto& file: files)
+// Архив читается строго подряд, так что годится и труба. В памяти — не больше окна сжатых данных
+// и окна распакованных чанков, ждущих ссылок
+void ExtractArchive(int numThreads, const Args& args)
+{
+	const int fd = OpenArchive(args.archiveName);
+	if (!args.filter.IsEmpty())
 	{
-		DecompressFile(file);
+		try
+		{
+			if (ExtractSelectedByIndex(fd, numThreads, args))
+			{
+				CloseArchive(fd);
+				return;
+			}
+		}
+		catch (...)
+		{
+			CloseArchive(fd);
+			throw;
+		}
 	}
 
+	try
+	{
+		// С --isolate распаковывают рабочие процессы: та же программа, запущенная пулом через exec
+		std::optional<ProcessPool> processes;
+		if (args.isolate && numThreads > 0)
+		{
+			processes.emplace(numThreads);
+		}
+		Extractor extractor(args.outputFolder, numThreads, args.window, processes ? &*processes : nullptr, args.filter);
+		// Скорость работы пула меряется по чтению архива: читающий поток упирается в окно памяти, пока пул не успевает
+		std::optional<WorkerController> controller;
+		if (args.autoWorkers && extractor.GetPool())
+		{
+			controller.emplace(*extractor.GetPool(), [&extractor] { return extractor.GetBytesRead(); });
+		}
+		extractor.Run(fd);
+		DrainArchive(fd);
+		if (!args.filter.IsEmpty() && extractor.GetMemberCount() == 0)
+		{
+			throw std::runtime_error("No members match --include/--exclude");
+		}
+	}
+	catch (...)
+	{
+		CloseArchive(fd);
+		throw;
+	}
+	CloseArchive(fd);
+}
+
+void SequentialMode(const Args& args)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	ExtractArchive(0, args);
+
 	auto end = std::chrono::high_resolution_clock::now();
 	std::chrono::duration<double> elapsed = end - start;
 	std::cout << "Total time: " << elapsed.count() << " seconds\n";
 }
 
-void ParallelMode(int numProcesses, const std::string& archiveName, const std::string& outputFolder)
+void ParallelMode(const Args& args)
 {
 	auto start = std::chrono::high_resolution_clock::now();
 
-	std::string extractCommand = "tar -xf " + archiveName + " -C " + outputFolder;
-	if (system(extractCommand.c_str()))
-	{
-		throw std::runtime_error("Failed to extract files from archive: " + archiveName);
-	}
+	ExtractArchive(args.numProcesses, args);
+
+	auto end = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> elapsed = end - start;
+	std::cout << "Total time: " << elapsed.count() << " seconds\n";
+}
 
-	std::vector<std::string> files;
-	for (const auto& entry: fs::directory_iterator(outputFolder))
+// Достаёт отдельные файлы по оглавлению архива, не читая остальные члены
+void ExtractMembersMode(int numThreads, const std::string& archiveName, const std::string& outputFolder,
+	const std::vector<std::string>& members)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	const int fd = OpenArchive(archiveName);
+	try
 	{
-		if (entry.path().extension() == ".gz")
+		// У трубы оглавления не прочитать: оно в конце, а назад по трубе не вернуться
+		const auto index = ArchiveIndex::Read(fd);
+		if (!index)
 		{
-			files.push_back(entry.path().string());
+			throw std::runtime_error(archiveName == STDIN_ARCHIVE
+				? "--member needs a seekable archive: stdin has no readable index"
+				: "Archive has no index: " + archiveName);
 		}
-	}
 
-	std::vector<pid_t> pids;
-	for (const auto& file: files)
-	{
-		if (pids.size() >= numProcesses)
+		std::vector<const IndexEntry*> entries;
+		for (const auto& member: members)
 		{
-			int status;
-			pid_t finishedPid = waitpid(-1, &status, 0);
-			auto it = std::find(pids.begin(), pids.end(), finishedPid);
-			if (it != pids.end())
+			const IndexEntry* entry = index->Find(StripLeadingSlashes(member));
+			if (!entry)
 			{
-				pids.erase(it);
+				throw std::runtime_error("No such member in archive: " + member);
 			}
+			entries.push_back(entry);
 		}
 
-		pid_t pid = fork();
-		if (pid == 0)
-		{
-			DecompressFile(file);
-			_exit(0);
-		}
-		else if (pid > 0)
+		ExtractIndexedEntries(fd, std::move(entries), numThreads, outputFolder);
+	}
+	catch (...)
+	{
+		CloseArchive(fd);
+		throw;
+	}
+	CloseArchive(fd);
+
+	auto end = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> elapsed = end - start;
+	std::cout << "Total time: " << elapsed.count() << " seconds\n";
+}
+
+// Проверяет архив, ничего не записывая на диск; испорченные члены перечисляются, а их наличие — ошибка
+void VerifyMode(const Args& args)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	const int fd = OpenArchive(args.archiveName);
+	Verifier verifier(args.numProcesses, args.window);
+	try
+	{
+		std::optional<WorkerController> controller;
+		if (args.autoWorkers && verifier.GetPool())
 		{
-			pids.push_back(pid);
+			controller.emplace(*verifier.GetPool(), [&verifier] { return verifier.GetBytesRead(); });
 		}
-		else
+		const auto index = ArchiveIndex::Read(fd);
+		if (!index)
 		{
-			throw std::runtime_error("Failed to fork process");
+			std::cout << "Archive has no index: only codec checksums are verified\n";
 		}
+		verifier.Run(fd, index ? &*index : nullptr);
+		DrainArchive(fd);
 	}
-
-	for (pid_t pid: pids)
+	catch (...)
 	{
-		waitpid(pid, nullptr, 0);
+		CloseArchive(fd);
+		throw;
 	}
+	CloseArchive(fd);
 
 	auto end = std::chrono::high_resolution_clock::now();
 	std::chrono::duration<double> elapsed = end - start;
+	for (const auto& problem: verifier.GetProblems())
+	{
+		std::cerr << "Bad member: " << problem << "\n";
+	}
+	std::cout << "Verified " << verifier.GetMemberCount() << " members, "
+		<< verifier.GetVerifiedBytes() << " bytes (" << verifier.GetArchiveBytes() << " in archive)\n";
 	std::cout << "Total time: " << elapsed.count() << " seconds\n";
+	std::cout << "Throughput: " << static_cast<double>(verifier.GetVerifiedBytes()) / elapsed.count() / 1e9 << " GB/s\n";
+	if (!verifier.GetProblems().empty())
+	{
+		throw std::runtime_error("Archive is corrupted: " + std::to_string(verifier.GetProblems().size()) + " of "
+			+ std::to_string(verifier.GetMemberCount()) + " members failed verification");
+	}
+}
+
+// Размер в байтах, можно с суффиксом K, M или G
+size_t ParseSize(const std::string& value)
+{
+	size_t end = 0;
+	const unsigned long long number = std::stoull(value, &end);
+	const std::string suffix = value.substr(end);
+	unsigned shift = 0;
+	if (suffix == "K" || suffix == "k")
+	{
+		shift = 10;
+	}
+	else if (suffix == "M" || suffix == "m")
+	{
+		shift = 20;
+	}
+	else if (suffix == "G" || suffix == "g")
+	{
+		shift = 30;
+	}
+	else if (!suffix.empty())
+	{
+		throw std::invalid_argument("Invalid size: " + value);
+	}
+	if (number == 0)
+	{
+		throw std::invalid_argument("Size must be positive: " + value);
+	}
+	return static_cast<size_t>(number) << shift;
 }
 
 Args ParseArgs(int argc, char* argv[])
 {
 	Args args;
-	if (argc < 4)
+
+	std::vector<std::string> positional;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg.starts_with("--member="))
+		{
+			args.members.push_back(arg.substr(std::string("--member=").size()));
+		}
+		else if (arg == "--isolate")
+		{
+			args.isolate = true;
+		}
+		else if (arg == "-V")
+		{
+			args.verify = true;
+		}
+		else if (arg.starts_with("--include="))
+		{
+			args.filter.Include(arg.substr(std::string("--include=").size()));
+		}
+		else if (arg.starts_with("--exclude="))
+		{
+			args.filter.Exclude(arg.substr(std::string("--exclude=").size()));
+		}
+		else if (arg.starts_with("--window="))
+		{
+			args.window = ParseSize(arg.substr(std::string("--window=").size()));
+		}
+		else if (arg.starts_with("--"))
+		{
+			throw std::invalid_argument("Unknown option: " + arg);
+		}
+		else
+		{
+			positional.push_back(std::move(arg));
+		}
+	}
+
+	const std::string usage = "Usage: " + std::string(argv[0])
+		+ " [--member=NAME]... [--include=GLOB]... [--exclude=GLOB]... [--isolate] [--window=BYTES]"
+		+ " -S|-P NUM-PROCESSES|auto ARCHIVE-NAME|- OUTPUT-FOLDER\n"
+		+ "   or: " + std::string(argv[0]) + " -V [--window=BYTES] -S|-P NUM-PROCESSES|auto ARCHIVE-NAME|-";
+	if (!args.filter.IsEmpty() && (args.verify || !args.members.empty()))
+	{
+		throw std::invalid_argument("--include/--exclude cannot be combined with -V or --member");
+	}
+
+	// При проверке (-V) выходной папки нет
+	const size_t folderArgs = args.verify ? 0 : 1;
+	if (positional.size() < 2 + folderArgs)
 	{
-		throw std::invalid_argument(
-			"Usage: " + std::string(argv[0]) + " -S|-P NUM-PROCESSES ARCHIVE-NAME OUTPUT-FOLDER");
+		throw std::invalid_argument(usage);
 	}
 
-	args.mode = argv[1];
-	if (args.mode == "-S")
+	args.mode = positional[0];
+	if (args.mode == "-S" && positional.size() == 2 + folderArgs)
 	{
-		args.archiveName = argv[2];
-		args.outputFolder = argv[3];
+		args.archiveName = positional[1];
+		args.outputFolder = args.verify ? std::string() : positional[2];
 	}
-	else if (args.mode == "-P")
+	else if (args.mode == "-P" && positional.size() == 3 + folderArgs)
 	{
-		args.numProcesses = std::stoi(argv[2]);
-		args.archiveName = argv[3];
-		args.outputFolder = argv[4];
+		args.autoWorkers = positional[1] == AUTO_WORKERS;
+		args.numProcesses = args.autoWorkers ? GetMaxAutoWorkers() : std::stoi(positional[1]);
+		if (args.numProcesses <= 0)
+		{
+			throw std::invalid_argument("NUM-PROCESSES must be a positive integer");
+		}
+		args.archiveName = positional[2];
+		args.outputFolder = args.verify ? std::string() : positional[3];
+	}
+	else if (args.mode == "-S" || args.mode == "-P")
+	{
+		throw std::invalid_argument(usage);
 	}
 	else
 	{
@@ -150,22 +408,34 @@ Args ParseArgs(int argc, char* argv[])
 
 int main(int argc, char* argv[])
 {
+	ProcessPool::ServeIfWorker(argc, argv, RunExtractionJob);
 	try
 	{
 		Args args = ParseArgs(argc, argv);
+		if (args.verify)
+		{
+			VerifyMode(args);
+			return 0;
+		}
 
 		if (!fs::exists(args.outputFolder))
 		{
 			fs::create_directory(args.outputFolder);
 		}
 
-		if (args.mode == "-S")
+		if (!args.members.empty())
+		{
+			// Члены по оглавлению раздаются все сразу, подстраивать тут нечего
+			ExtractMembersMode(args.autoWorkers ? GetCoreCount() : args.numProcesses, args.archiveName, args.outputFolder,
+				args.members);
+		}
+		else if (args.mode == "-S")
 		{
-			SequentialMode(args.archiveName, args.outputFolder);
+			SequentialMode(args);
 		}
 		else if (args.mode == "-P")
 		{
-			ParallelMode(args.numProcesses, args.archiveName, args.outputFolder);
+			ParallelMode(args);
 		}
 	}
 	catch (const std::exception& e)
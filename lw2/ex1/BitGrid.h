@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+constexpr int WORD_BITS = 64;
+
+// Поле по 64 клетки в слове, строки лежат подряд: клетка x строки — бит x % 64 слова x / 64.
+// Вокруг поля рамка из копий клеток с противоположного края тора: строки -1 и height, слово -1 каждой строки
+// (клетка width - 1 в старшем бите) и бит сразу за шириной (клетка 0). Тогда у каждого слова поля есть
+// соседи по всем восьми направлениям, и шаг обходится без деления по модулю и проверок края.
+// Рамка верна только после RefreshHalo; остальные биты за шириной поля всегда нулевые
+class BitGrid
+{
+public:
+	BitGrid() = default;
+
+	BitGrid(int width, int height)
+		: m_width(width)
+		, m_height(height)
+		, m_rowWords((width + WORD_BITS - 1) / WORD_BITS)
+		, m_stride(m_rowWords + 2)
+		, m_words(static_cast<size_t>(m_stride) * (height + 2))
+	{
+	}
+
+	[[nodiscard]] bool Get(int x, int y) const
+	{
+		return (Row(y)[x / WORD_BITS] >> (x % WORD_BITS)) & 1;
+	}
+
+	void Set(int x, int y, bool alive)
+	{
+		const uint64_t bit = uint64_t{ 1 } << (x % WORD_BITS);
+		uint64_t& word = Row(y)[x / WORD_BITS];
+		word = alive ? word | bit : word & ~bit;
+	}
+
+	// y от -1 до height включительно; Row(y)[-1] и Row(y)[GetRowWords()] тоже доступны
+	[[nodiscard]] uint64_t* Row(int y)
+	{
+		return m_words.data() + static_cast<size_t>(y + 1) * m_stride + 1;
+	}
+
+	[[nodiscard]] const uint64_t* Row(int y) const
+	{
+		return m_words.data() + static_cast<size_t>(y + 1) * m_stride + 1;
+	}
+
+	// Рамка строки y: клетка width - 1 слева от клетки 0 и клетка 0 справа от клетки width - 1
+	void WrapRow(int y)
+	{
+		uint64_t* row = Row(y);
+		row[-1] = static_cast<uint64_t>(Get(m_width - 1, y)) << (WORD_BITS - 1);
+		const uint64_t bit = uint64_t{ 1 } << (m_width % WORD_BITS);
+		uint64_t& word = row[m_width / WORD_BITS];
+		word = (row[0] & 1) ? word | bit : word & ~bit;
+	}
+
+	// Строки рамки сверху и снизу — копии последней и первой строк вместе с их рамкой,
+	// поэтому вызываются после WrapRow всех строк
+	void WrapRows()
+	{
+		const size_t size = m_stride * sizeof(uint64_t);
+		std::memcpy(Row(-1) - 1, Row(m_height - 1) - 1, size);
+		std::memcpy(Row(m_height) - 1, Row(0) - 1, size);
+	}
+
+	void RefreshHalo()
+	{
+		for (int y = 0; y < m_height; ++y)
+		{
+			WrapRow(y);
+		}
+		WrapRows();
+	}
+
+	[[nodiscard]] int GetWidth() const noexcept
+	{
+		return m_width;
+	}
+
+	[[nodiscard]] int GetHeight() const noexcept
+	{
+		return m_height;
+	}
+
+	// Слов в строке, без рамки
+	[[nodiscard]] int GetRowWords() const noexcept
+	{
+		return m_rowWords;
+	}
+
+	// Клеток в последнем слове строки, от 1 до 64
+	[[nodiscard]] int GetTailBits() const noexcept
+	{
+		return m_width - (m_rowWords - 1) * WORD_BITS;
+	}
+
+	[[nodiscard]] uint64_t GetTailMask() const noexcept
+	{
+		return GetTailBits() == WORD_BITS ? ~uint64_t{ 0 } : (uint64_t{ 1 } << GetTailBits()) - 1;
+	}
+
+	// Все клетки мертвы, рамка тоже
+	void Clear()
+	{
+		std::fill(m_words.begin(), m_words.end(), 0);
+	}
+
+	[[nodiscard]] uint64_t CountAlive() const
+	{
+		uint64_t count = 0;
+		for (int y = 0; y < m_height; ++y)
+		{
+			const uint64_t* row = Row(y);
+			for (int i = 0; i < m_rowWords - 1; ++i)
+			{
+				count += std::popcount(row[i]);
+			}
+			count += std::popcount(row[m_rowWords - 1] & GetTailMask());
+		}
+		return count;
+	}
+
+	void swap(BitGrid& other) noexcept
+	{
+		std::swap(m_width, other.m_width);
+		std::swap(m_height, other.m_height);
+		std::swap(m_rowWords, other.m_rowWords);
+		std::swap(m_stride, other.m_stride);
+		m_words.swap(other.m_words);
+	}
+
+	// Сравниваются только клетки поля, рамка может быть устаревшей
+	bool operator==(const BitGrid& other) const
+	{
+		if (m_width != other.m_width || m_height != other.m_height)
+		{
+			return false;
+		}
+		for (int y = 0; y < m_height; ++y)
+		{
+			const uint64_t* row = Row(y);
+			const uint64_t* otherRow = other.Row(y);
+			if (std::memcmp(row, otherRow, (m_rowWords - 1) * sizeof(uint64_t)) != 0
+				|| ((row[m_rowWords - 1] ^ otherRow[m_rowWords - 1]) & GetTailMask()) != 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	int m_width = 0;
+	int m_height = 0;
+	int m_rowWords = 0;
+	int m_stride = 0;
+	std::vector<uint64_t> m_words;
+};
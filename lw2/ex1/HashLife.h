@@ -0,0 +1,434 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "BitGrid.h"
+
+// Сколько узлов дерева держать в памяти; при превышении между прыжками запускается сборка мусора
+constexpr size_t HASHLIFE_MAX_NODES = 1 << 21;
+
+// HashLife: плоскость — квадродерево, одинаковые поддеревья хранятся один раз, а результат шага каждого
+// узла запоминается. Узел уровня L — квадрат 2^L x 2^L; его центральная половина через 2^j поколений
+// (j <= L - 2) считается из девяти перекрывающихся подквадратов рекурсивно. На пустых и периодических
+// полях почти всё берётся из кэша, и миллионы поколений проходятся прыжками по 2^k.
+// Плоскость бесконечная, а поле — тор. За n поколений узор выходит из своей ограничивающей рамки не дальше
+// чем на n клеток, поэтому прыжок разрешён, только если рамка живых клеток начального поля, расширенная
+// на число поколений и ещё на клетку с каждой стороны, помещается в поле: тогда ни одна клетка не касается
+// края и не видит соседей через шов тора, и ответ совпадает с обычным шагом. Иначе — исключение
+class HashLife
+{
+public:
+	explicit HashLife(const BitGrid& field, size_t maxNodes = HASHLIFE_MAX_NODES)
+		: m_width(field.GetWidth())
+		, m_height(field.GetHeight())
+		, m_maxNodes(std::max<size_t>(maxNodes, 1024))
+	{
+		m_nodes.push_back({ DEAD, DEAD, DEAD, DEAD, 0, 0 });
+		m_nodes.push_back({ DEAD, DEAD, DEAD, DEAD, 0, 1 });
+
+		int level = 3;
+		while ((int64_t{ 1 } << level) < std::max(m_width, m_height))
+		{
+			++level;
+		}
+		m_center = int64_t{ 1 } << (level - 1);
+		m_root = Build(field, level, 0, 0);
+		FindBounds(field);
+	}
+
+	// Бросает исключение, если за generations поколений от начального поля узор может дойти до края
+	void CheckFits(uint64_t generations) const
+	{
+		if (m_nodes[m_root].population == 0)
+		{
+			return;
+		}
+		const std::string box = "live cells span x " + std::to_string(m_minX) + ".." + std::to_string(m_maxX)
+			+ ", y " + std::to_string(m_minY) + ".." + std::to_string(m_maxY) + " of the "
+			+ std::to_string(m_width) + "x" + std::to_string(m_height) + " field";
+		if (m_minX == 0 || m_minY == 0 || m_maxX == m_width - 1 || m_maxY == m_height - 1)
+		{
+			throw std::runtime_error(box + "; hashlife rejects cells on the border rows or columns, "
+				"they already wrap around the torus (use --engine=dense)");
+		}
+		// Рамка, расширенная на generations + 1 клетку с каждой стороны
+		const uint64_t margin = generations + 1;
+		const auto fits = [margin](int64_t min, int64_t max, int size) {
+			return static_cast<uint64_t>(min) >= margin && static_cast<uint64_t>(size - 1 - max) >= margin;
+		};
+		if (!fits(m_minX, m_maxX, m_width) || !fits(m_minY, m_maxY, m_height))
+		{
+			throw std::runtime_error(box + "; grown by " + std::to_string(margin) + " cells per side for "
+				+ std::to_string(generations) + " generations it does not fit, so hashlife could diverge "
+				"from the torus (use --engine=dense or fewer generations)");
+		}
+	}
+
+	// Прыжок на n поколений — по прыжку 2^k на каждый единичный бит n
+	void Advance(uint64_t generations)
+	{
+		CheckFits(m_generation + generations);
+		m_generation += generations;
+		for (int k = 0; generations != 0; ++k, generations >>= 1)
+		{
+			if ((generations & 1) == 0)
+			{
+				continue;
+			}
+			// За 2^k поколений узор вырастает не больше чем на 2^k клеток в каждую сторону; в центральную
+			// половину корня он поместится, если сейчас лежит в центральной четверти и уровень >= k + 3
+			while (m_nodes[m_root].level < k + 3 || !IsPadded(m_root))
+			{
+				m_root = Expand(m_root);
+			}
+			m_root = Successor(m_root, k);
+			if (m_nodes.size() > m_maxNodes)
+			{
+				CollectGarbage();
+			}
+		}
+	}
+
+	// Переносит живые клетки в field. После CheckFits клеток за пределами поля быть не может;
+	// проверка оставлена на случай ошибки в самом HashLife
+	void WriteTo(BitGrid& field) const
+	{
+		field.Clear();
+		const int level = m_nodes[m_root].level;
+		const int64_t origin = m_center - (int64_t{ 1 } << (level - 1));
+		uint64_t escaped = 0;
+		Paint(field, m_root, level, origin, origin, escaped);
+		if (escaped > 0)
+		{
+			throw std::runtime_error(std::to_string(escaped) + " live cells left the field after a jump that passed CheckFits");
+		}
+	}
+
+	[[nodiscard]] uint64_t GetPopulation() const noexcept
+	{
+		return m_nodes[m_root].population;
+	}
+
+	[[nodiscard]] size_t GetNodeCount() const noexcept
+	{
+		return m_nodes.size();
+	}
+
+private:
+	using NodeId = uint32_t;
+
+	static constexpr NodeId DEAD = 0;
+	static constexpr NodeId ALIVE = 1;
+	// Квадрат 64x64 пустого поля проверяется по словам BitGrid целиком
+	static constexpr int WORD_LEVEL = 6;
+
+	// Уровень 0 — клетка, это узлы DEAD и ALIVE. Дети всегда созданы раньше родителя
+	struct Node
+	{
+		NodeId nw, ne, sw, se;
+		int level;
+		uint64_t population;
+	};
+
+	struct NodeKey
+	{
+		NodeId nw, ne, sw, se;
+
+		bool operator==(const NodeKey&) const = default;
+	};
+
+	struct NodeKeyHash
+	{
+		size_t operator()(const NodeKey& key) const noexcept
+		{
+			const uint64_t top = (static_cast<uint64_t>(key.nw) << 32) | key.ne;
+			const uint64_t bottom = (static_cast<uint64_t>(key.sw) << 32) | key.se;
+			return std::hash<uint64_t>{}((top * 0x9E3779B97F4A7C15) ^ (bottom * 0xC2B2AE3D27D4EB4F) ^ (top >> 29));
+		}
+	};
+
+	NodeId Join(NodeId nw, NodeId ne, NodeId sw, NodeId se)
+	{
+		const auto [it, inserted] = m_index.try_emplace({ nw, ne, sw, se }, static_cast<NodeId>(m_nodes.size()));
+		if (inserted)
+		{
+			m_nodes.push_back({ nw, ne, sw, se, m_nodes[nw].level + 1,
+				m_nodes[nw].population + m_nodes[ne].population + m_nodes[sw].population + m_nodes[se].population });
+		}
+		return it->second;
+	}
+
+	NodeId Empty(int level)
+	{
+		while (static_cast<int>(m_empty.size()) <= level)
+		{
+			m_empty.push_back(m_empty.empty() ? DEAD : Join(m_empty.back(), m_empty.back(), m_empty.back(), m_empty.back()));
+		}
+		return m_empty[level];
+	}
+
+	NodeId Build(const BitGrid& field, int level, int64_t x0, int64_t y0)
+	{
+		if (x0 >= m_width || y0 >= m_height)
+		{
+			return Empty(level);
+		}
+		if (level == 0)
+		{
+			return field.Get(static_cast<int>(x0), static_cast<int>(y0)) ? ALIVE : DEAD;
+		}
+		if (level == WORD_LEVEL && IsEmptyBlock(field, x0, y0))
+		{
+			return Empty(level);
+		}
+		const int64_t half = int64_t{ 1 } << (level - 1);
+		const NodeId nw = Build(field, level - 1, x0, y0);
+		const NodeId ne = Build(field, level - 1, x0 + half, y0);
+		const NodeId sw = Build(field, level - 1, x0, y0 + half);
+		const NodeId se = Build(field, level - 1, x0 + half, y0 + half);
+		return Join(nw, ne, sw, se);
+	}
+
+	// Рамка живых клеток начального поля; для пустого поля не нужна
+	void FindBounds(const BitGrid& field)
+	{
+		m_minX = m_width;
+		m_minY = m_height;
+		for (int y = 0; y < m_height; ++y)
+		{
+			const uint64_t* row = field.Row(y);
+			for (int i = 0; i < field.GetRowWords(); ++i)
+			{
+				const uint64_t word = i == field.GetRowWords() - 1 ? row[i] & field.GetTailMask() : row[i];
+				if (word == 0)
+				{
+					continue;
+				}
+				m_minX = std::min<int64_t>(m_minX, int64_t{ i } * WORD_BITS + std::countr_zero(word));
+				m_maxX = std::max<int64_t>(m_maxX, int64_t{ i } * WORD_BITS + std::bit_width(word) - 1);
+				m_minY = std::min<int64_t>(m_minY, y);
+				m_maxY = y;
+			}
+		}
+	}
+
+	// Квадрат 64x64 с углом (x0, y0), x0 кратно 64 — это одно слово в каждой из 64 строк
+	[[nodiscard]] bool IsEmptyBlock(const BitGrid& field, int64_t x0, int64_t y0) const
+	{
+		const int word = static_cast<int>(x0 / WORD_BITS);
+		const uint64_t mask = word == field.GetRowWords() - 1 ? field.GetTailMask() : ~uint64_t{ 0 };
+		const int endY = static_cast<int>(std::min<int64_t>(y0 + WORD_BITS, m_height));
+		for (int y = static_cast<int>(y0); y < endY; ++y)
+		{
+			if ((field.Row(y)[word] & mask) != 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void Paint(BitGrid& field, NodeId id, int level, int64_t x0, int64_t y0, uint64_t& escaped) const
+	{
+		const Node& node = m_nodes[id];
+		if (node.population == 0)
+		{
+			return;
+		}
+		if (level == 0)
+		{
+			if (x0 >= 0 && x0 < m_width && y0 >= 0 && y0 < m_height)
+			{
+				field.Set(static_cast<int>(x0), static_cast<int>(y0), true);
+			}
+			else
+			{
+				++escaped;
+			}
+			return;
+		}
+		const int64_t half = int64_t{ 1 } << (level - 1);
+		Paint(field, node.nw, level - 1, x0, y0, escaped);
+		Paint(field, node.ne, level - 1, x0 + half, y0, escaped);
+		Paint(field, node.sw, level - 1, x0, y0 + half, escaped);
+		Paint(field, node.se, level - 1, x0 + half, y0 + half, escaped);
+	}
+
+	// Весь узор в центральной четверти узла
+	[[nodiscard]] bool IsPadded(NodeId id) const
+	{
+		const Node& node = m_nodes[id];
+		const auto inner = [&](NodeId quadrant, NodeId Node::* corner) {
+			return m_nodes[m_nodes[m_nodes[quadrant].*corner].*corner].population;
+		};
+		return node.population == inner(node.nw, &Node::se) + inner(node.ne, &Node::sw)
+			+ inner(node.sw, &Node::ne) + inner(node.se, &Node::nw);
+	}
+
+	// Узел уровнем выше с тем же центром
+	NodeId Expand(NodeId id)
+	{
+		const Node node = m_nodes[id];
+		const NodeId empty = Empty(node.level - 1);
+		return Join(Join(empty, empty, empty, node.nw), Join(empty, empty, node.ne, empty),
+			Join(empty, node.sw, empty, empty), Join(node.se, empty, empty, empty));
+	}
+
+	// Центральный квадрат уровня L - 1 из четырёх соседних узлов уровня L - 1
+	NodeId Centre(NodeId nw, NodeId ne, NodeId sw, NodeId se)
+	{
+		return Join(m_nodes[nw].se, m_nodes[ne].sw, m_nodes[sw].ne, m_nodes[se].nw);
+	}
+
+	// Центральные 2x2 квадрата 4x4 через одно поколение
+	NodeId StepLeaf(NodeId id)
+	{
+		uint32_t cells = 0;
+		for (int y = 0; y < 4; ++y)
+		{
+			for (int x = 0; x < 4; ++x)
+			{
+				const Node& node = m_nodes[id];
+				const Node& quadrant = m_nodes[y < 2 ? (x < 2 ? node.nw : node.ne) : (x < 2 ? node.sw : node.se)];
+				const NodeId cell = (y % 2 == 0) ? (x % 2 == 0 ? quadrant.nw : quadrant.ne) : (x % 2 == 0 ? quadrant.sw : quadrant.se);
+				cells |= static_cast<uint32_t>(cell == ALIVE) << (y * 4 + x);
+			}
+		}
+		const auto next = [cells](int x, int y) {
+			int neighbors = 0;
+			for (int dy = -1; dy <= 1; ++dy)
+			{
+				for (int dx = -1; dx <= 1; ++dx)
+				{
+					if ((dx != 0 || dy != 0) && ((cells >> ((y + dy) * 4 + x + dx)) & 1))
+					{
+						++neighbors;
+					}
+				}
+			}
+			const bool alive = (cells >> (y * 4 + x)) & 1;
+			return (alive ? (neighbors == 2 || neighbors == 3) : neighbors == 3) ? ALIVE : DEAD;
+		};
+		return Join(next(1, 1), next(2, 1), next(1, 2), next(2, 2));
+	}
+
+	// Центральная половина узла через 2^j поколений, j <= L - 2. При j = L - 2 обе половины пути
+	// по 2^(L-3) поколений считаются рекурсивно; при меньшем j шаг делает только первая, а из второй
+	// берутся центры
+	NodeId Successor(NodeId id, int j)
+	{
+		const Node node = m_nodes[id];
+		if (node.population == 0)
+		{
+			return Empty(node.level - 1);
+		}
+		const uint64_t key = (static_cast<uint64_t>(id) << 8) | static_cast<uint64_t>(j);
+		if (const auto it = m_results.find(key); it != m_results.end())
+		{
+			return it->second;
+		}
+
+		NodeId result;
+		if (node.level == 2)
+		{
+			result = StepLeaf(id);
+		}
+		else
+		{
+			const Node nw = m_nodes[node.nw];
+			const Node ne = m_nodes[node.ne];
+			const Node sw = m_nodes[node.sw];
+			const Node se = m_nodes[node.se];
+			const NodeId parts[9] = {
+				node.nw, Join(nw.ne, ne.nw, nw.se, ne.sw), node.ne,
+				Join(nw.sw, nw.se, sw.nw, sw.ne), Join(nw.se, ne.sw, sw.ne, se.nw), Join(ne.sw, ne.se, se.nw, se.ne),
+				node.sw, Join(sw.ne, se.nw, sw.se, se.sw), node.se
+			};
+			const int partStep = std::min(j, node.level - 3);
+			NodeId r[9];
+			for (int i = 0; i < 9; ++i)
+			{
+				r[i] = Successor(parts[i], partStep);
+			}
+			if (j == node.level - 2)
+			{
+				result = Join(Successor(Join(r[0], r[1], r[3], r[4]), partStep), Successor(Join(r[1], r[2], r[4], r[5]), partStep),
+					Successor(Join(r[3], r[4], r[6], r[7]), partStep), Successor(Join(r[4], r[5], r[7], r[8]), partStep));
+			}
+			else
+			{
+				result = Join(Centre(r[0], r[1], r[3], r[4]), Centre(r[1], r[2], r[4], r[5]),
+					Centre(r[3], r[4], r[6], r[7]), Centre(r[4], r[5], r[7], r[8]));
+			}
+		}
+		m_results.emplace(key, result);
+		return result;
+	}
+
+	// Оставляет только узлы, достижимые из корня, и плотно перенумеровывает их. Кэш шагов сбрасывается:
+	// его результаты из корня не достижимы и почти все были бы удалены
+	void CollectGarbage()
+	{
+		std::vector<bool> live(m_nodes.size());
+		live[DEAD] = live[ALIVE] = live[m_root] = true;
+		// Дети создаются раньше родителя, так что одного прохода сверху вниз хватает
+		for (size_t id = m_nodes.size(); id-- > ALIVE + 1;)
+		{
+			if (live[id])
+			{
+				const Node& node = m_nodes[id];
+				live[node.nw] = live[node.ne] = live[node.sw] = live[node.se] = true;
+			}
+		}
+
+		std::vector<NodeId> remap(m_nodes.size());
+		std::vector<Node> nodes;
+		m_index.clear();
+		for (size_t id = 0; id < m_nodes.size(); ++id)
+		{
+			if (!live[id])
+			{
+				continue;
+			}
+			Node node = m_nodes[id];
+			remap[id] = static_cast<NodeId>(nodes.size());
+			if (node.level > 0)
+			{
+				node.nw = remap[node.nw];
+				node.ne = remap[node.ne];
+				node.sw = remap[node.sw];
+				node.se = remap[node.se];
+				m_index.emplace(NodeKey{ node.nw, node.ne, node.sw, node.se }, remap[id]);
+			}
+			nodes.push_back(node);
+		}
+		m_nodes = std::move(nodes);
+		m_root = remap[m_root];
+		m_results.clear();
+		m_empty.clear();
+	}
+
+	int m_width;
+	int m_height;
+	size_t m_maxNodes;
+	// Все корни — с центром в одной точке плоскости; поле занимает [0, width) x [0, height)
+	int64_t m_center = 0;
+	// Рамка живых клеток начального поля и сколько поколений от него уже пройдено
+	int64_t m_minX = 0;
+	int64_t m_minY = 0;
+	int64_t m_maxX = 0;
+	int64_t m_maxY = 0;
+	uint64_t m_generation = 0;
+	NodeId m_root = DEAD;
+	std::vector<Node> m_nodes;
+	std::unordered_map<NodeKey, NodeId, NodeKeyHash> m_index;
+	std::unordered_map<uint64_t, NodeId> m_results;
+	std::vector<NodeId> m_empty;
+};
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "BitGrid.h"
+#include "StepKernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define LIFE_X86_KERNELS 1
+#endif
+
+// Ядро шага: считает слова [beginWord, endWord) строк [startY, endY) следующего поколения
+// по current с обновлённой рамкой и возвращает, отличается ли результат от того, что было в next до шага
+using StepFunction = bool (*)(const BitGrid& current, BitGrid& next, int startY, int endY, int beginWord, int endWord);
+
+struct StepKernel
+{
+	std::string name;
+	StepFunction step;
+};
+
+// Исходный алгоритм: по клетке, восемь соседей через деление по модулю, рамка не нужна. Медленный,
+// но очевидно верный — с ним сверяются остальные ядра
+inline bool StepRowsReference(const BitGrid& current, BitGrid& next, int startY, int endY, int beginWord, int endWord)
+{
+	const int width = current.GetWidth();
+	const int height = current.GetHeight();
+	const int endX = std::min(width, endWord * WORD_BITS);
+	bool changed = false;
+	for (int y = startY; y < endY; ++y)
+	{
+		for (int x = beginWord * WORD_BITS; x < endX; ++x)
+		{
+			int neighbors = 0;
+			for (int dy = -1; dy <= 1; ++dy)
+			{
+				for (int dx = -1; dx <= 1; ++dx)
+				{
+					if ((dx != 0 || dy != 0) && current.Get((x + dx + width) % width, (y + dy + height) % height))
+					{
+						++neighbors;
+					}
+				}
+			}
+			const bool nextAlive = current.Get(x, y) ? (neighbors == 2 || neighbors == 3) : neighbors == 3;
+			changed = changed || next.Get(x, y) != nextAlive;
+			next.Set(x, y, nextAlive);
+		}
+	}
+	return changed;
+}
+
+inline bool StepRowsScalar(const BitGrid& current, BitGrid& next, int startY, int endY, int beginWord, int endWord)
+{
+	return StepRowsWith<uint64_t>(current, next, startY, endY, beginWord, endWord);
+}
+
+#ifdef LIFE_X86_KERNELS
+// Векторы GCC из 2, 4 и 8 слов — регистры xmm, ymm и zmm. Тело ядра одно, StepRowsWith встраивается
+// в каждую из функций ниже и компилируется под её набор инструкций
+using Words128 = uint64_t __attribute__((vector_size(16)));
+using Words256 = uint64_t __attribute__((vector_size(32)));
+using Words512 = uint64_t __attribute__((vector_size(64)));
+
+__attribute__((target("sse2"))) inline bool StepRowsSse2(const BitGrid& current, BitGrid& next,
+	int startY, int endY, int beginWord, int endWord)
+{
+	return StepRowsWith<Words128>(current, next, startY, endY, beginWord, endWord);
+}
+
+__attribute__((target("avx2"))) inline bool StepRowsAvx2(const BitGrid& current, BitGrid& next,
+	int startY, int endY, int beginWord, int endWord)
+{
+	return StepRowsWith<Words256>(current, next, startY, endY, beginWord, endWord);
+}
+
+__attribute__((target("avx512f"))) inline bool StepRowsAvx512(const BitGrid& current, BitGrid& next,
+	int startY, int endY, int beginWord, int endWord)
+{
+	return StepRowsWith<Words512>(current, next, startY, endY, beginWord, endWord);
+}
+
+struct CpuFeatures
+{
+	bool sse2 = false;
+	bool avx2 = false;
+	bool avx512 = false;
+};
+
+// Инструкции мало поддерживать процессору: регистры ymm и zmm ещё должна сохранять ОС (XCR0, OSXSAVE)
+inline CpuFeatures DetectCpuFeatures()
+{
+	CpuFeatures features;
+	unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+	{
+		return features;
+	}
+	features.sse2 = (edx & bit_SSE2) != 0;
+
+	uint64_t osState = 0;
+	if ((ecx & bit_OSXSAVE) != 0)
+	{
+		unsigned low = 0, high = 0;
+		asm volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+		osState = (static_cast<uint64_t>(high) << 32) | low;
+	}
+	const bool osYmm = (osState & 0x06) == 0x06; // состояния SSE и AVX
+	const bool osZmm = (osState & 0xE6) == 0xE6; // плюс opmask и обе половины zmm
+
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+	{
+		features.avx2 = osYmm && (ebx & bit_AVX2) != 0;
+		features.avx512 = osZmm && (ebx & bit_AVX512F) != 0;
+	}
+	return features;
+}
+#endif
+
+// Ядра, которые можно запустить на этом процессоре, от самого широкого к эталонному
+inline std::vector<StepKernel> GetAvailableKernels()
+{
+	std::vector<StepKernel> kernels;
+#ifdef LIFE_X86_KERNELS
+	const CpuFeatures features = DetectCpuFeatures();
+	if (features.avx512)
+	{
+		kernels.push_back({ "avx512", StepRowsAvx512 });
+	}
+	if (features.avx2)
+	{
+		kernels.push_back({ "avx2", StepRowsAvx2 });
+	}
+	if (features.sse2)
+	{
+		kernels.push_back({ "sse2", StepRowsSse2 });
+	}
+#endif
+	kernels.push_back({ "scalar", StepRowsScalar });
+	kernels.push_back({ "reference", StepRowsReference });
+	return kernels;
+}
+
+// auto — самое широкое из доступных
+inline StepKernel SelectKernel(const std::string& name)
+{
+	const auto kernels = GetAvailableKernels();
+	if (name == "auto")
+	{
+		return kernels.front();
+	}
+	std::string available;
+	for (const auto& kernel: kernels)
+	{
+		if (kernel.name == name)
+		{
+			return kernel;
+		}
+		available += (available.empty() ? "" : ", ") + kernel.name;
+	}
+	throw std::invalid_argument("Kernel '" + name + "' is unknown or not supported by this CPU (available: auto, " + available + ")");
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include "BitGrid.h"
+
+// Сумматоры над словами: бит i результата складывает биты i входов, так что за раз считаются 64 клетки.
+// Word — uint64_t или вектор из нескольких uint64_t (векторные расширения GCC): те же операции идут
+// сразу по всем словам вектора
+template <typename Word>
+[[gnu::always_inline]] inline void FullAdd(Word a, Word b, Word c, Word& sum, Word& carry)
+{
+	const Word partial = a ^ b;
+	sum = partial ^ c;
+	carry = (a & b) | (partial & c);
+}
+
+template <typename Word>
+[[gnu::always_inline]] inline void HalfAdd(Word a, Word b, Word& sum, Word& carry)
+{
+	sum = a ^ b;
+	carry = a & b;
+}
+
+// Следующее состояние 64 клеток по восьми словам соседей, уже сдвинутым так, что бит i — сосед клетки i.
+// Число соседей собирается в разряды ones, twos, fours; восьми соседей дают twos = 0, и клетка умирает,
+// как и должна, так что разряд восьмёрок не нужен. Живой будет клетка с 3 соседями или живая с 2
+template <typename Word>
+[[gnu::always_inline]] inline Word NextWord(Word aboveWest, Word above, Word aboveEast,
+	Word west, Word cell, Word east,
+	Word belowWest, Word below, Word belowEast)
+{
+	Word sumA, carryA, sumB, carryB, sumC, carryC;
+	FullAdd(aboveWest, above, aboveEast, sumA, carryA);
+	FullAdd(west, east, belowWest, sumB, carryB);
+	HalfAdd(below, belowEast, sumC, carryC);
+
+	Word ones, carryOnes;
+	FullAdd(sumA, sumB, sumC, ones, carryOnes);
+
+	Word twosPartial, foursA, twos, foursB;
+	FullAdd(carryA, carryB, carryC, twosPartial, foursA);
+	HalfAdd(twosPartial, carryOnes, twos, foursB);
+	const Word fours = foursA ^ foursB;
+
+	return twos & ~fours & (ones | cell);
+}
+
+// Строки не выровнены под вектор, так что читаем и пишем без требований к выравниванию
+template <typename Word>
+[[gnu::always_inline]] inline Word LoadWords(const uint64_t* data)
+{
+	Word word;
+	std::memcpy(&word, data, sizeof(word));
+	return word;
+}
+
+template <typename Word>
+[[gnu::always_inline]] inline void StoreWords(uint64_t* data, Word word)
+{
+	std::memcpy(data, &word, sizeof(word));
+}
+
+// Соседи слева и справа: бит i — клетки x - 1 и x + 1. Крайним словам строки соседние слова даёт рамка
+template <typename Word>
+[[gnu::always_inline]] inline Word WestWords(const uint64_t* data)
+{
+	return (LoadWords<Word>(data) << 1) | (LoadWords<Word>(data - 1) >> (WORD_BITS - 1));
+}
+
+template <typename Word>
+[[gnu::always_inline]] inline Word EastWords(const uint64_t* data)
+{
+	return (LoadWords<Word>(data) >> 1) | (LoadWords<Word>(data + 1) << (WORD_BITS - 1));
+}
+
+// Слова [begin, end) строки. Word-ом обрабатывается сразу sizeof(Word) / 8 слов, остаток — по одному.
+// В diff и scalarDiff копится разница с тем, что лежало в out до записи
+template <typename Word>
+[[gnu::always_inline]] inline void StepRowWords(const uint64_t* above, const uint64_t* row, const uint64_t* below,
+	uint64_t* out, int begin, int end, Word& diff, uint64_t& scalarDiff)
+{
+	constexpr int WORDS = sizeof(Word) / sizeof(uint64_t);
+	int i = begin;
+	for (; i + WORDS <= end; i += WORDS)
+	{
+		const Word result = NextWord(WestWords<Word>(above + i), LoadWords<Word>(above + i), EastWords<Word>(above + i),
+			WestWords<Word>(row + i), LoadWords<Word>(row + i), EastWords<Word>(row + i),
+			WestWords<Word>(below + i), LoadWords<Word>(below + i), EastWords<Word>(below + i));
+		diff |= result ^ LoadWords<Word>(out + i);
+		StoreWords(out + i, result);
+	}
+	if constexpr (WORDS > 1)
+	{
+		StepRowWords<uint64_t>(above, row, below, out, i, end, scalarDiff, scalarDiff);
+	}
+}
+
+// Считает слова [beginWord, endWord) строк [startY, endY) следующего поколения; рамка current должна
+// быть обновлена. Рамку next не трогает, клетки за шириной поля в ней обнуляются. Возвращает, отличается ли
+// результат от того, что было в next до шага. Последнее слово строки считается отдельно: до маски в нём
+// мусор, а в next за шириной лежит бит рамки
+template <typename Word>
+[[gnu::always_inline]] inline bool StepRowsWith(const BitGrid& current, BitGrid& next, int startY, int endY,
+	int beginWord, int endWord)
+{
+	const int last = endWord == current.GetRowWords() ? endWord - 1 : endWord;
+	const uint64_t tailMask = current.GetTailMask();
+	Word diff{};
+	uint64_t scalarDiff = 0;
+	for (int y = startY; y < endY; ++y)
+	{
+		const uint64_t* above = current.Row(y - 1);
+		const uint64_t* row = current.Row(y);
+		const uint64_t* below = current.Row(y + 1);
+		uint64_t* out = next.Row(y);
+		StepRowWords<Word>(above, row, below, out, beginWord, last, diff, scalarDiff);
+		if (last != endWord)
+		{
+			const uint64_t before = out[last];
+			uint64_t unused = 0;
+			StepRowWords<uint64_t>(above, row, below, out, last, endWord, unused, unused);
+			out[last] &= tailMask;
+			scalarDiff |= (out[last] ^ before) & tailMask;
+		}
+	}
+	if constexpr (sizeof(Word) > sizeof(uint64_t))
+	{
+		for (size_t k = 0; k < sizeof(Word) / sizeof(uint64_t); ++k)
+		{
+			scalarDiff |= diff[k];
+		}
+	}
+	else
+	{
+		scalarDiff |= diff;
+	}
+	return scalarDiff != 0;
+}
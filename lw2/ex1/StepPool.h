@@ -0,0 +1,242 @@
+#pragma once
+
+#include <algorithm>
+#include <barrier>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "BitGrid.h"
+#include "Kernels.h"
+
+// Поле делится на плитки по TILE_ROWS строк и TILE_WORDS слов
+constexpr int TILE_ROWS = 32;
+constexpr int TILE_WORDS = 16;
+// Если в поколении посчитано больше этой доли плиток, следующие DENSE_GENERATIONS поколений поле считается
+// целиком, без плиток: на почти сплошь активном поле лишние вызовы ядра и учёт плиток дороже пропусков
+constexpr double DENSE_ACTIVE_FRACTION = 0.5;
+constexpr int DENSE_GENERATIONS = 32;
+
+// Потоки создаются один раз и между поколениями ждут на барьере. Вызывающий поток тоже считает свою
+// полосу строк, так что дополнительных потоков numThreads - 1. Боковую рамку своих строк поток заполняет
+// сам, сразу после шага. Когда все полосы поколения посчитаны, завершение барьера меняет current и next
+// местами, копирует строки рамки, и сразу начинается следующее поколение.
+// Плитка «изменилась», если её новое состояние отличается от позапрошлого, которое оно затёрло в next.
+// Плитка считается, только если изменилась она или одна из восьми соседних. Иначе её окрестность та же,
+// что два поколения назад, значит и следующее состояние — то, что было поколение назад и так лежит в next:
+// ни считать, ни копировать её не нужно. Так пропускаются и натюрморты, и осцилляторы периода 2 вроде
+// мигалок, которыми полно любое успокоившееся поле. Сплошной шаг помечает изменившимися все плитки, поэтому
+// первое поколение после него снова считает всё, и долю активных плиток показывает только второе
+// (после запуска — третье: первый шаг сравнивает с тем же полем, а не с позапрошлым).
+// Между Run поле меняет только сам пул
+class StepPool
+{
+public:
+	StepPool(const StepKernel& kernel, int numThreads, BitGrid& current, BitGrid& next)
+		: m_step(kernel.step)
+		, m_current(current)
+		, m_next(next)
+		, m_tilesX((current.GetRowWords() + TILE_WORDS - 1) / TILE_WORDS)
+		, m_tilesY((current.GetHeight() + TILE_ROWS - 1) / TILE_ROWS)
+		// Поток считает целые ряды плиток
+		, m_numThreads(std::clamp(numThreads, 1, std::max(m_tilesY, 1)))
+		// В первом поколении считаются все плитки
+		, m_changed(static_cast<size_t>(m_tilesX) * m_tilesY, 1)
+		, m_nextChanged(m_changed.size())
+		, m_activeTiles(m_numThreads)
+		, m_barrier(m_numThreads, OnPhaseDone{ this })
+	{
+		m_current.RefreshHalo();
+		// «Поколение назад» для первого шага — само поле
+		m_next = m_current;
+		m_workers.reserve(m_numThreads - 1);
+		for (int i = 1; i < m_numThreads; ++i)
+		{
+			m_workers.emplace_back([this, i] { Work(i); });
+		}
+	}
+
+	StepPool(const StepPool&) = delete;
+	StepPool& operator=(const StepPool&) = delete;
+
+	~StepPool()
+	{
+		m_stopping = true;
+		m_barrier.arrive_and_wait();
+	}
+
+	// Делает generations поколений; результат — в current
+	void Run(int generations)
+	{
+		if (generations <= 0)
+		{
+			return;
+		}
+		m_remaining = generations;
+		m_barrier.arrive_and_wait();
+		StepGenerations(0);
+	}
+
+	[[nodiscard]] int GetNumThreads() const noexcept
+	{
+		return m_numThreads;
+	}
+
+	// Доля посчитанных плиток среди всех с прошлого вызова
+	double TakeActiveFraction() noexcept
+	{
+		const double fraction = m_tileSteps > 0 ? static_cast<double>(m_activeTotal) / static_cast<double>(m_tileSteps) : 0.0;
+		m_activeTotal = 0;
+		m_tileSteps = 0;
+		return fraction;
+	}
+
+private:
+	// Фаза барьера — либо пуск (из Run или деструктора), либо конец поколения
+	struct OnPhaseDone
+	{
+		StepPool* pool;
+
+		void operator()() const noexcept
+		{
+			if (!pool->m_stepping)
+			{
+				pool->m_stepping = pool->m_remaining > 0;
+				return;
+			}
+			pool->m_current.swap(pool->m_next);
+			pool->m_current.WrapRows();
+			pool->m_changed.swap(pool->m_nextChanged);
+			uint64_t active = 0;
+			for (const uint64_t tiles: pool->m_activeTiles)
+			{
+				active += tiles;
+			}
+			pool->m_activeTotal += active;
+			pool->m_tileSteps += pool->m_changed.size();
+			pool->ChooseMode(active);
+			pool->m_stepping = --pool->m_remaining > 0;
+		}
+	};
+
+	void Work(int index)
+	{
+		while (true)
+		{
+			m_barrier.arrive_and_wait();
+			if (m_stopping)
+			{
+				return;
+			}
+			StepGenerations(index);
+		}
+	}
+
+	void StepGenerations(int index)
+	{
+		const int height = m_current.GetHeight();
+		const int beginTile = static_cast<int>(static_cast<long long>(m_tilesY) * index / m_numThreads);
+		const int endTile = static_cast<int>(static_cast<long long>(m_tilesY) * (index + 1) / m_numThreads);
+		while (m_stepping)
+		{
+			uint64_t active = 0;
+			for (int tileY = beginTile; tileY < endTile; ++tileY)
+			{
+				const int startY = tileY * TILE_ROWS;
+				const int endY = std::min(startY + TILE_ROWS, height);
+				if (m_denseLeft > 0)
+				{
+					m_step(m_current, m_next, startY, endY, 0, m_current.GetRowWords());
+					std::fill_n(m_nextChanged.begin() + static_cast<ptrdiff_t>(tileY) * m_tilesX, m_tilesX, uint8_t{ 1 });
+					active += m_tilesX;
+				}
+				else
+				{
+					StepTileRow(tileY, startY, endY, active);
+				}
+				for (int y = startY; y < endY; ++y)
+				{
+					m_next.WrapRow(y);
+				}
+			}
+			m_activeTiles[index] = active;
+			m_barrier.arrive_and_wait();
+		}
+	}
+
+	void StepTileRow(int tileY, int startY, int endY, uint64_t& active)
+	{
+		for (int tileX = 0; tileX < m_tilesX; ++tileX)
+		{
+			uint8_t& changed = m_nextChanged[static_cast<size_t>(tileY) * m_tilesX + tileX];
+			if (!IsActive(tileX, tileY))
+			{
+				changed = 0;
+				continue;
+			}
+			++active;
+			const int beginWord = tileX * TILE_WORDS;
+			const int endWord = std::min(beginWord + TILE_WORDS, m_current.GetRowWords());
+			changed = m_step(m_current, m_next, startY, endY, beginWord, endWord);
+		}
+	}
+
+	// Вызывается в завершении барьера: решает, как считать следующее поколение
+	void ChooseMode(uint64_t active) noexcept
+	{
+		if (m_denseLeft > 0)
+		{
+			m_warmup = --m_denseLeft == 0 ? 1 : 0;
+			return;
+		}
+		if (m_warmup > 0)
+		{
+			--m_warmup;
+			return;
+		}
+		if (static_cast<double>(active) > DENSE_ACTIVE_FRACTION * static_cast<double>(m_changed.size()))
+		{
+			m_denseLeft = DENSE_GENERATIONS;
+		}
+	}
+
+	// Плитки тоже замкнуты в тор
+	[[nodiscard]] bool IsActive(int tileX, int tileY) const
+	{
+		for (int dy = -1; dy <= 1; ++dy)
+		{
+			const int y = (tileY + dy + m_tilesY) % m_tilesY;
+			for (int dx = -1; dx <= 1; ++dx)
+			{
+				const int x = (tileX + dx + m_tilesX) % m_tilesX;
+				if (m_changed[static_cast<size_t>(y) * m_tilesX + x])
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	StepFunction m_step;
+	BitGrid& m_current;
+	BitGrid& m_next;
+	const int m_tilesX;
+	const int m_tilesY;
+	const int m_numThreads;
+	// Флаги изменения плиток в current и в считаемом поколении; uint8_t, чтобы потоки писали в разные байты
+	std::vector<uint8_t> m_changed;
+	std::vector<uint8_t> m_nextChanged;
+	// Посчитанные за поколение плитки, по счётчику на поток
+	std::vector<uint64_t> m_activeTiles;
+	uint64_t m_activeTotal = 0;
+	uint64_t m_tileSteps = 0;
+	// Меняются только до барьера в вызывающем потоке или в завершении барьера, которое видят все потоки
+	int m_remaining = 0;
+	// Сколько поколений ещё считать сплошь и сколько ещё не смотреть на долю активных плиток
+	int m_denseLeft = 0;
+	int m_warmup = 2;
+	bool m_stepping = false;
+	bool m_stopping = false;
+	std::barrier<OnPhaseDone> m_barrier;
+	std::vector<std::jthread> m_workers;
+};
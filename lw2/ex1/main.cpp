@@ -1,13 +1,19 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <chrono>
 #include <variant>
 #include <stdexcept>
+#include <filesystem>
 #include <fstream>
 #include <thread>
 #include <random>
 #include <SFML/Graphics.hpp>
+#include "BitGrid.h"
+#include "HashLife.h"
+#include "Kernels.h"
+#include "StepPool.h"
 
 template<class... Ts>
 struct overloads : Ts ...
@@ -16,8 +22,6 @@ struct overloads : Ts ...
 };
 template<class... Ts> overloads(Ts...) -> overloads<Ts...>;
 
-using State = std::vector<std::vector<bool>>;
-
 constexpr int CELL_SIZE = 8;
 const sf::Color ALIVE_COLOR = sf::Color::Black;
 const sf::Color DEAD_COLOR = sf::Color::White;
@@ -35,24 +39,72 @@ struct StepArgs
 	int numThread = 0;
 	std::string outFileName;
 	std::string inFileName;
+	std::string kernel;
+};
+
+struct RunArgs
+{
+	int numThread = 0;
+	int generations = 0;
+	int every = 0;
+	std::string outFileName;
+	std::string inFileName;
+	std::string kernel;
+	std::string engine;
+	size_t cacheNodes = HASHLIFE_MAX_NODES;
 };
 
 struct VisualizeArgs
 {
 	int numThread = 0;
 	std::string inFileName;
+	std::string kernel;
 };
 
-using VariantArgs = std::variant<GenerateArgs, StepArgs, VisualizeArgs>;
+using VariantArgs = std::variant<GenerateArgs, StepArgs, RunArgs, VisualizeArgs>;
+
+// Параметр --name=value или --name value может стоять где угодно; он убирается из argv,
+// остаются позиционные аргументы
+std::string ExtractOption(int& argc, char* argv[], const std::string& name, const std::string& defaultValue)
+{
+	const std::string flag = "--" + name;
+	const std::string prefix = flag + "=";
+	std::string value = defaultValue;
+	int kept = 0;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (std::string(argv[i]).starts_with(prefix))
+		{
+			value = argv[i] + prefix.size();
+		}
+		else if (argv[i] == flag && i + 1 < argc)
+		{
+			value = argv[++i];
+		}
+		else
+		{
+			argv[kept++] = argv[i];
+		}
+	}
+	argc = kept;
+	return value;
+}
 
 VariantArgs ParseArgs(int argc, char* argv[])
 {
+	const std::string kernel = ExtractOption(argc, argv, "kernel", "auto");
+	const std::string every = ExtractOption(argc, argv, "every", "0");
+	const std::string engine = ExtractOption(argc, argv, "engine", "dense");
+	const std::string cacheNodes = ExtractOption(argc, argv, "cache-nodes", std::to_string(HASHLIFE_MAX_NODES));
 	if (argc < 2)
 	{
 		throw std::invalid_argument("Not enough arguments. Usage: \n"
 									"life generate OUTPUT_FILE_NAME WIDTH HEIGHT PROBABILITY\n"
-									"life step INPUT_FILE_NAME NUM_THREADS [OUTPUT_FILE_NAME]\n"
-									"life visualize INPUT_FILE_NAME NUM_THREADS\n");
+									"life step INPUT_FILE_NAME NUM_THREADS [OUTPUT_FILE_NAME] [--kernel=KERNEL]\n"
+									"life run INPUT_FILE_NAME GENERATIONS NUM_THREADS [OUTPUT_FILE_NAME] [--every K] [--kernel=KERNEL]\n"
+									"         [--engine=dense|hashlife] [--cache-nodes=N]\n"
+									"life visualize INPUT_FILE_NAME NUM_THREADS [--kernel=KERNEL]\n"
+									"KERNEL: auto, avx512, avx2, sse2, scalar or reference\n");
 	}
 
 	std::string mode = argv[1];
@@ -77,10 +129,11 @@ VariantArgs ParseArgs(int argc, char* argv[])
 		if (argc < 4 || argc > 5)
 		{
 			throw std::invalid_argument("Invalid arguments for 'step'. Usage:\n"
-										"life step INPUT_FILE_NAME NUM_THREADS [OUTPUT_FILE_NAME]");
+										"life step INPUT_FILE_NAME NUM_THREADS [OUTPUT_FILE_NAME] [--kernel=KERNEL]");
 		}
 
 		StepArgs args;
+		args.kernel = kernel;
 		args.inFileName = argv[2];
 		args.numThread = std::stoi(argv[3]);
 		if (argc == 5)
@@ -89,15 +142,47 @@ VariantArgs ParseArgs(int argc, char* argv[])
 		}
 		return args;
 	}
+	else if (mode == "run")
+	{
+		if (argc < 5 || argc > 6)
+		{
+			throw std::invalid_argument("Invalid arguments for 'run'. Usage:\n"
+										"life run INPUT_FILE_NAME GENERATIONS NUM_THREADS [OUTPUT_FILE_NAME] [--every K] [--kernel=KERNEL]\n"
+										"         [--engine=dense|hashlife] [--cache-nodes=N]");
+		}
+
+		RunArgs args;
+		args.kernel = kernel;
+		args.inFileName = argv[2];
+		args.generations = std::stoi(argv[3]);
+		args.numThread = std::stoi(argv[4]);
+		args.every = std::stoi(every);
+		args.engine = engine;
+		args.cacheNodes = std::stoull(cacheNodes);
+		if (args.engine != "dense" && args.engine != "hashlife")
+		{
+			throw std::invalid_argument("Unknown engine: " + args.engine + " (expected dense or hashlife)");
+		}
+		if (argc == 6)
+		{
+			args.outFileName = argv[5];
+		}
+		if (args.generations < 0 || args.every < 0)
+		{
+			throw std::invalid_argument("GENERATIONS and K must not be negative");
+		}
+		return args;
+	}
 	else if (mode == "visualize")
 	{
 		if (argc != 4)
 		{
 			throw std::invalid_argument("Invalid arguments for 'visualize'. Usage:\n"
-										"life visualize INPUT_FILE_NAME NUM_THREADS");
+										"life visualize INPUT_FILE_NAME NUM_THREADS [--kernel=KERNEL]");
 		}
 
 		VisualizeArgs args;
+		args.kernel = kernel;
 		args.inFileName = argv[2];
 		args.numThread = std::stoi(argv[3]);
 		return args;
@@ -149,10 +234,8 @@ using namespace std::chrono;
 
 struct Field
 {
-	int width;
-	int height;
-	State cells;
-	State nextState;
+	BitGrid cells;
+	BitGrid nextState;
 };
 
 Field ReadField(const std::string& filename)
@@ -164,18 +247,28 @@ Field ReadField(const std::string& filename)
 	}
 
 	int width, height;
-	file >> width >> height;
+	if (!(file >> width >> height) || width <= 0 || height <= 0)
+	{
+		throw std::runtime_error("Invalid field size in file: " + filename);
+	}
 
-	State cells(height, std::vector<bool>(width));
+	BitGrid cells(width, height);
 	std::string line;
+	// Остаток строки с размерами
+	std::getline(file, line);
 	for (int y = 0; y < height && std::getline(file, line); ++y)
 	{
-		for (int x = 0; x < width; ++x)
+		const int length = std::min(width, static_cast<int>(line.size()));
+		for (int x = 0; x < length; ++x)
 		{
-			cells[y][x] = (line[x] == '#');
+			if (line[x] == '#')
+			{
+				cells.Set(x, y, true);
+			}
 		}
 	}
-	return { width, height, cells, cells };
+	BitGrid nextState(width, height);
+	return { std::move(cells), std::move(nextState) };
 }
 
 void WriteField(const std::string& filename, const Field& field)
@@ -186,93 +279,116 @@ void WriteField(const std::string& filename, const Field& field)
 		throw std::runtime_error("Can't write to file: " + filename);
 	}
 
-	file << field.width << " " << field.height << "\n";
-	for (const auto& row: field.cells)
+	const BitGrid& cells = field.cells;
+	file << cells.GetWidth() << " " << cells.GetHeight() << "\n";
+	std::string row(cells.GetWidth() + 1, '\n');
+	for (int y = 0; y < cells.GetHeight(); ++y)
 	{
-		for (bool cell: row)
+		for (int x = 0; x < cells.GetWidth(); ++x)
 		{
-			file << (cell ? '#' : ' ');
+			row[x] = cells.Get(x, y) ? '#' : ' ';
 		}
-		file << "\n";
+		file << row;
 	}
 }
 
-void CalculateSection(int startY, int endY,
-	const State& current,
-	State& next,
-	int width, int height)
+void Step(const StepArgs& args)
 {
-	for (int y = startY; y < endY; ++y)
-	{
-		for (int x = 0; x < width; ++x)
-		{
-			int neighbors = 0;
+	Field field = ReadField(args.inFileName);
+	const StepKernel kernel = SelectKernel(args.kernel);
+	StepPool pool(kernel, args.numThread, field.cells, field.nextState);
 
-			for (int dy = -1; dy <= 1; ++dy)
-			{
-				for (int dx = -1; dx <= 1; ++dx)
-				{
-					if (dx == 0 && dy == 0)
-					{
-						continue;
-					}
-
-					int nx = (x + dx + width) % width;
-					int ny = (y + dy + height) % height;
-
-					if (current[ny][nx])
-					{
-						neighbors++;
-					}
-				}
-			}
+	auto start = high_resolution_clock::now();
 
-			next[y][x] = (current[y][x])
-						 ? (neighbors == 2 || neighbors == 3)
-						 : (neighbors == 3);
-		}
-	}
+	pool.Run(1);
+
+	auto duration = duration_cast<milliseconds>(high_resolution_clock::now() - start);
+	std::cout << duration.count() << "ms (kernel: " << kernel.name << ")\n";
+
+	WriteField(args.outFileName.empty() ? args.inFileName : args.outFileName, field);
+}
+
+// out.txt, 100 -> out.100.txt
+std::string GetSnapshotName(const std::string& fileName, int generation)
+{
+	const std::filesystem::path path(fileName);
+	std::filesystem::path snapshot = path.parent_path() / path.stem();
+	snapshot += "." + std::to_string(generation) + path.extension().string();
+	return snapshot.string();
 }
 
-void GenerateNextState(int width, int height, int numThreads, const State& currentState, State& nextState)
+// Общий цикл run: advance(n) считает n поколений, sync переносит результат в field.cells.
+// Со --every K каждые K поколений пишется снимок; время записи в скорость не входит
+template <typename Advance, typename Sync>
+void RunGenerations(const RunArgs& args, Field& field, const std::string& engineInfo, Advance&& advance, Sync&& sync)
 {
-	std::vector<std::jthread> threads;
-	const int rowsPerThread = height / numThreads;
+	const std::string outFileName = args.outFileName.empty() ? args.inFileName : args.outFileName;
 
-	for (int i = 0; i < numThreads; ++i)
+	nanoseconds elapsed{};
+	int done = 0;
+	while (done < args.generations)
 	{
-		int start = i * rowsPerThread;
-		int end = (i == numThreads - 1) ? height : start + rowsPerThread;
-		threads.emplace_back(CalculateSection, start, end,
-			cref(currentState), ref(nextState), width, height);
+		const int chunk = args.every > 0 ? std::min(args.every, args.generations - done) : args.generations - done;
+		auto start = high_resolution_clock::now();
+		advance(chunk);
+		elapsed += high_resolution_clock::now() - start;
+		done += chunk;
+		if (args.every > 0 && done % args.every == 0 && done < args.generations)
+		{
+			sync();
+			WriteField(GetSnapshotName(outFileName, done), field);
+		}
 	}
+	sync();
+
+	const double seconds = duration<double>(elapsed).count();
+	const double cells = static_cast<double>(field.cells.GetWidth()) * field.cells.GetHeight();
+	std::cout << args.generations << " generations in " << duration_cast<milliseconds>(elapsed).count() << "ms"
+			  << " (" << engineInfo << ")\n";
+	if (seconds > 0)
+	{
+		std::cout << args.generations / seconds << " generations/s, "
+				  << args.generations * cells / seconds << " cell updates/s\n";
+	}
+
+	WriteField(outFileName, field);
 }
 
-void Step(const StepArgs& args)
+// Поле читается и пишется один раз, между ними поколения считаются в памяти
+void Run(const RunArgs& args)
 {
 	Field field = ReadField(args.inFileName);
-	const int width = field.width;
-	const int height = field.height;
-
-	auto start = high_resolution_clock::now();
-
-	GenerateNextState(width, height, args.numThread, field.cells, field.nextState);
-
-	auto duration = duration_cast<milliseconds>(high_resolution_clock::now() - start);
-	std::cout << duration.count() << "ms\n";
+	if (args.engine == "hashlife")
+	{
+		// HashLife однопоточный, NUM_THREADS и --kernel ему не нужны
+		HashLife life(field.cells, args.cacheNodes);
+		// Весь прогон проверяется сразу, до первого снимка
+		life.CheckFits(static_cast<uint64_t>(args.generations));
+		RunGenerations(args, field, "engine: hashlife",
+			[&](int generations) { life.Advance(static_cast<uint64_t>(generations)); },
+			[&] { life.WriteTo(field.cells); });
+		std::cout << "Nodes in cache: " << life.GetNodeCount() << "\n";
+		return;
+	}
 
-	field.cells.swap(field.nextState);
-	WriteField(args.outFileName.empty() ? args.inFileName : args.outFileName, field);
+	const StepKernel kernel = SelectKernel(args.kernel);
+	StepPool pool(kernel, args.numThread, field.cells, field.nextState);
+	RunGenerations(args, field, "kernel: " + kernel.name + ", threads: " + std::to_string(pool.GetNumThreads()),
+		[&](int generations) { pool.Run(generations); },
+		[] {});
+	std::cout << "Active tiles: " << pool.TakeActiveFraction() * 100 << "%\n";
 }
 
-void UpdatePixels(int width, int height, State& state, std::vector<sf::Uint8>& pixels)
+void UpdatePixels(const BitGrid& state, std::vector<sf::Uint8>& pixels)
 {
+	const int width = state.GetWidth();
+	const int height = state.GetHeight();
 	for (int y = 0; y < height; ++y)
 	{
 		for (int x = 0; x < width; ++x)
 		{
 			const int idx = (y * width + x) * 4;
-			const sf::Color color = state[y][x] ? ALIVE_COLOR : DEAD_COLOR;
+			const sf::Color color = state.Get(x, y) ? ALIVE_COLOR : DEAD_COLOR;
 			pixels[idx] = color.r;
 			pixels[idx + 1] = color.g;
 			pixels[idx + 2] = color.b;
@@ -280,15 +396,14 @@ void UpdatePixels(int width, int height, State& state, std::vector<sf::Uint8>& p
 	}
 }
 
-void UpdateState(bool paused, sf::Texture& texture, Field& field, int numThread, std::vector<long>& stepTimes, std::vector<sf::Uint8>& pixels )
+void UpdateState(bool paused, sf::Texture& texture, const Field& field, StepPool& pool, std::vector<long>& stepTimes, std::vector<sf::Uint8>& pixels )
 {
 	if (!paused)
 	{
 		//TODO: Переписать
 		auto stepStart = high_resolution_clock::now();
 
-		GenerateNextState(field.width, field.height, numThread, field.cells, field.nextState);
-		field.cells.swap(field.nextState);
+		pool.Run(1);
 
 		auto stepDuration = duration_cast<microseconds>(
 			high_resolution_clock::now() - stepStart
@@ -296,15 +411,17 @@ void UpdateState(bool paused, sf::Texture& texture, Field& field, int numThread,
 		stepTimes.push_back(stepDuration.count());
 	}
 
-	UpdatePixels(field.width, field.height, field.cells, pixels);
+	UpdatePixels(field.cells, pixels);
 	texture.update(pixels.data());
 }
 
 void Visualize(VisualizeArgs args)
 {
 	Field field = ReadField(args.inFileName);
-	const int width = field.width;
-	const int height = field.height;
+	const StepKernel kernel = SelectKernel(args.kernel);
+	StepPool pool(kernel, args.numThread, field.cells, field.nextState);
+	const int width = field.cells.GetWidth();
+	const int height = field.cells.GetHeight();
 
 	sf::RenderWindow window(
 		sf::VideoMode(width * CELL_SIZE, height * CELL_SIZE),
@@ -338,7 +455,7 @@ void Visualize(VisualizeArgs args)
 			}
 		}
 
-		UpdateState(paused, texture, field, args.numThread, stepTimes, pixels);
+		UpdateState(paused, texture, field, pool, stepTimes, pixels);
 
 		auto now = high_resolution_clock::now();
 		if (now - lastTitleUpdate >= 1s)
@@ -351,7 +468,9 @@ void Visualize(VisualizeArgs args)
 
 				window.setTitle("Game of Life - Avg step: "
 								+ std::to_string(avg)
-								+ "ms (Space to pause)");
+								+ "ms, " + kernel.name + ", active tiles: "
+								+ std::to_string(static_cast<int>(pool.TakeActiveFraction() * 100))
+								+ "% (Space to pause)");
 				stepTimes.clear();
 			}
 			lastTitleUpdate = now;
@@ -375,6 +494,8 @@ int main(int argc, char* argv[])
 				{ GenerateField(args); },
 				[](const StepArgs& args)
 				{ Step(args); },
+				[](const RunArgs& args)
+				{ Run(args); },
 				[](const VisualizeArgs& args)
 				{ Visualize(args); }
 			}, args);